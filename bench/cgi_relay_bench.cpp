@@ -0,0 +1,205 @@
+// Throughput of passing a CGI script's stdout to a client socket: the output read into a
+// std::string and sent once the script is done, the way processCgiOutput() used to work, a
+// streamed read()/send() copy through a 64 KB buffer, and ResponseBody's pipe chunk, which
+// splice()s the pipe into the socket. A thread stands in for the script, another for the client
+// draining a loopback TCP connection. Wall-clock throughput is mostly bound by the 64 KB pipe
+// between the script and the server, so the CPU time the relaying thread spends is shown as well.
+//
+//   make bench                         64, 256 and 1024 MB
+//   ./cgi_relay_bench [max_mb] [runs]
+
+#include "ResponseBody.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+enum Relay { COLLECT, COPY, SPLICE, SPLICE_CHUNKED };
+
+static void fail(const char *what) {
+    std::perror(what);
+    std::exit(1);
+}
+
+// a connected loopback TCP pair, the server end non-blocking like a client socket in the event loop
+static void tcpPair(int &server_end, int &client_end) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener == -1 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+        || listen(listener, 1) == -1 || getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) == -1) {
+        fail("listener");
+    }
+    client_end = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client_end, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1) {
+        fail("connect");
+    }
+    server_end = accept(listener, NULL, NULL);
+    if (server_end == -1) {
+        fail("accept");
+    }
+    close(listener);
+    fcntl(server_end, F_SETFL, fcntl(server_end, F_GETFL) | O_NONBLOCK);
+}
+
+static void waitFor(int fd, short events) {
+    struct pollfd state = {fd, events, 0};
+    poll(&state, 1, -1);
+}
+
+static void sendAll(int socket_fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t bytes = send(socket_fd, data, size, 0);
+        if (bytes < 0) {
+            if (errno != EAGAIN) {
+                fail("send");
+            }
+            waitFor(socket_fd, POLLOUT);
+            continue;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+}
+
+static void relay(Relay mode, int pipe_fd, int socket_fd) {
+    if (mode == SPLICE || mode == SPLICE_CHUNKED) {
+        ResponseBody body;
+        body.addPipe(pipe_fd, mode == SPLICE_CHUNKED);
+        while (true) {
+            ResponseBody::Status status = body.writeTo(socket_fd);
+            if (status == ResponseBody::DONE) {
+                return;
+            }
+            if (status == ResponseBody::FAILED) {
+                fail("writeTo");
+            }
+            waitFor(status == ResponseBody::WAITING ? pipe_fd : socket_fd, status == ResponseBody::WAITING ? POLLIN : POLLOUT);
+        }
+    }
+
+    std::string output;
+    char buffer[65536];
+    while (true) {
+        ssize_t bytes = read(pipe_fd, buffer, sizeof(buffer));
+        if (bytes < 0) {
+            if (errno != EAGAIN) {
+                fail("read");
+            }
+            waitFor(pipe_fd, POLLIN);
+            continue;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        if (mode == COPY) {
+            sendAll(socket_fd, buffer, bytes);
+        } else {
+            output.append(buffer, bytes);
+        }
+    }
+    close(pipe_fd);
+    if (mode == COLLECT) {
+        sendAll(socket_fd, output.data(), output.size());
+    }
+}
+
+struct Sample {
+    double mb_per_second;   // from the script's first write until the client has read everything
+    double cpu_ms;          // spent by the relaying thread
+};
+
+static double threadCpuMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static Sample measure(Relay mode, size_t total) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        fail("pipe");
+    }
+    fcntl(pipe_fds[0], F_SETFL, fcntl(pipe_fds[0], F_GETFL) | O_NONBLOCK);
+    int server_end;
+    int client_end;
+    tcpPair(server_end, client_end);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread script([&]() {
+        std::vector<char> block(65536, 'x');
+        for (size_t written = 0; written < total;) {
+            ssize_t bytes = write(pipe_fds[1], block.data(), std::min(block.size(), total - written));
+            if (bytes < 0) {
+                fail("write");
+            }
+            written += bytes;
+        }
+        close(pipe_fds[1]);
+    });
+    std::thread client([&]() {
+        std::vector<char> buffer(1 << 20);
+        while (recv(client_end, buffer.data(), buffer.size(), 0) > 0) {
+        }
+    });
+
+    double cpu = threadCpuMs();
+    relay(mode, pipe_fds[0], server_end);
+    cpu = threadCpuMs() - cpu;
+    shutdown(server_end, SHUT_WR);
+    script.join();
+    client.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    close(server_end);
+    close(client_end);
+    return Sample{total / seconds / (1 << 20), cpu};
+}
+
+// the run with the median throughput
+static Sample median(Relay mode, size_t total, int runs) {
+    std::vector<Sample> samples;
+    for (int i = 0; i < runs; ++i) {
+        samples.push_back(measure(mode, total));
+    }
+    std::sort(samples.begin(), samples.end(), [](const Sample &a, const Sample &b) { return a.mb_per_second < b.mb_per_second; });
+    return samples[samples.size() / 2];
+}
+
+int main(int argc, char **argv) {
+    size_t max_mb = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1024;
+    int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    const char *names[] = {"read+string", "read/send", "splice", "splice chunked"};
+    std::printf("%10s", "size (MB)");
+    for (const char *name : names) {
+        std::printf(" %26s", name);
+    }
+    std::printf("\n%10s", "");
+    for (size_t i = 0; i < 4; ++i) {
+        std::printf(" %12s %13s", "MB/s", "relay cpu ms");
+    }
+    std::printf("\n");
+    for (size_t mb = 64; mb <= max_mb; mb *= 4) {
+        std::printf("%10zu", mb);
+        for (Relay mode : {COLLECT, COPY, SPLICE, SPLICE_CHUNKED}) {
+            Sample sample = median(mode, mb << 20, runs);
+            std::printf(" %12.0f %13.1f", sample.mb_per_second, sample.cpu_ms);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Process start-up latency as the parent grows: fork() + execve(), the way CGI scripts used to be
+// started, against spawnProcess() (posix_spawn), the way they are started now. The parent's heap
+// is grown and touched in steps to stand in for a server with large caches and connection tables.
+//
+//   make bench                    sizes up to 1024 MB
+//   ./spawn_bench [max_mb] [runs]
+
+#include "Spawn.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const char *PROGRAM = "/bin/true";
+
+static pid_t forkExec() {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *const argv[] = {const_cast<char *>(PROGRAM), NULL};
+        execv(PROGRAM, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn() {
+    SpawnOptions options;
+    options.path = PROGRAM;
+    options.argv = {PROGRAM};
+    return spawnProcess(options);
+}
+
+// median microseconds from the call until the child has been reaped
+static double measure(pid_t (*start)(), int runs) {
+    std::vector<double> samples;
+    for (int i = 0; i < runs; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        pid_t pid = start();
+        if (pid == -1) {
+            std::perror("start");
+            std::exit(1);
+        }
+        waitpid(pid, NULL, 0);
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+int main(int argc, char **argv) {
+    size_t max_mb = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1024;
+    int runs = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    std::printf("%10s %16s %16s\n", "rss (MB)", "fork+exec (us)", "posix_spawn (us)");
+    std::vector<char *> blocks;
+    size_t grown = 0;
+    for (size_t target = 0; target <= max_mb; target = target == 0 ? 128 : target * 2) {
+        // touch every page so it is mapped and has to be copied or shared on fork
+        while (grown < target) {
+            char *block = static_cast<char *>(std::malloc(64 << 20));
+            std::memset(block, 1, 64 << 20);
+            blocks.push_back(block);
+            grown += 64;
+        }
+        std::printf("%10zu %16.1f %16.1f\n", grown, measure(forkExec, runs), measure(spawn, runs));
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        std::free(blocks[i]);
+    }
+    return 0;
+}
@@ -5,7 +5,9 @@ import urllib.parse
 
 def main():
     # Output HTTP headers
-    
+    print("Content-Type: text/html")
+    print()
+
     request_method = os.environ.get('REQUEST_METHOD', 'GET')
     
     # Initialize an empty dictionary to hold parameters
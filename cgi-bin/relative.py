@@ -1,3 +1,6 @@
+print("Content-Type: text/plain")
+print()
+
 with open("config.txt", "r") as f:
     config_data = f.read()
 
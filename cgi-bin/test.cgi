@@ -1,5 +1,7 @@
 #!/bin/bash
 
+echo "Content-Type: text/html"
+echo
 echo "<html><body>"
 echo "<h1>CGI Script Test</h1>"
 echo "<p>This is a simple CGI script!</p>"
@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 
+print("Content-Type: text/html")
+print()
 print("<h1>Python CGI Script Test</h1>")
 print("<p>This is a simple Python CGI script!</p>")
 
@@ -1,6 +1,8 @@
 #!/bin/bash
 # A simple bash CGI script that outputs HTML
 
+echo "Content-Type: text/html"
+echo
 echo "<html>"
 echo "<head>"
 echo "<title>Bash CGI Test</title>"
@@ -1,4 +1,6 @@
 #!/usr/bin/env python3
 
+print("Content-Type: text/plain")
+print()
 while (True):
 	print("test")
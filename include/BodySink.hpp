@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <sys/types.h>
+
+// Takes a request body as it comes off the socket, for handlers that consume it while it arrives
+// instead of after all of it has been buffered or spooled. Chosen once the headers are parsed.
+class BodySink {
+    public:
+        virtual ~BodySink() {}
+
+        // create the directories and files the body goes to. runs once, on a disk thread, before the first
+        // write(), a failure is reported by write() and finish()
+        virtual void open() {}
+        // the next piece of the body, 0 or the status the request is rejected with
+        virtual int write(const char *data, size_t size) = 0;
+        // the whole body has been written, 0 or the status the request is rejected with
+        virtual int finish() = 0;
+
+        // a sink that writes the body to a file can take it from the socket with splice(), it never enters user space
+        virtual bool canSplice() const { return false; }
+        // move up to size bytes from the socket, like read(): bytes moved, 0 once the client closed, -1 with errno set
+        virtual ssize_t splice(int fd, size_t size) { (void)fd; (void)size; errno = ENOTSUP; return -1; }
+};
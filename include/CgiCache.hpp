@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ctime>
+#include <unordered_map>
+
+#define CGI_CACHE_MAX_ENTRY (1024 * 1024) // larger script responses are passed through, never stored
+
+// A script's response as it is replayed from the cache. The framing, Date and Connection
+// are added per request.
+struct CachedCgiResponse {
+    std::string                         status;     // "200 OK"
+    std::string                         headers;    // the script's header lines, each ending in "\r\n"
+    std::shared_ptr<const std::string>  body;
+    time_t                              stored = 0; // for the Age header
+
+    size_t bytes() const;
+};
+
+// Per-location micro-cache for GET script responses, shared by all workers. The first
+// miss for a key claims it and runs the script, later requests for the same key wait for that
+// run instead of starting their own and are woken through their worker's eventfd once it ends.
+// A response that must not be cached leaves a pass marker, so requests for it run in parallel
+// again instead of queueing behind each other.
+class CgiCache {
+    public:
+        enum Lookup {
+            HIT,    // out holds a fresh response
+            MISS,   // the caller runs the script and must store(), pass() or abandon() the key
+            WAIT,   // the script is running for another request, notify_fd is signalled when it is done
+            PASS    // the response isn't cacheable, run the script without storing it
+        };
+
+    private:
+        enum State { FILLING, FRESH, PASSING };
+
+        struct Entry {
+            State                               state = FILLING;
+            CachedCgiResponse                   response;   // FRESH
+            time_t                              expires = 0;
+            std::vector<int>                    waiters;    // FILLING: eventfds of workers with requests waiting
+            std::list<std::string>::iterator    lru;        // FRESH and PASSING
+        };
+
+        std::mutex                              _mutex;
+        std::unordered_map<std::string, Entry>  _entries;
+        std::list<std::string>                  _lru; // settled entries, most recently used first
+        size_t                                  _max_size;
+        size_t                                  _size;
+
+        void settle(const std::string &key, Entry &entry);
+        void erase(std::unordered_map<std::string, Entry>::iterator it);
+        void wake(Entry &entry);
+
+    public:
+        explicit CgiCache(size_t max_size);
+        CgiCache(const CgiCache &src) = delete;
+        CgiCache &operator=(const CgiCache &src) = delete;
+
+        Lookup lookup(const std::string &key, time_t now, int notify_fd, CachedCgiResponse &out);
+        // the claimed key's response, kept until expires
+        void store(const std::string &key, CachedCgiResponse response, time_t expires);
+        // the claimed key's response can't be shared, requests for it skip the cache until expires
+        void pass(const std::string &key, time_t expires);
+        // the run failed or its client went away, one of the waiters claims the key next
+        void abandon(const std::string &key);
+};
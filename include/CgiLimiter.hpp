@@ -0,0 +1,65 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <unordered_set>
+
+// Snapshot of a location's admission counters for the status page.
+struct CgiLimiterStats {
+    size_t      running = 0;        // scripts holding a slot, including ones handed a slot that haven't started yet
+    size_t      queued = 0;         // requests waiting for a slot right now
+    size_t      max_concurrency = 0;
+    size_t      queue_size = 0;
+    uint64_t    admitted = 0;       // runs started, right away or after waiting
+    uint64_t    waited = 0;         // of those, the ones that had to queue
+    uint64_t    rejected = 0;       // turned away because the queue was full
+    uint64_t    timed_out = 0;      // gave up in the queue after cgi_queue_timeout
+    double      wait_total_ms = 0;  // queue time of the waited and timed-out requests
+    double      wait_max_ms = 0;
+};
+
+// Per-location cap on concurrently running scripts, shared by all workers. Requests over the cap
+// wait in one FIFO queue. A finishing script hands its slot straight to the request at the front
+// and signals that request's worker through its eventfd, so the running count never overshoots
+// and a wake-up never races a newly arriving request for the slot.
+class CgiLimiter {
+    public:
+        enum Admission {
+            RUN,    // the caller holds a slot and must release() it when its script is done
+            QUEUED, // ticket is in the queue, notify_fd is signalled once it has been handed a slot
+            FULL    // the queue is full, the request is rejected
+        };
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Waiter {
+            uint64_t            ticket;
+            int                 notify_fd;
+            Clock::time_point   since;
+        };
+
+        std::mutex                      _mutex;
+        std::list<Waiter>               _queue;
+        std::unordered_set<uint64_t>    _granted; // tickets handed a slot that haven't claimed it yet
+        uint64_t                        _next_ticket;
+        CgiLimiterStats                 _stats;
+
+        void recordWait(Clock::time_point since);
+
+    public:
+        CgiLimiter(size_t max_concurrency, size_t queue_size);
+        CgiLimiter(const CgiLimiter &src) = delete;
+        CgiLimiter &operator=(const CgiLimiter &src) = delete;
+
+        Admission acquire(int notify_fd, uint64_t &ticket);
+        // true if the ticket was handed a slot, which is the caller's from now on
+        bool claim(uint64_t ticket);
+        // take a ticket out of the queue, false if it was handed a slot in the meantime
+        bool leave(uint64_t ticket, bool timed_out);
+        // a script is done, its slot goes to the first one in the queue
+        void release();
+        CgiLimiterStats stats();
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <ctime>
+#include <sys/types.h>
+
+#define CGI_MAX_BUFFERED (1024 * 1024) // response bytes held for a slow client before its script or backend is paused
+
+// A CGI script running next to the event loop. The parent ends of its pipes are non-blocking
+// and polled by the worker's epoll instance, its exit is noticed through a pidfd, so a slow
+// script only delays its own connection. Its stdout is passed on to the client as it is read. The descriptors are public so the event loop can
+// register them; whoever closes one sets it to -1.
+class CgiProcess {
+    public:
+        pid_t       pid;
+        int         pidfd;      // readable once the child exits, -1 if the kernel has no pidfd_open
+        int         stdin_fd;   // write end of the script's stdin, closed once the body is written
+        int         stdout_fd;
+        int         stderr_fd;
+        int         timeout;    // seconds the script may stay silent
+        time_t      deadline;   // the script is killed if it hasn't sent anything by then, moved on with its output
+
+        std::string input;      // request body fed to the script
+        size_t      input_offset;
+        bool        exited;
+        int         status;     // waitpid() status once exited
+
+        CgiProcess(pid_t child, int stdin_pipe, int stdout_pipe, int stderr_pipe, std::string body, int timeout);
+        CgiProcess(const CgiProcess &src) = delete;
+        CgiProcess &operator=(const CgiProcess &src) = delete;
+        // kills and reaps a script that is still running
+        ~CgiProcess();
+
+        // each returns false once its descriptor is done (EOF, fully written or broken) and can be closed
+        bool writeInput();
+        // one read of what the script wrote to stdout or stderr, appended to data
+        bool readOutput(int fd, std::string &data);
+        // collect the exit status without blocking, true once the child is gone
+        bool reap();
+
+        // the response is complete: the script exited and both output pipes reached EOF
+        bool finished() const { return exited && stdout_fd == -1 && stderr_fd == -1; }
+        void closeFd(int &fd);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "FastCgi.hpp"
+#include "FastCgiPool.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <ctime>
+#include <sys/types.h>
+
+#define CGI_WORKER_IDLE_TIMEOUT 30  // seconds a worker above min_workers may stay idle before it is stopped
+#define CGI_WORKER_EXIT_GRACE 5     // seconds a retired worker gets to exit before it is killed
+
+// Pre-forked interpreters of one event-loop worker. Every interpreter runs a runner program that
+// serves one request at a time as a FastCGI responder on a socketpair, the sockets are handed to
+// the FastCGI connection pool so responses come back through the same event handling as a remote
+// backend. Workers are grouped by interpreter and runner; a group keeps min_workers warm, grows up
+// to max_workers while requests queue up and shrinks again once they sit idle.
+class CgiWorkerPool {
+    public:
+        explicit CgiWorkerPool(FastCgiPool &fastcgi) : _fastcgi(fastcgi) {}
+        CgiWorkerPool(const CgiWorkerPool &src) = delete;
+        CgiWorkerPool &operator=(const CgiWorkerPool &src) = delete;
+        // kills and reaps every worker
+        ~CgiWorkerPool();
+
+        // start the warm workers of a location before the first request arrives
+        void prepare(const CgiWorkerConfig &config);
+        // hand a request to an idle worker, start one, or queue it. false if no worker can be started
+        bool submit(const CgiWorkerConfig &config, int client_fd, FastCgiParams params, std::string stdin_data);
+        // the client's response is complete, its worker takes the next queued request
+        void finished(int client_fd);
+        // the client went away or timed out: a queued request is dropped, a running script is killed with its worker
+        void cancel(int client_fd);
+        // reap exited workers, stop idle ones above min_workers and start replacements
+        void maintain(time_t now);
+
+    private:
+        struct Worker {
+            pid_t       pid = -1;
+            std::string address;            // name of its socket in the FastCGI pool
+            int         client_fd = -1;     // client whose request it is running, -1 while idle
+            size_t      served = 0;
+            time_t      idle_since = time(NULL);
+        };
+
+        struct Pending {
+            int             client_fd;
+            FastCgiParams   params;
+            std::string     stdin_data;
+        };
+
+        struct Group {
+            CgiWorkerConfig     config;
+            std::vector<Worker> workers;
+            std::deque<Pending> queue;
+        };
+
+        FastCgiPool                                     &_fastcgi;
+        std::unordered_map<std::string, Group>          _groups;    // interpreter + runner ->
+        std::unordered_map<int, std::string>            _clients;   // client fd -> group, while queued or running
+        std::vector<std::pair<pid_t, time_t>>           _exiting;   // retired workers not reaped yet, with their deadline
+
+        Group &group(const CgiWorkerConfig &config);
+        bool spawn(Group &group);
+        bool dispatch(Worker &worker, Pending &pending);
+        void dispatchQueued(Group &group);
+        void retire(Group &group, size_t index, bool kill_now);
+        bool needsRecycling(const Group &group, const Worker &worker) const;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DISK_QUEUE_SIZE 1024 // jobs waiting for a disk thread before new ones run on the event loop again
+
+// Filesystem work of one request. It runs on a disk thread and may only touch what it captured,
+// the request it belongs to can be gone by the time it finishes.
+struct DiskJob {
+    std::function<void()>   work;
+    int                     notify_fd; // eventfd of the worker whose request waits for the job, -1 if none does
+    std::atomic<bool>       done{false};
+
+    DiskJob(std::function<void()> job_work, int fd) : work(std::move(job_work)), notify_fd(fd) {}
+};
+
+// Threads that stat, open, read, list and delete files for the event loops of every worker, so a cold
+// page cache or a slow disk stalls the request waiting for it instead of all connections of its worker.
+// A finished job signals the eventfd of its worker, which picks up its waiting requests from there.
+class DiskPool {
+    private:
+        std::mutex                              _mutex;
+        std::condition_variable                 _ready;
+        std::deque<std::shared_ptr<DiskJob>>    _queue;
+        std::vector<std::thread>                _threads;
+        size_t                                  _max_queued;
+        bool                                    _stopping;
+
+        void run();
+
+    public:
+        DiskPool(size_t threads, size_t max_queued = DISK_QUEUE_SIZE);
+        DiskPool(const DiskPool &src) = delete;
+        DiskPool &operator=(const DiskPool &src) = delete;
+        ~DiskPool();
+
+        // queue the work, notify_fd is signalled once it is done. nullptr if the pool has no threads
+        // or its queue is full, the caller does the work itself then
+        std::shared_ptr<DiskJob> submit(std::function<void()> work, int notify_fd);
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <ctime>
+
+// FastCGI 1.0 record types
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_STDERR             7
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT  10
+
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_HEADER_SIZE        8
+#define FCGI_MAX_CONTENT        65535
+
+typedef std::vector<std::pair<std::string, std::string>> FastCgiParams;
+
+// Scripts of a location run by pre-forked interpreters instead of a process per request. Each
+// interpreter runs the runner program, which serves requests as a FastCGI responder on its stdin
+struct CgiWorkerConfig {
+    std::string     interpreter;    // cgi_path of the script's extension
+    std::string     runner;         // program the interpreter runs, empty if a process is started per request
+    size_t          min_workers;    // started up front and kept running while idle
+    size_t          max_workers;    // the pool grows up to this many while requests queue up
+    size_t          max_requests;   // a worker is replaced after this many requests
+    size_t          max_memory;     // or once its resident memory grows beyond this many bytes
+};
+
+// A request for a FastCGI backend, built by Request and handed to the worker's connection pool
+struct FastCgiRequest {
+    std::string     address;    // "unix:/path/to.sock" or "host:port"
+    CgiWorkerConfig worker;     // runner set: served by the pre-forked CGI workers, address is unused
+    FastCgiParams   params;     // the CGI/1.1 environment
+    std::string     stdin_data; // the request body
+    int             timeout;    // seconds the backend may stay silent
+    time_t          deadline;   // the request is aborted (504, or the connection cut) if no output arrived by then
+};
+
+// One record as it came off the wire, padding already stripped
+struct FastCgiRecord {
+    uint8_t     type = 0;
+    uint16_t    request_id = 0;
+    std::string content;
+};
+
+// Resumable record decoder. The connection's read buffer is handed in after every read,
+// complete records are taken from the front and only a partial one is left behind.
+class FastCgiParser {
+    public:
+        FastCgiParser() : _offset(0) {}
+
+        // the next complete record in the buffer, false if more bytes are needed
+        bool next(std::string &buffer, FastCgiRecord &record);
+
+    private:
+        size_t  _offset; // bytes at the front of the buffer already decoded
+};
+
+// encoders, everything is appended to a connection's output buffer
+void fastcgiAppendRecord(std::string &out, uint8_t type, uint16_t request_id, const char *data, size_t length);
+void fastcgiAppendBeginRequest(std::string &out, uint16_t request_id, bool keep_conn);
+// a stream (FCGI_PARAMS, FCGI_STDIN) split into records and closed with an empty one
+void fastcgiAppendStream(std::string &out, uint8_t type, uint16_t request_id, const std::string &data);
+std::string fastcgiEncodeParams(const FastCgiParams &params);
+FastCgiParams fastcgiDecodeParams(const std::string &content);
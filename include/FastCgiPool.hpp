@@ -0,0 +1,96 @@
+#pragma once
+
+#include "FastCgi.hpp"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+
+#define FASTCGI_KEEPALIVE 8         // idle backend connections kept open per address and worker
+#define FASTCGI_MAX_MULTIPLEX 16    // requests in flight on one connection if the backend multiplexes
+
+// The FastCGI backend connections of one worker. Connections are opened on demand, kept
+// alive between requests and reused; a backend that announces FCGI_MPXS_CONNS gets several
+// requests per connection. The sockets are registered with the worker's epoll instance,
+// which hands their events back through handleEvent().
+class FastCgiPool {
+    public:
+        // what happened to a request, for the event loop to pass on to its client
+        struct Event {
+            enum Type {
+                STDOUT, // a piece of the response
+                STDERR, // a piece of the backend's error log
+                END,    // the response is complete
+                FAILED  // the backend went away or refused the request
+            };
+
+            Type        type;
+            int         client_fd;
+            std::string data;
+        };
+
+        FastCgiPool();
+        FastCgiPool(const FastCgiPool &src) = delete;
+        FastCgiPool &operator=(const FastCgiPool &src) = delete;
+        ~FastCgiPool();
+
+        // the epoll instance the backend sockets are registered with
+        void attach(int epoll_fd) { _epoll_fd = epoll_fd; }
+        bool owns(int fd) const { return _connections.count(fd) > 0; }
+
+        // take over a socket that is already connected, like a pre-forked worker's end of a socketpair.
+        // it is reused like any other connection but never connected to again or closed for being idle
+        bool adopt(int fd, const std::string &address);
+        bool hasConnection(const std::string &address) const;
+        // close the connection to address, its requests are dropped without events
+        void disconnect(const std::string &address);
+
+        // send a request on behalf of a client, false if no connection could be set up
+        bool submit(const std::string &address, int client_fd, const FastCgiParams &params, const std::string &stdin_data);
+        // the client went away or the request timed out, its output is dropped from now on
+        void abort(int client_fd);
+        // stop and restart reading a client's connection while its response can't be sent fast enough
+        void pause(int client_fd);
+        void resume(int client_fd);
+        bool isPaused(int client_fd) const;
+
+        // do the socket's I/O and collect what happened to the requests on it
+        void handleEvent(int fd, uint32_t events, std::vector<Event> &out);
+
+        // "unix:/path" or "host:port" understood by submit(), checked when the config is read
+        static bool isValidAddress(const std::string &address);
+
+    private:
+        struct Connection {
+            int                                     fd = -1;
+            std::string                             address;
+            bool                                    connecting = true;
+            bool                                    multiplexed = false; // the backend answered FCGI_MPXS_CONNS=1
+            bool                                    adopted = false;     // handed in through adopt()
+            std::string                             write_buffer;
+            size_t                                  write_offset = 0;    // cursor into write_buffer
+            std::string                             read_buffer;
+            FastCgiParser                           parser;
+            std::unordered_map<uint16_t, int>       requests;            // request id -> client fd
+            std::set<uint16_t>                      paused;              // requests whose client is behind
+            uint16_t                                next_id = 1;
+            uint32_t                                events = 0;          // what epoll currently reports
+        };
+
+        int                                                 _epoll_fd;
+        std::unordered_map<int, Connection>                 _connections; // socket fd ->
+        std::unordered_map<int, std::pair<int, uint16_t>>   _clients;     // client fd -> socket fd, request id
+
+        Connection *acquire(const std::string &address);
+        Connection *connectTo(const std::string &address);
+        bool flush(Connection &conn);
+        bool receive(Connection &conn, std::vector<Event> &out);
+        void handleRecord(Connection &conn, FastCgiRecord &record, std::vector<Event> &out);
+        void finishRequest(Connection &conn, uint16_t request_id);
+        void updateEvents(Connection &conn);
+        void fail(Connection &conn, std::vector<Event> &out);
+        void closeConnection(int fd);
+        size_t idleConnections(const std::string &address) const;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <sys/stat.h>
+
+#define FILE_CACHE_MAX_ENTRIES 512 // per worker, every cached regular file keeps one fd open
+
+// An open read-only file descriptor shared by the cache and the responses sending it.
+// sendfile() is always given its own offset, so one fd can serve many connections at once.
+struct OpenFile {
+    int         fd;
+    std::string content_hash; // filled in on first use by locations with content-based ETags
+
+    explicit OpenFile(int file_fd) : fd(file_fd) {}
+    ~OpenFile();
+    OpenFile(const OpenFile &src) = delete;
+    OpenFile &operator=(const OpenFile &src) = delete;
+};
+
+// What the GET path needs to know about a path on disk
+struct FileCacheEntry {
+    bool                        exists = false; // false is a cached ENOENT
+    struct stat                 st = {};
+    std::shared_ptr<OpenFile>   file; // set for regular files only
+    int                         error = 0; // errno of a path that doesn't exist or can't be opened
+};
+
+// Bounded LRU cache of stat results, open fds and negative entries, keyed by resolved path.
+// Each worker owns one, so it is never locked. The directories holding cached paths are
+// watched with inotify and every change invalidates the affected entries.
+class FileCache {
+    private:
+        struct Node {
+            FileCacheEntry                      entry;
+            std::list<std::string>::iterator    lru_pos;
+        };
+
+        size_t                                  _max_entries;
+        int                                     _inotify_fd;
+        std::unordered_map<std::string, Node>   _entries;
+        std::list<std::string>                  _lru; // most recently used first
+        std::unordered_map<int, std::string>    _watch_dirs; // watch descriptor -> directory
+        std::unordered_map<std::string, int>    _dir_watches; // directory -> watch descriptor
+        uint64_t                                _generation; // bumped by every batch of inotify events
+
+        bool watchParent(const std::string &path);
+        void insert(const std::string &path, const FileCacheEntry &entry);
+        void invalidate(const std::string &path);
+        void invalidatePrefix(const std::string &dir);
+        void clear();
+
+    public:
+        FileCache(size_t max_entries = FILE_CACHE_MAX_ENTRIES);
+        FileCache(const FileCache &src) = delete;
+        FileCache &operator=(const FileCache &src) = delete;
+        ~FileCache();
+
+        // a lookup in steps, so a miss can be loaded off the event loop: find() answers hits, load() stats
+        // (and opens) the path touching nothing but the disk, and store() keeps its result unless files
+        // changed since generation()
+        bool find(const std::string &path, FileCacheEntry &entry);
+        static FileCacheEntry load(const std::string &path);
+        uint64_t generation() const { return _generation; }
+        void store(const std::string &path, const FileCacheEntry &entry, uint64_t generation);
+
+        // the inotify descriptor the owning event loop polls for readability
+        int getInotifyFd() const { return _inotify_fd; }
+        // drain pending inotify events and drop the entries they affect
+        void handleEvents();
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "BodySink.hpp"
+
+#include <string>
+
+// mkdir -p: every missing directory of path is created, false (and logged) if one can't be
+bool createDirectories(const std::string &path);
+
+// A request body written into a file from some offset on. What passed through the read buffer is
+// written with pwrite(). Once the body stops passing through it, the rest goes socket -> pipe -> file
+// with splice() and never enters user space: QueuedSink fills the pipe on the event loop, drain()
+// empties it into the file on a disk thread. The sink owns the descriptor it is given.
+class FileSink : public BodySink {
+    protected:
+        std::string _path; // named in error messages
+        int         _fd;
+        off_t       _offset; // where the next byte goes
+        int         _status; // first error, every later call returns it
+
+        virtual void fail(int status, const char *what);
+
+    public:
+        FileSink(const std::string &path, int fd, off_t offset);
+        FileSink(const FileSink &src) = delete;
+        FileSink &operator=(const FileSink &src) = delete;
+        ~FileSink() override;
+
+        int write(const char *data, size_t size) override;
+        // move size bytes the body was spliced into pipe with to the file, 0 or the status the request is rejected with
+        int drain(int pipe, size_t size);
+};
+
+// A raw request body written to one file, e.g. the body of a PUT. The file is written under a
+// temporary name next to its destination and renamed over it once the body is complete, so readers
+// see the old file or the whole new one and an aborted upload leaves nothing behind. With
+// Content-Length known, the space is reserved up front.
+class FileUpload : public FileSink {
+    private:
+        std::string _tmp_path;
+        size_t      _size; // bytes reserved by open()
+        bool        _replaced; // the destination existed before the upload was renamed over it
+
+        void fail(int status, const char *what) override;
+
+    public:
+        explicit FileUpload(const std::string &path, size_t size = 0);
+        ~FileUpload() override;
+
+        // create the temporary file, and the directories of the destination, with size bytes reserved
+        // if size isn't 0. a failure is reported by the first write() or finish()
+        bool open(size_t size);
+        void open() override { open(_size); }
+
+        int finish() override;
+
+        bool replaced() const { return _replaced; }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "SpooledBody.hpp"
+#include "BodySink.hpp"
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+#define MAX_HEADER_SIZE 32768 // request line plus headers, anything larger is rejected
+#define MAX_CHUNK_LINE 4096 // a chunk size line with its extensions
+
+// A request as it came off the wire, split into its parts exactly once
+struct HttpRequest {
+    std::string method;
+    std::string target;
+    std::string version;
+    std::unordered_map<std::string, std::string> headers; // keys are lowercased
+    size_t content_length = 0;
+    std::string body;
+    std::unique_ptr<SpooledBody> spooled_body; // set instead of body when it was larger than client_body_buffer_size
+    std::unique_ptr<BodySink> body_sink; // set if the body's handler took it as it arrived, body stays empty
+    int error_status = 0; // set if the parser rejected the request, what it is answered with
+
+    // value of a header (name in lowercase), or an empty string if the client did not send it
+    std::string getHeader(const std::string &name) const;
+};
+
+// Resumable HTTP/1.x request parser. It is fed the connection's growing read buffer
+// after every read and only looks at bytes it has not seen before.
+class HttpParser {
+    public:
+        enum State {
+            REQUEST_LINE,   // waiting for the request line
+            HEADERS,        // reading header lines
+            HEADERS_DONE,   // a body follows, the caller may give it a sink before startBody()
+            BODY,           // headers done, counting body bytes
+            COMPLETE,       // a full request is available
+            ERROR           // the request is malformed
+        };
+
+        HttpParser();
+
+        // continue parsing the buffer from where the previous call stopped. the body of a request
+        // larger than the body buffer size is moved from the buffer into a temporary file, a chunked
+        // one is decoded and moved out of the buffer as it arrives. a body given a sink goes there as it arrives
+        State parse(std::string &buffer);
+        void setBodyBufferSize(size_t size) { _body_buffer_size = size; }
+        // read the body once the headers are done, into sink if there is one. a chunked body growing
+        // past max_size is rejected with 413 before the rest of it is read
+        void startBody(std::unique_ptr<BodySink> sink, size_t max_size);
+        // answer the request with status without reading its body, the request line and headers are kept
+        void rejectBody(int status);
+        // a Content-Length body whose sink can take it from the socket, and none of it is left in the buffer
+        bool canSplice(const std::string &buffer) const;
+        // move the next part of the body from the socket into the sink, like read(): bytes moved,
+        // 0 if the client closed the connection, -1 with errno set. a failed sink fails the request
+        ssize_t spliceBody(int fd);
+
+        State getState() const { return _state; }
+        bool readingHeaders() const { return _state == REQUEST_LINE || _state == HEADERS; }
+        // the request line and headers while the request is still being read
+        const HttpRequest &getRequest() const { return _request; }
+        // bytes at the front of the buffer that belong to the completed request
+        size_t getRequestLength() const { return _body_start + (_spooling || _chunked || _request.body_sink ? 0 : _request.content_length); }
+        // hand the parsed request over, the parser must be reset before it is used again
+        HttpRequest takeRequest();
+        // forget everything and get ready for the next request on the connection
+        void reset();
+
+    private:
+        enum ChunkState {
+            CHUNK_SIZE,     // the size line of the next chunk
+            CHUNK_DATA,     // _chunk_left bytes of data
+            CHUNK_DATA_END, // the CRLF after them
+            CHUNK_TRAILER   // trailer fields after the last chunk, up to an empty line
+        };
+
+        State       _state;
+        size_t      _line_start; // start of the line currently being read
+        size_t      _scan_pos;   // where the search for the end of that line resumes
+        size_t      _body_start; // offset of the first body byte once headers are complete
+        size_t      _body_buffer_size; // larger bodies are spooled, kept across requests
+        size_t      _max_body_size; // of the request being read
+        bool        _spooling; // the body goes to _request.spooled_body, none of it stays in the buffer
+        bool        _chunked; // the body is decoded into _request.body or the spool file, none of it stays in the buffer
+        ChunkState  _chunk_state;
+        size_t      _chunk_left;
+        size_t      _trailer_size;
+        size_t      _body_size; // decoded, spooled or sunk body bytes so far
+        HttpRequest _request;
+
+        bool parseRequestLine(const std::string &line);
+        bool parseHeaderLine(const std::string &line);
+        int finishHeaders();
+        State drainBody(std::string &buffer);
+        bool startSpool();
+        int storeBody(const char *data, size_t size);
+        State decodeChunked(std::string &buffer);
+        State finishBody();
+        State finishChunked();
+        State fail(int status = 400);
+};
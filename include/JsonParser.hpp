@@ -5,6 +5,14 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include "FastCgi.hpp"
+
+class ResponseCache;
+class CgiCache;
+class CgiLimiter;
+class UploadSessions;
 
 // Configuration structure for a server's location block
 struct LocationConfig {
@@ -15,9 +23,39 @@ struct LocationConfig {
     std::string root;
     bool autoindex = true;
     std::string upload_path;
+    size_t max_body_size = SIZE_MAX; // client_max_body_size of the location, the server's if it sets none
+    bool resumable_uploads = false; // files under upload_path can be uploaded in parts over several requests
+    size_t resumable_max_size = 10ULL * 1024 * 1024 * 1024; // largest file a resumable upload may announce
+    int resumable_timeout = 3600; // seconds an upload nobody writes to is kept before it is dropped
+    std::shared_ptr<UploadSessions> upload_sessions; // shared by every copy of this location
     std::vector<std::string> cgi_extension;
     std::vector<std::string> cgi_path;
     std::string index;
+    int cgi_timeout = 30; // seconds a CGI script may go without output before it is killed with a 504
+    std::string fastcgi_pass; // "unix:/path" or "host:port" of a FastCGI backend serving the whole location
+    std::vector<std::string> cgi_worker_runner; // per cgi_extension: program run by pre-forked interpreters, "" starts one per request
+    size_t cgi_workers = 2; // pre-forked interpreters kept warm per runner and event loop
+    size_t cgi_workers_max = 8; // the pool grows up to this while requests queue up
+    size_t cgi_worker_requests = 1000; // requests a pre-forked interpreter serves before it is replaced, 0 for no limit
+    size_t cgi_worker_memory = 256 * 1024 * 1024; // resident memory above which it is replaced, 0 for no limit
+
+    // the worker pool settings for the interpreter of cgi_extension[index]
+    CgiWorkerConfig cgiWorkerConfig(size_t index) const {
+        return CgiWorkerConfig{cgi_path[index], cgi_worker_runner[index], cgi_workers, cgi_workers_max, cgi_worker_requests, cgi_worker_memory};
+    }
+    int cgi_cache_ttl = 0; // seconds a script's response to GET is replayed, 0 disables the CGI cache
+    std::vector<std::string> cgi_cache_key_headers; // request headers that are part of the CGI cache key besides method, path and query
+    size_t cgi_cache_max_size = 16 * 1024 * 1024; // bytes of script responses kept in memory
+    std::shared_ptr<CgiCache> cgi_cache; // shared by every copy of this location
+    size_t cgi_max_concurrency = 0; // scripts of the location running at once across all workers, 0 for no limit
+    size_t cgi_queue_size = 100; // requests waiting for one of them before the rest get a 503
+    int cgi_queue_timeout = 10; // seconds a request may wait in that queue before it gets a 503
+    std::shared_ptr<CgiLimiter> cgi_limiter; // shared by every copy of this location
+    bool cgi_status = false; // the location answers with the CGI admission counters of every location
+    size_t cache_max_size = 0; // bytes of static responses kept in memory, 0 disables the cache
+    size_t cache_max_file_size = 1024 * 1024; // larger files are always sent from disk
+    std::shared_ptr<ResponseCache> response_cache; // shared by every copy of this location
+    bool etag_content_hash = false; // derive ETags from the file contents instead of inode/size/mtime
 };
 
 // Configuration structure for a server block
@@ -27,19 +65,33 @@ struct ServerConfig {
     std::string server_name;
     std::unordered_map<int, std::string> error_pages;
     std::string client_max_body_size = "1M";
+    size_t max_body_size = 1024 * 1024; // client_max_body_size in bytes
+    size_t client_body_buffer_size = 1024 * 1024; // larger request bodies are written to a temporary file as they arrive
+    int keepalive_timeout = 75; // seconds an idle persistent connection is kept, 0 disables keep-alive
+    int keepalive_requests = 1000; // requests served on one connection before it is closed
     std::vector<LocationConfig> locations;
 };
 
+// Process-wide settings that live at the root of the configuration
+struct GlobalConfig {
+    int workers = 0; // number of event-loop threads, 0 means one per CPU
+    bool worker_cpu_affinity = false; // pin each event-loop thread to its own CPU
+    int disk_threads = 4; // threads doing the file system work of requests for all workers, 0 keeps it on the event loops
+};
+
 // JsonParser class to parse server configurations from input
 class JsonParser {
     private:
         std::string input_;
         size_t pos_;
+        GlobalConfig global_;
 
         // Helper methods to extract values from the input
         std::string getNextString();
         int getNextInt();
+        int getNextNonNegative(const std::string &key);
         bool getNextBool();
+        size_t getNextSize();
         std::vector<std::string> getNextStringArray();
         void expect(char expected);
         void skipWhitespace();
@@ -52,4 +104,7 @@ class JsonParser {
     public:
         JsonParser(const std::string& input) : input_(input), pos_(0) {}
         std::vector<ServerConfig> parse();
+        const GlobalConfig& getGlobalConfig() const { return global_; }
+        // "512", "64K", "10M" or "1G" in bytes, throws if it is none of those
+        static size_t parseSize(const std::string &size);
 };
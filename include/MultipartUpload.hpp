@@ -0,0 +1,60 @@
+#pragma once
+
+#include "BodySink.hpp"
+
+#include <string>
+
+#define MAX_PART_HEADERS 8192 // header block of one part of a multipart body
+#define MAX_DELIMITER_LINE 256 // transport padding after a boundary
+
+// A multipart/form-data body (RFC 7578) parsed as it arrives. File parts are written to the upload
+// directory piece by piece, other fields are skipped, so memory use doesn't depend on the upload size.
+// Boundaries are found with Boyer-Moore-Horspool. The last few bytes of a piece that could be the
+// start of a boundary are held back until the next piece shows whether they are.
+class MultipartUpload : public BodySink {
+    private:
+        enum State {
+            PREAMBLE,       // before the first boundary, ignored
+            DELIMITER_END,  // after a boundary: "--" for the last one, otherwise CRLF
+            PART_HEADERS,   // header block of a part, up to an empty line
+            PART_DATA,      // content of a part, up to the next boundary
+            EPILOGUE        // after the last boundary, ignored
+        };
+
+        std::string _delimiter; // CRLF "--" boundary
+        size_t      _skip[256]; // Horspool shift for every byte value
+        std::string _dir;
+        State       _state;
+        std::string _lookbehind; // tail of the previous piece that may start a delimiter
+        std::string _line; // delimiter padding or part headers read so far
+        int         _status; // first error, the rest of the body is ignored after it
+
+        int         _fd; // file the current part is written to, -1 for fields that aren't files
+        std::string _tmp_path; // where it is written, renamed to _file_path once it is complete
+        std::string _file_path;
+
+        size_t search(const char *text, size_t size) const;
+        size_t scanData(const char *data, size_t size);
+        size_t readDelimiterEnd(const char *data, size_t size);
+        size_t readHeaders(const char *data, size_t size);
+        void emit(const char *data, size_t size);
+        void startPart(const std::string &headers);
+        void endPart();
+        void fail(int status);
+
+    public:
+        // files are stored in dir, which open() creates
+        MultipartUpload(const std::string &boundary, const std::string &dir);
+        MultipartUpload(const MultipartUpload &src) = delete;
+        MultipartUpload &operator=(const MultipartUpload &src) = delete;
+        ~MultipartUpload();
+
+        void open() override;
+        int write(const char *data, size_t size) override;
+        int finish() override;
+
+        // boundary parameter of a multipart/form-data Content-Type, empty if there is none
+        static std::string boundary(const std::string &contentType);
+        // file name of a part as the client sent it, without any directories
+        static std::string filename(const std::string &partHeaders);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "BodySink.hpp"
+#include "DiskPool.hpp"
+#include "FileUpload.hpp"
+
+#include <memory>
+#include <string>
+
+#define UPLOAD_SPLICE_SIZE (1024 * 1024) // most bytes moved from the socket into the pipe per splice() round
+
+// Stands between the parser and a sink that writes to disk, so none of the writing, creating or renaming
+// runs on the event loop. What the parser writes is queued in memory, what it splices only goes from the
+// socket into a pipe. flush() hands all of it, and finish() once it was called, to the sink on a disk
+// thread; the connection isn't read while that runs, so no more than one read's worth is ever queued.
+class QueuedSink : public BodySink {
+    private:
+        // the pipe goes with the disk job that empties it, the connection may be closed before it is done
+        struct Pipe {
+            int fds[2] = {-1, -1};
+            ~Pipe();
+        };
+
+        std::shared_ptr<BodySink>   _target;
+        FileSink                    *_file; // the target, if a pipe can be spliced into it
+        DiskPool                    *_pool;
+        int                         _notify_fd;
+        std::string                 _queued; // written since the last flush
+        std::shared_ptr<Pipe>       _pipe; // created for the first splice()
+        size_t                      _piped; // bytes spliced into it since the last flush
+        bool                        _finishing; // finish() was called, the target's runs with the next flush
+        std::shared_ptr<int>        _status; // result of the last flush, only read once it is done
+
+    public:
+        // without a pool, or with its queue full, a flush runs right away
+        QueuedSink(std::unique_ptr<BodySink> target, DiskPool *pool, int notify_fd);
+        QueuedSink(const QueuedSink &src) = delete;
+        QueuedSink &operator=(const QueuedSink &src) = delete;
+        ~QueuedSink() override;
+
+        int write(const char *data, size_t size) override;
+        int finish() override;
+        bool canSplice() const override;
+        ssize_t splice(int fd, size_t size) override;
+
+        // something was written, spliced or finished since the last flush
+        bool pending() const { return !_queued.empty() || _piped > 0 || _finishing; }
+        // pass it on to the target on a disk thread, notify_fd is signalled once that is done. nullptr if it
+        // was done right here
+        std::shared_ptr<DiskJob> flush();
+        // 0, or the status the request is rejected with, once the last flush is done
+        int status() const { return *_status; }
+
+        BodySink *target() const { return _target.get(); }
+};
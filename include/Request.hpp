@@ -1,17 +1,52 @@
 #pragma once
 
 #include "JsonParser.hpp"
+#include "HttpParser.hpp"
+#include "FileCache.hpp"
+#include "ResponseCache.hpp"
+#include "CgiCache.hpp"
+#include "CgiLimiter.hpp"
+#include "ResponseBody.hpp"
+#include "CgiProcess.hpp"
+#include "MultipartUpload.hpp"
+#include "FileUpload.hpp"
+#include "QueuedSink.hpp"
+#include "UploadSessions.hpp"
+#include "FastCgi.hpp"
+#include "DiskPool.hpp"
 #include <string>
 #include <vector>
+#include <functional>
 
 const std::string HTTP_200 = "200 OK";
+const std::string HTTP_201 = "201 Created";
+const std::string HTTP_206 = "206 Partial Content";
+const std::string HTTP_304 = "304 Not Modified";
 const std::string HTTP_400 = "400 Bad Request";
 const std::string HTTP_403 = "403 Forbidden";
 const std::string HTTP_404 = "404 Not Found";
 const std::string HTTP_405 = "405 Method Not Allowed";
+const std::string HTTP_409 = "409 Conflict";
 const std::string HTTP_413 = "413 Payload Too Large";
 const std::string HTTP_415 = "415 Unsupported Media Type";
+const std::string HTTP_416 = "416 Range Not Satisfiable";
+const std::string HTTP_417 = "417 Expectation Failed";
 const std::string HTTP_500 = "500 Internal Server Error";
+const std::string HTTP_501 = "501 Not Implemented";
+const std::string HTTP_502 = "502 Bad Gateway";
+const std::string HTTP_503 = "503 Service Unavailable";
+const std::string HTTP_504 = "504 Gateway Timeout";
+
+#define MAX_RANGES 32 // Range headers with more parts than this are ignored
+
+// What the headers of a request say about its body, decided before any of it is read
+struct BodyRoute {
+    int							status = 0; // answer with this right away instead of reading the body
+    bool						send_continue = false; // the client waits for 100 Continue before it sends the body
+    size_t						max_size = SIZE_MAX; // client_max_body_size of the location
+    std::unique_ptr<BodySink>	sink; // takes the body as it arrives, nullptr to buffer or spool it
+    bool						open_sink = false; // sink->open() has to run, on a disk thread, before the body is read
+};
 
 class Request
 {
@@ -23,15 +58,41 @@ class Request
         std::string					_url;
         std::string					_http_version;
 
-        std::string					_request;
-        std::string					_response;
-
-        std::string					_body;
-        ssize_t    					_max_body_size;
-
-        std::string					_headers;
+        HttpRequest					_request; // request line, headers and body as parsed by HttpParser
+        std::string					_response; // status line and headers
+        ResponseBody				_body; // sent after _response: in-memory data, file regions or a pipe
+        std::unique_ptr<CgiProcess>	_cgi; // script still running, its response is streamed in as it writes
+        std::unique_ptr<FastCgiRequest>	_fastcgi; // request for a FastCGI backend, its response is streamed in
+
+        std::string					_cgi_header_buffer; // start of a streamed CGI response until its header block is complete
+        bool						_cgi_headers_done = false;
+        bool						_cgi_chunked = false; // the script sent no Content-Length, the body is chunk-encoded
+        bool						_cgi_relayed = false; // the rest of the script's stdout is spliced to the client, framing included
+        bool						_cgi_bodiless = false; // 1xx, 204 or 304: no framing, the script's body is dropped
+
+        LocationConfig				*_cgi_location = nullptr; // location whose script answers the request
+        std::string					_cgi_cache_key; // set if the response may come from or go into the location's CGI cache
+        bool						_cgi_cache_waiting = false; // another request is running the script, woken through _cgi_cache_fd
+        bool						_cgi_cache_filling = false; // this request claimed the key, its response is captured for the cache
+        CachedCgiResponse			_cgi_cache_entry; // status and headers of the captured response
+        std::string					_cgi_cache_body;
+        time_t						_cgi_cache_expires = 0;
+        bool						_cgi_slot = false; // holds one of the location's CGI slots until the request is done
+        bool						_cgi_queued = false; // waiting for a slot, woken through _cgi_queue_fd once it was handed one
+        uint64_t					_cgi_queue_ticket = 0;
+        time_t						_cgi_queue_deadline = 0; // answered with a 503 if it is still queued by then
 
         int							_port;
+        size_t						_request_count; // position of this request on its connection, starting at 1
+        FileCache					*_file_cache; // stat/open cache of the worker handling the request
+        int							_cgi_cache_fd; // eventfd of the worker, signalled when a CGI cache entry it waits for is settled
+        int							_cgi_queue_fd; // eventfd of the worker, signalled when a queued CGI request was handed a slot
+        DiskPool					*_disk_pool; // threads the file system work of GET, POST and DELETE runs on, nullptr to do it inline
+        int							_disk_fd; // eventfd of the worker, signalled when a disk job of one of its requests is done
+        std::shared_ptr<DiskJob>	_disk_job; // file system work the request waits for
+        std::function<void()>		_disk_done; // continues the request on the event loop once that work is done
+
+        bool _keep_alive = false;
 
         bool _needs_redirect = false;
         bool _response_ready = false;
@@ -39,72 +100,154 @@ class Request
         // Updated method signature
         ServerConfig* selectServerConfig(const std::string &host_header);
 
-        // Header Parsing and Request Handling
-        void ParseHeadersAndBody(); // Split headers and body parsing logic
-        std::string ExtractRequestLine(); // Extract the request line from headers
+        // Request Handling
         void HandleRequest(); // Handle request after selecting the config
+        bool ShouldKeepAlive(); // Decide if the connection stays open after this response
 
         // URL Parsing and Normalization
-        void ParseLine(const std::string &line);
+        void ParseLine();
         void NormalizeURL();
 
+        // Disk I/O, done on the disk threads while the event loop goes on with other connections
+        void offloadDisk(std::function<void()> work, std::function<void()> done); // Run work on a disk thread, then done on the event loop
+        void lookupFile(const std::string &path, std::function<void(const FileCacheEntry &)> then); // File cache lookup, a miss is loaded on a disk thread
+        void ServeFallbackErrorPage(int error_code); // The built-in page for errors without a custom one
+
         // Response Handling
         void HandleGetRequest(); // Handle GET requests
-        void HandlePostRequest(const std::string &requestBody);
+        void HandlePostRequest();
+        void HandlePutRequest(); // Store the body as a file under the location's upload_path
+        void putResponse(bool replaced); // 201 Created, or 200 if the file was replaced
+        BodyRoute planBody(); // Route the request from its headers alone, before the body is read
+        void uploadSink(LocationConfig* location, BodyRoute &route); // Multipart upload, PUT or upload part to the location's upload_path
+        std::string uploadTarget(LocationConfig* location); // File a PUT writes, empty if the URL names none
+
+        // Resumable Uploads
+        bool queryParam(const std::string &name, std::string &value); // Value of a query parameter, false if it is absent
+        void HandleUploadSession(LocationConfig* location); // Create, write, query, finish or abort a resumable upload
+        int uploadPart(LocationConfig* location, std::unique_ptr<BodySink> &sink); // Sink for a PATCH, or the status it is refused with
+        void uploadSessionResponse(UploadSession &session, const std::string &status_code, const std::string &message, const std::string &extra_headers = ""); // Answer with the upload's progress
         void HandleDeleteRequest(); // Handle DELETE requests
 
         // File and Directory Handling
         void ServeFileOrDirectory(const std::string &filePath, LocationConfig* location); // Handle file or directory requests
         void HandleDirectoryRequest(const std::string &filePath, LocationConfig* location); // Handle directory requests
-        void ServeFile(const std::string &filePath); // Serve a file to the client
+        void ServeFile(const std::string &filePath, const FileCacheEntry &file, LocationConfig* location); // Serve a file to the client
+        void LoadCachedResponse(const std::string &cacheKey, const FileCacheEntry &file, LocationConfig* location, std::string content, CachedResponse &cached, const std::string &validators); // Build and offer a response to the location's cache
+        void ServeCachedResponse(const CachedResponse &cached); // Answer from a serialized in-memory response
+
+        // Conditional Requests
+        std::string validatorHeaders(const std::string &etag, time_t lastModified); // ETag and Last-Modified lines
+        std::string buildETag(const FileCacheEntry &file, LocationConfig* location);
+        static std::string hashFileContent(int fd); // Reads the whole file, on a disk thread
+        bool isNotModified(const std::string &etag, time_t lastModified);
+        void sendNotModifiedResponse(const std::string &validators);
+
+        // Byte Ranges
+        bool ServeRange(const FileCacheEntry &file, const std::string &etag, const std::string &extraHeaders);
+        bool ifRangeMatches(const std::string &etag, time_t lastModified);
 
         // Newly added private methods for handling CGI execution
         LocationConfig* validateCgiRequest(std::string& path); // Validate CGI request and prepare environment
         bool setupPipes(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2]);  // Setup pipes for communication
-        void handleCgiChildProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], LocationConfig* location, const std::string& scriptPath, const std::string& method, const std::string& body);  // Handle child process logic
-        bool executeCgiScript(LocationConfig* location, const std::string& scriptPath, char* const envp[]);  // Execute CGI script
-        void handleCgiParentProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], const std::string& body, pid_t pid);  // Handle parent process logic
-        void writeBodyToPipe(const std::string& body, int writeFd);  // Write the request body to the CGI script via stdin pipe
-        bool monitorCgiExecution(pid_t pid, int stdoutPipe, int stderrPipe);  // Monitor CGI process and handle timeouts/errors
-        void processCgiOutput(int stdoutPipe, int stderrPipe);  // Process CGI script output and prepare the HTTP response
+        pid_t spawnCgiScript(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], LocationConfig* location, const std::string& scriptPath);  // Start the script with its pipes as stdio
+        std::string cgiInterpreter(LocationConfig* location, const std::string& scriptPath);  // Interpreter configured for the script's extension
+        FastCgiParams cgiEnvironment(LocationConfig* location, const std::string& scriptPath);  // CGI/1.1 meta-variables for the script
+        bool startCgiResponse(const std::string& headerBlock);  // Turn the script's header block into the HTTP response headers
+        void appendCgiBody(std::string data);  // Queue a piece of the body, chunk-encoded if needed
+        bool executeCgiWorker(LocationConfig* location, const std::string& scriptPath, std::string& body);  // Queue the script for a pre-forked interpreter
+        void startCgi(LocationConfig* location);  // Run the script, or answer from the CGI cache
+        void runCgi();  // Start the script locally, on a pre-forked interpreter or on the FastCGI backend
+        bool lookupCgiCache();  // Consult the CGI cache, true if the script has to run
+        std::string cgiCacheKey(LocationConfig* location);  // Method, path, query and the configured headers
+        void serveCachedCgi(const CachedCgiResponse &cached);  // Answer with a cached script response
+        static bool isBodilessStatus(const std::string &status);  // 1xx, 204 and 304 never carry a body
+        int cgiCacheLifetime(const std::string &status, const std::string &cacheControl, bool shareable);  // Seconds the response may be replayed
+        void passCgiCache();  // The response can't be cached, stop capturing it
+        bool admitCgi();  // Take one of the location's CGI slots, false if the request is queued or rejected
+        void serveOverloaded();  // 503 for a request the location's CGI queue has no room or time for
+        void serveCgiStatus();  // Admission counters of every location with a CGI limit
+        bool loadSpooledBody(std::string &body);  // Read a body spooled to disk back into memory
+        void handleCgiParentProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], std::string body, pid_t pid, int timeout);  // Hand the running script to the event loop
 
     public:
         // Updated constructor to initialize _configs
-        Request(const std::vector<ServerConfig> &configs, const std::string &request_data, int port);
+        Request(const std::vector<ServerConfig> &configs, HttpRequest request, int port, size_t request_count, FileCache *file_cache, int cgi_cache_fd, int cgi_queue_fd, DiskPool *disk_pool = nullptr, int disk_fd = -1);
         Request(const Request &src) = delete;
         Request &operator=(const Request &src) = delete;
         ~Request();
 
+        // called once the headers of a request with a body are parsed
+        static BodyRoute routeBody(const std::vector<ServerConfig> &configs, int port, const HttpRequest &request);
+
+        // inclusive byte ranges of a Range header, false if the header is ignored, none if nothing is satisfiable
+        static bool parseRanges(const std::string &header, off_t size, std::vector<std::pair<off_t, off_t>> &ranges);
+
         // Main Request Parsing and Execution
         void ParseRequest(); 
 
         // CGI and Method Utilities
-        void executeCGI(std::string path, std::string method, std::string body);
+        void executeCGI(std::string path, std::string body);
         bool isCgiRequest(std::string path);
+        // a script of the location, another extension where the location runs scripts (a 415), or neither
+        enum CgiMatch { NOT_CGI, CGI_SCRIPT, UNSUPPORTED_EXTENSION };
+        static CgiMatch matchCgiExtension(LocationConfig* location, std::string path);
+        CgiProcess *getCgi() { return _cgi.get(); } // set while a script is running and its response isn't complete
+        void failCgi(int error_code, const std::string &reason);  // Kill the script and answer with an error page
+
+        // FastCGI, the response is streamed as the backend sends it
+        void executeFastCgi(LocationConfig* location);
+        FastCgiRequest *getFastCgi() { return _fastcgi.get(); } // set until the backend has finished the response
+
+        // the output of a script, forked, pre-forked or behind FastCGI, is passed on as an RFC 3875 response
+        bool appendCgiOutput(std::string data);  // Feed the script's stdout, false if its headers are malformed
+        void appendCgiErrors(const std::string &data);  // Feed the script's stderr
+        bool finishCgiResponse();  // The script is done, false if it never sent its headers
+        bool cgiResponseStarted() const { return _cgi_headers_done; }
+        bool cgiBodiless() const { return _cgi_bodiless; }
+        void relayCgiOutput(int fd);  // Send the rest of the script's stdout from its pipe, the body owns the descriptor
+
+        // the CGI cache: a request may have to wait for the same script running for another one
+        bool cgiCacheWaiting() const { return _cgi_cache_waiting; }
+        bool cgiCacheFilling() const { return _cgi_cache_filling; } // the script's output is needed in memory
+        void resumeCgiCache();  // The entry it waited for is settled, answer from it or run the script
+
+        // the location's CGI limit: a request over it waits for a slot in a queue shared by all workers
+        bool cgiQueued() const { return _cgi_queued; }
+        time_t cgiQueueDeadline() const { return _cgi_queue_deadline; }
+        void resumeCgiQueue();  // The worker was signalled, run the script if this request was handed a slot
+        void expireCgiQueue();  // Its time in the queue is up, answer with a 503
+
+        // file system work runs on the disk threads, the request is parked until its worker is signalled
+        bool diskWaiting() const { return _disk_job != nullptr; }
+        bool diskDone() const { return _disk_job && _disk_job->done.load(std::memory_order_acquire); }
+        void resumeDisk();  // The job is done, continue with the response
 
         // Response Utilities
         void responseHeader(const std::string &content, const std::string &status_code);
-        void ServeErrorPage(int error_code);
+        void responseHeader(size_t content_length, const std::string &status_code, const std::string &extra_headers = "");
+        std::string contentTypeHeader() const;
+        void ServeErrorPage(int error_code); // A custom page that isn't open yet parks the request like any file
 
         // Additional Helpers for POST, DELETE, and Response Handling
         void DeleteResponse();
         void handleFormUrlEncoded(const std::string &requestBody);
         void handlePlainText(const std::string &requestBody);
-        void handleJson(const std::string &requestBody);
+        void handleJson();
         void handleMultipartFormData(const std::string &requestBody);
         void handleUnsupportedContentType();
         void sendHtmlResponse(const std::string &htmlContent);
 
         // Directory Listing and Auto-Indexing
-        void ServeAutoIndex(const std::string& directoryPath, const std::string& url, const std::string& host, int port, LocationConfig* location);
+        void ServeAutoIndex(const std::string& directoryPath, const std::string& url, LocationConfig* location);
 
         // URL Redirection
         void sendRedirectResponse(const std::string &redirection_url, int return_code);
 
         // Utilities
         std::string getCurrentTimeHttpFormat();
+        std::string formatHttpDate(time_t time);
         bool hasFileExtension(const std::string& url);
-        void createDir(const std::string &path);
 
         // Location and Method Utilities
         LocationConfig* findLocation(const std::string& url);
@@ -112,12 +255,15 @@ class Request
 
         // Response Readiness
         bool isResponseReady() const { return _response_ready; }
-        std::string getResponse() const { return _response; }
+        // hand the headers and the body over to the connection, nothing is copied
+        ResponseBody releaseResponse();
 
-        std::string getAbsolutePath(const std::string &path);
+        // Persistent Connections
+        bool keepAlive() const { return _keep_alive; }
+        int getKeepAliveTimeout() const { return _config.keepalive_timeout; }
+        std::string connectionHeader() const;
 
-    // Convert max body size from configuration string (e.g., "1M", "1K") to bytes.
-    ssize_t convertMaxBodySize(const std::string &input);
+        std::string getAbsolutePath(const std::string &path);
 
     // Handle POST request
     // Extract Content-Length from headers
@@ -131,13 +277,4 @@ class Request
 
     // Extract multipart boundary from headers
     std::string extractBoundary();
-
-    // Process multipart form-data and save files
-    void processMultipartData(const std::string &requestBody, const std::string &boundary, const std::string &uploadDir);
-
-    // Extract filename from multipart headers
-    std::string extractFilename(const std::string &partHeaders);
-
-    // Save uploaded file to specified path
-    void saveUploadedFile(const std::string &uploadDir, const std::string &filename, const std::string &fileContent);
 };
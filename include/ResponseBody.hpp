@@ -0,0 +1,94 @@
+#pragma once
+
+#include "FileCache.hpp"
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+
+#define PIPE_READ_SIZE 65536 // bytes pulled from a pipe source before they have to reach the socket
+#define PIPE_SPLICE_SIZE (1024 * 1024) // bytes asked of one splice() from a pipe source to the socket
+#define MAX_IOVECS 64 // in-memory chunks gathered into a single sendmsg() call
+
+// Everything a connection still has to send for the current response, in order:
+// the header block and in-memory bodies, regions of open files and pipes read until EOF.
+// The socket is fed incrementally, and a source is only read again once what was
+// read from it before has been written, so memory follows the socket, not the payload.
+// Files go out with sendfile() and pipes with splice(), their data never enters user space.
+// In-memory chunks are refcounted and sent in place with scatter-gather I/O; partial
+// writes only move a cursor, nothing is erased or copied.
+class ResponseBody {
+    public:
+        enum Status {
+            DONE,       // everything was sent
+            BLOCKED,    // the socket is full, continue on EPOLLOUT
+            WAITING,    // a pipe has no data yet, continue when it is readable
+            FAILED      // the peer went away or a source broke, the response can't be completed
+        };
+
+        ResponseBody() : _pipe_offset(0), _buffered(0), _streaming(false), _stream_ended(false) {}
+        ResponseBody(ResponseBody &&src) = default;
+        ResponseBody &operator=(ResponseBody &&src);
+        ResponseBody(const ResponseBody &src) = delete;
+        ResponseBody &operator=(const ResponseBody &src) = delete;
+        ~ResponseBody();
+
+        // queue data, shared strings (e.g. from the response cache) are sent without a copy
+        void addMemory(std::string data);
+        void addMemory(std::shared_ptr<const std::string> data);
+        // queue a region of an open file, sent with sendfile()
+        void addFile(std::shared_ptr<OpenFile> file, off_t offset, size_t length);
+        // queue a non-blocking pipe read until EOF, the body takes ownership of the descriptor.
+        // chunked frames what arrives in HTTP/1.1 chunks and ends with the last-chunk
+        void addPipe(int fd, bool chunked = false);
+        // put another body's contents at the end of this one
+        void append(ResponseBody &&other);
+
+        // nothing left to send, and nothing more will be added
+        bool empty() const { return _chunks.empty() && !_streaming; }
+        // while streaming, running out of chunks means waiting for the producer, not the end of the response.
+        // the body stays non-empty after endStream() until writeTo() has reported DONE, even if nothing was left to send
+        void beginStream() { _streaming = true; _stream_ended = false; }
+        void endStream() { _stream_ended = true; }
+        // in-memory bytes still waiting for the socket, lets producers stop while the client is behind
+        size_t bufferedBytes() const { return _buffered; }
+        // the pipe the body is currently reading from, -1 if the front chunk is not a pipe
+        int pipeFd() const;
+
+        // write as much as the socket accepts
+        Status writeTo(int socket_fd);
+        // drop everything, closing pipes
+        void clear();
+
+    private:
+        enum Kind { MEMORY, FILE_RANGE, PIPE };
+
+        struct Chunk {
+            Kind                                kind;
+            std::shared_ptr<const std::string>  data;       // MEMORY
+            size_t                              sent = 0;   // MEMORY: cursor, bytes of data already written
+            std::shared_ptr<OpenFile>           file;       // FILE_RANGE
+            off_t                               offset = 0; // FILE_RANGE
+            size_t                              length = 0; // FILE_RANGE: bytes left
+            int                                 fd = -1;    // PIPE
+            bool                                chunked = false; // PIPE: frame the data as HTTP/1.1 chunks
+            size_t                              frame_left = 0; // PIPE: bytes of the current chunk still in the pipe
+            bool                                spliced = true; // PIPE: false once splice() was refused, read() and send() then
+            bool                                eof = false; // PIPE: only what is in _pipe_buffer is left
+        };
+
+        std::deque<Chunk>   _chunks;
+        std::string         _pipe_buffer; // data read from the front pipe, not yet written
+        size_t              _pipe_offset; // bytes of _pipe_buffer already written
+        size_t              _buffered;    // unsent bytes of the memory chunks
+        bool                _streaming;   // the chunks are produced while the response is sent
+        bool                _stream_ended; // the producer added its last chunk
+
+        Status writeMemory(int socket_fd);
+        Status writeFile(int socket_fd, Chunk &chunk);
+        Status writePipe(int socket_fd, Chunk &chunk);
+        Status splicePipe(int socket_fd, Chunk &chunk);
+        Status readPipe(Chunk &chunk);
+        void popFront();
+};
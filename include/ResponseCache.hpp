@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#define RESPONSE_CACHE_MAX_SHARDS 16
+
+// A fully serialized static response. The headers hold everything that does not change
+// between requests; the status line, Date and Connection are added per request.
+struct CachedResponse {
+    std::shared_ptr<const std::string>  headers;
+    std::shared_ptr<const std::string>  body;
+    // identity of the file the response was built from, a mismatch means it changed on disk
+    ino_t                               ino = 0;
+    off_t                               size = 0;
+    struct timespec                     mtime = {};
+
+    size_t bytes() const;
+    bool matches(const struct stat &st) const;
+};
+
+// Size-bounded in-memory cache of small static responses, shared by all workers.
+// Entries are spread over independently locked shards. Admission follows W-TinyLFU:
+// new entries land in a small LRU window and only move into the main region if a
+// count-min sketch says they are requested more often than the entry they would evict,
+// so one-off requests can't flush the hot set.
+class ResponseCache {
+    private:
+        enum Region { WINDOW, MAIN };
+
+        struct Entry {
+            std::string     key;
+            uint64_t        hash;
+            CachedResponse  response;
+            Region          region;
+        };
+
+        // approximate request counts with periodic aging, 4 rows of saturating 8-bit counters
+        class FrequencySketch {
+            private:
+                std::vector<uint8_t>    _counters;
+                size_t                  _mask;
+                size_t                  _additions;
+                size_t                  _sample_size;
+
+                size_t index(uint64_t hash, int row) const;
+
+            public:
+                explicit FrequencySketch(size_t expected_entries);
+                void increment(uint64_t hash);
+                uint8_t frequency(uint64_t hash) const;
+        };
+
+        struct Shard {
+            std::mutex                                                      mutex;
+            std::list<Entry>                                                window; // most recently used first
+            std::list<Entry>                                                main;   // most recently used first
+            std::unordered_map<std::string, std::list<Entry>::iterator>     index;
+            size_t                                                          window_bytes = 0;
+            size_t                                                          main_bytes = 0;
+            FrequencySketch                                                 sketch;
+
+            explicit Shard(size_t expected_entries) : sketch(expected_entries) {}
+        };
+
+        size_t                                  _window_capacity; // per shard
+        size_t                                  _main_capacity;   // per shard
+        std::vector<std::unique_ptr<Shard>>     _shards;
+
+        Shard &shardFor(uint64_t hash);
+        void erase(Shard &shard, std::list<Entry>::iterator it);
+        void admitFromWindow(Shard &shard);
+
+    public:
+        ResponseCache(size_t max_size, size_t max_file_size);
+        ResponseCache(const ResponseCache &src) = delete;
+        ResponseCache &operator=(const ResponseCache &src) = delete;
+
+        // find a response for the path that still matches the file's current stat
+        bool get(const std::string &key, const struct stat &st, CachedResponse &out);
+        // whether a response of about this many bytes would make it into the main region right now,
+        // so a miss the cache would turn away isn't read into memory at all
+        bool admits(const std::string &key, size_t bytes);
+        // offer a response to the cache, the admission policy decides whether it stays
+        void put(const std::string &key, const CachedResponse &response);
+};
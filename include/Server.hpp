@@ -3,13 +3,25 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <sys/epoll.h>
 #include <netinet/in.h>
 #include "Request.hpp" // Include for handling requests
+#include "HttpParser.hpp"
+#include "FileCache.hpp"
+#include "ResponseBody.hpp"
+#include "FastCgiPool.hpp"
+#include "CgiWorkerPool.hpp"
+#include "DiskPool.hpp"
+#include "QueuedSink.hpp"
 #include <map>
+#include <ctime>
 
 #define MAX_EVENTS 10
+#define TIMER_INTERVAL_MS 1000 // how often idle connections are checked
+#define READ_SPOOL_INTERVAL 65536 // buffered bytes after which a read loop lets the parser spool the body
+#define LINGER_TIMEOUT 5 // seconds the rest of a refused request is read and dropped before the connection is closed
 
 struct ListeningSocket
 {
@@ -24,14 +36,24 @@ class ClientContext
 	public:
 		int			fd;
 		std::string read_buffer;
-		std::string write_buffer;
-		bool		header_parsed;
-		size_t		content_length;
+		ResponseBody response; // Headers and body of the response being sent, pulled as the socket drains
+		int			watched_pipe_fd = -1; // Pipe of the response registered in epoll while it has no data
+		uint32_t	epoll_events = EPOLLIN | EPOLLET; // What epoll currently reports for the socket
+		std::unique_ptr<Request> cgi_request; // Request whose CGI script, FastCGI backend or disk job is still running
+		HttpParser	parser; // Resumable parser for the request at the front of read_buffer
 		bool 		response_ready;
 		int 		listening_socket_fd; // To identify which listening socket this client is associated with
+		size_t		requests_served = 0; // Number of responses already sent on this connection
+		bool		keep_alive = false; // Whether the connection is reused after the current response
+		int			keepalive_timeout = 0; // Idle timeout (seconds) of the server block that served the last request
+		time_t		last_activity = time(NULL); // Last time a request finished or data arrived
+		bool		linger = false; // The request was refused before all of it was read, drain it before closing
+		bool		lingering = false; // The error has been sent, input is dropped until the client closes or LINGER_TIMEOUT
+		std::shared_ptr<BodyRoute> body_route; // Where the body goes while its files are created on a disk thread
+		std::shared_ptr<DiskJob> body_job; // That job, or one writing the body read so far, the rest is left in the socket until it is done
 
-		ClientContext() : fd(-1), header_parsed(false), content_length(0), response_ready(false), listening_socket_fd(-1) {}
-		ClientContext(int client_fd, int listen_fd) : fd(client_fd), header_parsed(false), content_length(0), response_ready(false), listening_socket_fd(listen_fd) {}
+		ClientContext() : fd(-1), response_ready(false), listening_socket_fd(-1) {}
+		ClientContext(int client_fd, int listen_fd) : fd(client_fd), response_ready(false), listening_socket_fd(listen_fd) {}
 };
 
 class Server
@@ -39,9 +61,25 @@ class Server
 	private:
 		std::vector<ListeningSocket> _listening_sockets;
 		std::unordered_map<int, ClientContext> _clients; // key: client_fd
+		std::unordered_map<int, int> _pipe_clients; // response pipe fd -> client_fd waiting for it
+		std::unordered_map<int, int> _cgi_clients; // CGI pipe or pidfd -> client_fd whose script it belongs to
 		struct sockaddr_in _address;
 
+		int _worker_id; // index of the event-loop thread that owns this instance
+
+		FileCache _file_cache; // stat results and open fds of this worker's static files
+		FastCgiPool _fastcgi; // persistent connections to the FastCGI backends
+		CgiWorkerPool _cgi_workers; // pre-forked interpreters, their sockets live in _fastcgi
+		int _cgi_cache_fd; // eventfd the CGI caches signal once a run this worker's requests wait for is over
+		std::unordered_set<int> _cgi_cache_waiting; // clients whose request waits for another one's run in a CGI cache
+		int _cgi_queue_fd; // eventfd the CGI limiters signal once a request queued in this worker was handed a slot
+		std::unordered_set<int> _cgi_queued; // clients whose request is queued for a CGI slot
+		DiskPool *_disk_pool; // threads shared by all workers that do the file system work of requests
+		int _disk_fd; // eventfd the disk threads signal once a job of one of this worker's requests is done
+		std::unordered_set<int> _disk_waiting; // clients whose request or upload waits for a disk job
+
 		int _epoll_fd;
+		time_t _last_timer_run; // last time RunTimers swept the client map
 		struct epoll_event _event;
 		struct epoll_event _events[MAX_EVENTS];
 
@@ -51,9 +89,11 @@ class Server
 		void CreateAndBindSocket(ServerConfig &current);
 		void InitializeSocketAddress(ServerConfig &current);
 		void SetNonBlocking(int sock);
+		void PinToCpu(int cpu);
 
 		// Epoll Management
 		void EpollCreate();
+		void StartCgiWorkers(const std::vector<ServerConfig> &servers);
 		void EpollWait(const std::vector<ServerConfig> &servers);
 		bool HandleEvent(int fd, uint32_t events, const std::vector<ServerConfig> &servers);
 
@@ -61,15 +101,58 @@ class Server
 		bool HandleListeningSocket(int fd);
 		void AcceptConnection(int listening_fd);
 		int AcceptClient(int listening_fd);
-		void AddClientToEpoll(int client_fd);
+		bool AddClientToEpoll(int client_fd);
 
 		// Client I/O Handling
 		void HandleClientRead(int client_fd, const std::vector<ServerConfig> &configs);
-		void HandleClientWrite(int client_fd);
+		void HandleClientWrite(int client_fd, const std::vector<ServerConfig> &configs);
+		void WatchResponsePipe(int client_fd, ClientContext &client, ResponseBody::Status status);
+		void UnwatchResponsePipe(ClientContext &client);
 		ClientContext* GetClientContext(int client_fd);
-		bool ReadClientData(int client_fd, ClientContext* client);
-		bool IsFullRequestReceived(const ClientContext &client);
-		void ProcessClientRequest(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs);
+		bool ReadClientData(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs);
+		bool IsFullRequestReceived(ClientContext &client, const std::vector<ServerConfig> &configs);
+		void SendContinue(ClientContext &client);
+		bool OpenBodySink(ClientContext &client, BodyRoute &route);
+		void StartBody(ClientContext &client, BodyRoute &route);
+		bool FlushBody(ClientContext &client);
+		void BodyFlushed(ClientContext &client);
+		void ResumeBody(int client_fd, ClientContext &client, const std::vector<ServerConfig> &configs);
+		bool ProcessClientRequest(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs);
+		bool StartResponse(int client_fd, ClientContext &client, std::unique_ptr<Request> request);
+		bool SetClientEvents(int client_fd, ClientContext &client, uint32_t events);
+
+		// Non-blocking CGI
+		bool StartCgi(int client_fd, ClientContext &client, std::unique_ptr<Request> request);
+		bool WatchCgiFd(int client_fd, int fd, uint32_t events);
+		void CloseCgiFd(int &fd);
+		void CloseCgiFds(CgiProcess &cgi);
+		void HandleCgiEvent(int fd, const std::vector<ServerConfig> &configs);
+		void RelayCgiOutput(Request &request, CgiProcess &cgi);
+		void FinishCgi(int client_fd, ClientContext &client, const std::vector<ServerConfig> &configs, int error_code = 0);
+		void CheckCgiProcesses(time_t now, const std::vector<ServerConfig> &configs);
+
+		// FastCGI
+		bool StartFastCgi(int client_fd, ClientContext &client, std::unique_ptr<Request> request);
+		void HandleFastCgiEvent(int fd, uint32_t events, const std::vector<ServerConfig> &configs);
+		void FinishFastCgi(int client_fd, ClientContext &client, int error_code = 0);
+		void ResumeFastCgi(int client_fd, ClientContext &client);
+
+		// CGI cache
+		void HandleCgiCacheEvent(const std::vector<ServerConfig> &configs);
+
+		// CGI queue
+		void HandleCgiQueueEvent(const std::vector<ServerConfig> &configs);
+		void ExpireCgiQueue(time_t now, const std::vector<ServerConfig> &configs);
+
+		// Disk I/O
+		void HandleDiskEvent(const std::vector<ServerConfig> &configs);
+
+		// Persistent Connections
+		void ResetClientForNextRequest(ClientContext &client);
+		void LingerClient(int client_fd, ClientContext &client);
+		void DrainLingeringClient(int client_fd);
+		void RunTimers(const std::vector<ServerConfig> &configs);
+		void CloseIdleClients(time_t now);
 
 		// Client Closing
 		void CloseClient(int client_fd);
@@ -78,7 +161,9 @@ class Server
 		ListeningSocket* FindListeningSocket(int listening_socket_fd);
 
 	public:
-		Server(const std::vector<ServerConfig> &servers);
+		// every instance runs its own event loop with its own SO_REUSEPORT listeners,
+		// so one Server is created per worker thread and nothing is shared between them
+		Server(const std::vector<ServerConfig> &servers, int worker_id = 0, int cpu = -1, DiskPool *disk_pool = nullptr);
 		Server(const Server &src) = delete;
 		Server &operator=(const Server &src) = delete;
 		~Server();
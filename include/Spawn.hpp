@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// How a child process is started: the program, its arguments and environment, where its stdio goes
+struct SpawnOptions {
+    std::string                 path;           // program to execute
+    std::vector<std::string>    argv;
+    std::vector<std::string>    env;            // "NAME=value", empty to pass on the server's environment
+    int                         stdin_fd = -1;  // -1 leaves the server's descriptor in place
+    int                         stdout_fd = -1;
+    int                         stderr_fd = -1;
+    std::string                 cwd;            // empty to stay in the server's directory
+};
+
+// posix_spawn() with the stdio redirections and the chdir as file actions. glibc starts the child
+// with CLONE_VM | CLONE_VFORK, so no page tables are copied however large the server has grown.
+// returns the pid, or -1 with errno set if the program couldn't be started
+pid_t spawnProcess(const SpawnOptions &options);
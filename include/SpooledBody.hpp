@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+// A request body too large to keep in memory, written to an unlinked temporary file as it arrives.
+// Writes go through pwrite(), so the descriptor's offset stays at the start and a CGI script given
+// it as stdin reads the body from the beginning. The file disappears once the descriptor is closed.
+class SpooledBody {
+    private:
+        int     _fd;
+        size_t  _size;
+
+    public:
+        SpooledBody();
+        SpooledBody(const SpooledBody &src) = delete;
+        SpooledBody &operator=(const SpooledBody &src) = delete;
+        ~SpooledBody();
+
+        // create the file in $TMPDIR, /tmp if it isn't set
+        bool open();
+        bool append(const char *data, size_t size);
+        // the whole body, for handlers that work on it in memory
+        bool read(std::string &out) const;
+
+        int fd() const { return _fd; }
+        size_t size() const { return _size; }
+};
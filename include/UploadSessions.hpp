@@ -0,0 +1,85 @@
+#pragma once
+
+#include "FileUpload.hpp"
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <ctime>
+#include <unordered_map>
+
+// One resumable upload: a file of known length, preallocated under a temporary name next to its
+// destination. Parts are written into it in place, from any number of connections at once, and the
+// byte ranges that arrived are tracked until all of them are there and the file is renamed into place.
+class UploadSession {
+    private:
+        std::mutex              _mutex;
+        std::string             _path;
+        std::string             _tmp_path;
+        int                     _fd;
+        off_t                   _length;
+        std::map<off_t, off_t>  _ranges; // received bytes, start -> end, merged so they never touch or overlap
+        size_t                  _writers; // parts being written right now
+        time_t                  _last_activity;
+        bool                    _closed; // committed or aborted, no more parts are taken
+        bool                    _committed;
+
+    public:
+        UploadSession(const std::string &path, const std::string &tmp_path, int fd, off_t length);
+        UploadSession(const UploadSession &src) = delete;
+        UploadSession &operator=(const UploadSession &src) = delete;
+        // the temporary file of an upload that was never committed is removed with the last part writing to it
+        ~UploadSession();
+
+        const std::string &path() const { return _path; }
+        off_t length() const { return _length; }
+
+        // a descriptor of its own for a part, -1 with errno ESTALE once the upload is closed
+        int openPart();
+        // a part is done, bytes [start, end) of it made it to the file
+        void closePart(off_t start, off_t end);
+        // received ranges like "0-1023,4096-8191", inclusive as in Content-Range
+        std::string ranges();
+        // rename the file into place: 0, 409 while bytes are missing or parts are still being written, 500
+        int commit(bool &replaced);
+        void abort();
+        bool expired(time_t now, int timeout);
+};
+
+// The resumable uploads of a location, shared by all workers. Sessions left alone for longer than
+// the timeout are dropped along with their temporary file.
+class UploadSessions {
+    private:
+        std::mutex                                                      _mutex;
+        std::unordered_map<std::string, std::shared_ptr<UploadSession>> _sessions;
+        int                                                             _timeout;
+
+        void expire(time_t now);
+
+    public:
+        explicit UploadSessions(int timeout);
+        UploadSessions(const UploadSessions &src) = delete;
+        UploadSessions &operator=(const UploadSessions &src) = delete;
+
+        // a new session for a file of length bytes at path, named by id. nullptr if the file couldn't be created
+        std::shared_ptr<UploadSession> create(const std::string &path, off_t length, std::string &id);
+        std::shared_ptr<UploadSession> find(const std::string &id);
+        void remove(const std::string &id);
+};
+
+// The body of one PATCH to a resumable upload, written in place from its offset on. The bytes that made it
+// to the file are recorded even if the connection breaks off, so the client only has to send what is missing.
+class UploadPart : public FileSink {
+    private:
+        std::shared_ptr<UploadSession>  _session;
+        off_t                           _start;
+        bool                            _open; // holds one of the session's writer counts
+
+    public:
+        UploadPart(const std::shared_ptr<UploadSession> &session, off_t offset);
+        ~UploadPart() override;
+
+        int write(const char *data, size_t size) override;
+        int finish() override;
+};
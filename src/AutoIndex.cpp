@@ -3,39 +3,14 @@
 #include <dirent.h>
 #include <sys/stat.h>
 
-// generates an HTML directory listing and sends it as a response
-void Request::ServeAutoIndex(const std::string& directoryPath, const std::string& url, const std::string& host, int port, LocationConfig* location) {
-
-    // adjust directoryPath to include the additional part of the URL after the location's path
-    std::string adjustedDirectoryPath = directoryPath;
-
-    // if the URL is not the same as the location's path, append the remaining URL to the directoryPath
-    if (url != location->path && url.find(location->path) == 0) {
-        std::string remainingUrl = url.substr(location->path.length());
-        if (!remainingUrl.empty()) {
-            if (remainingUrl[0] == '/') {
-                remainingUrl = remainingUrl.substr(1);
-            }
-            adjustedDirectoryPath += "/" + remainingUrl;
-        }
-    }
-
-    // open the directory specified by adjustedDirectoryPath
-    DIR* dir = opendir(adjustedDirectoryPath.c_str());
+// the names in a directory, directories with a slash appended. runs on a disk thread
+static bool listDirectory(const std::string &path, std::vector<std::string> &entries) {
+    // open the directory specified by path
+    DIR* dir = opendir(path.c_str());
     if (dir == nullptr) {
-        std::cerr << "Error: Unable to open directory: " << adjustedDirectoryPath << std::endl;
-        ServeErrorPage(500);
-        return;
+        return false;
     }
 
-    // create a string stream to build the HTML response
-    std::ostringstream html;
-    
-    // start HTML construction
-    html << "<html><head><title>Directory Listing</title></head><body>";
-    html << "<h1>Index of " << url << "</h1>";
-    html << "<ul>";
-
     // loop through the entries in the directory
     struct dirent* entry;
     while ((entry = readdir(dir)) != nullptr) {
@@ -47,7 +22,7 @@ void Request::ServeAutoIndex(const std::string& directoryPath, const std::string
         }
 
         // construct the full path to the current directory entry
-        std::string fullPath = adjustedDirectoryPath + "/" + entryName;
+        std::string fullPath = path + "/" + entryName;
 
         struct stat entryStat;
         // use the 'stat' system call to get information about the file or directory at 'fullPath'
@@ -60,22 +35,63 @@ void Request::ServeAutoIndex(const std::string& directoryPath, const std::string
         if (S_ISDIR(entryStat.st_mode)) {
             entryName += "/";
         }
-
-        // show entries
-        html << "<li>" << entryName << "</li>";
+        entries.push_back(entryName);
     }
 
     // close the directory after reading its contents
     closedir(dir);
+    return true;
+}
+
+// generates an HTML directory listing and sends it as a response
+void Request::ServeAutoIndex(const std::string& directoryPath, const std::string& url, LocationConfig* location) {
+
+    // adjust directoryPath to include the additional part of the URL after the location's path
+    std::string adjustedDirectoryPath = directoryPath;
+
+    // if the URL is not the same as the location's path, append the remaining URL to the directoryPath
+    if (url != location->path && url.find(location->path) == 0) {
+        std::string remainingUrl = url.substr(location->path.length());
+        if (!remainingUrl.empty()) {
+            if (remainingUrl[0] == '/') {
+                remainingUrl = remainingUrl.substr(1);
+            }
+            adjustedDirectoryPath += "/" + remainingUrl;
+        }
+    }
+
+    // the directory is read and its entries stat'ed on a disk thread
+    auto entries = std::make_shared<std::vector<std::string>>();
+    auto listed = std::make_shared<bool>(false);
+    offloadDisk([adjustedDirectoryPath, entries, listed] { *listed = listDirectory(adjustedDirectoryPath, *entries); }, [this, adjustedDirectoryPath, url, entries, listed] {
+        if (!*listed) {
+            std::cerr << "Error: Unable to open directory: " << adjustedDirectoryPath << std::endl;
+            ServeErrorPage(500);
+            return;
+        }
+
+        // create a string stream to build the HTML response
+        std::ostringstream html;
+
+        // start HTML construction
+        html << "<html><head><title>Directory Listing</title></head><body>";
+        html << "<h1>Index of " << url << "</h1>";
+        html << "<ul>";
+
+        // show entries
+        for (size_t i = 0; i < entries->size(); ++i) {
+            html << "<li>" << (*entries)[i] << "</li>";
+        }
 
-    // close HTML construction
-    html << "</ul></body></html>";
+        // close HTML construction
+        html << "</ul></body></html>";
 
-    std::string htmlContent = html.str();
+        std::string htmlContent = html.str();
 
-    // add the response header with HTTP 200 OK status and the correct content length
-    responseHeader(htmlContent, HTTP_200);
+        // add the response header with HTTP 200 OK status and the correct content length
+        responseHeader(htmlContent, HTTP_200);
 
-    // append the generated HTML to the response
-    _response += htmlContent;
+        // the generated HTML follows the headers without being copied again
+        _body.addMemory(std::move(htmlContent));
+    });
 }
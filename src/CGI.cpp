@@ -1,50 +1,217 @@
 #include "../include/Request.hpp"
+#include "../include/Spawn.hpp"
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <cstring>
 #include <signal.h>
+#include <fcntl.h>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
 
 // check if the request is for a CGI script based on the file extension
 bool Request::isCgiRequest(std::string path) {
     // retrieve the location configuration for the current URL
     LocationConfig* location = findLocation(_url);
 
-    // check if the location is valid and has specified CGI extensions
-    if (location != nullptr && !location->cgi_extension.empty()) {
-        // find the position of a query string (if any) and remove it from the path
-        std::string::size_type queryPos = path.find("?");
-        if (queryPos != std::string::npos) {
-            // remove query string if present
-            path = path.substr(0, queryPos);  
+    CgiMatch match = matchCgiExtension(location, path);
+    if (match == UNSUPPORTED_EXTENSION) {
+        // if the extension is not supported, return a 415 error (Unsupported Media Type)
+        std::cerr << "Unsupported extension: " << path.substr(path.find_last_of('.')) << std::endl;
+        ServeErrorPage(415);
+    }
+    return match == CGI_SCRIPT;
+}
+
+// what the path's extension means to a location with CGI extensions, without answering the request
+Request::CgiMatch Request::matchCgiExtension(LocationConfig* location, std::string path) {
+    if (location == nullptr || location->cgi_extension.empty()) {
+        return NOT_CGI;
+    }
+
+    // find the position of a query string (if any) and remove it from the path
+    std::string::size_type queryPos = path.find("?");
+    if (queryPos != std::string::npos) {
+        path = path.substr(0, queryPos);
+    }
+
+    // find the last occurrence of a '.' to identify the file extension
+    std::string::size_type dotPos = path.find_last_of('.');
+    if (dotPos == std::string::npos) {
+        return NOT_CGI;
+    }
+
+    // check if the file extension matches any of the configured CGI extensions
+    std::string ext = path.substr(dotPos);
+    for (const auto& valid_ext : location->cgi_extension) {
+        if (ext == valid_ext) {
+            return CGI_SCRIPT;
         }
+    }
+    return UNSUPPORTED_EXTENSION;
+}
 
-        // find the last occurrence of a '.' to identify the file extension
-        std::string::size_type dotPos = path.find_last_of('.');
-        if (dotPos != std::string::npos) {
-            // extract the file extension
-            std::string ext = path.substr(dotPos);
-
-            // check if the file extension matches any of the configured CGI extensions
-            for (const auto& valid_ext : location->cgi_extension) {
-                if (ext == valid_ext) {
-                    return true;  // CGI request detected based on file extension
-                }
-            }
+// run the location's script for the request, unless the location's CGI cache has its response
+// or the same script is already running for another request
+void Request::startCgi(LocationConfig* location) {
+    _cgi_location = location;
+    // only GET is replayed, anything else may have side effects
+    if (location->cgi_cache && _method == "GET") {
+        _cgi_cache_key = cgiCacheKey(location);
+        if (!lookupCgiCache()) {
+            return;
+        }
+    }
+    runCgi();
+}
+
+void Request::runCgi() {
+    // over the location's limit the script waits for a slot, and isn't run at all once the queue is full
+    if (_cgi_location->cgi_limiter && !admitCgi()) {
+        return;
+    }
+    if (!_cgi_location->fastcgi_pass.empty()) {
+        executeFastCgi(_cgi_location);
+    } else {
+        executeCGI(_url, std::move(_request.body));
+    }
+}
+
+// a hit is answered right away, a miss claims the key and captures the script's response for it
+bool Request::lookupCgiCache() {
+    CachedCgiResponse cached;
+    CgiCache::Lookup result = _cgi_location->cgi_cache->lookup(_cgi_cache_key, time(NULL), _cgi_cache_fd, cached);
+    _cgi_cache_waiting = result == CgiCache::WAIT;
+    _cgi_cache_filling = result == CgiCache::MISS;
+    if (result == CgiCache::HIT) {
+        serveCachedCgi(cached);
+    }
+    return result == CgiCache::MISS || result == CgiCache::PASS;
+}
+
+// the run this request waited for is over: its response is cached, the key is free to claim, or it passes
+void Request::resumeCgiCache() {
+    if (lookupCgiCache()) {
+        runCgi();
+    }
+}
+
+bool Request::admitCgi() {
+    if (_cgi_slot) {
+        return true;
+    }
+    CgiLimiter::Admission admission = _cgi_location->cgi_limiter->acquire(_cgi_queue_fd, _cgi_queue_ticket);
+    _cgi_slot = admission == CgiLimiter::RUN;
+    _cgi_queued = admission == CgiLimiter::QUEUED;
+    if (_cgi_queued) {
+        _cgi_queue_deadline = time(NULL) + _cgi_location->cgi_queue_timeout;
+    } else if (admission == CgiLimiter::FULL) {
+        serveOverloaded();
+    }
+    return _cgi_slot;
+}
+
+// a worker's eventfd is shared by all of its queued requests, the ones that weren't handed a slot keep waiting
+void Request::resumeCgiQueue() {
+    if (_cgi_location->cgi_limiter->claim(_cgi_queue_ticket)) {
+        _cgi_queued = false;
+        _cgi_slot = true;
+        runCgi();
+    }
+}
+
+void Request::expireCgiQueue() {
+    if (_cgi_location->cgi_limiter->leave(_cgi_queue_ticket, true)) {
+        _cgi_queued = false;
+        serveOverloaded();
+    } else {
+        // a slot came up just in time
+        resumeCgiQueue();
+    }
+}
 
-            // if the extension is not supported, return a 415 error (Unsupported Media Type)
-            std::cerr << "Unsupported extension: " << ext << std::endl;
-            ServeErrorPage(415);
-            return false;
+// shedding load has to stay cheap, so the default page is built once and shared by every 503
+void Request::serveOverloaded() {
+    static const std::shared_ptr<const std::string> page = std::make_shared<const std::string>(
+        "<!DOCTYPE html>\n<html><head><title>503 Service Unavailable</title></head>\n"
+        "<body><h1>503 Service Unavailable</h1><p>The server is busy, please try again in a moment.</p></body></html>\n");
+
+    if (_config.error_pages.count(503)) {
+        ServeErrorPage(503);
+        return;
+    }
+    _body.clear();
+    _response = _http_version + " " + HTTP_503 + "\r\n";
+    _response += "Content-Type: text/html\r\n";
+    _response += "Content-Length: " + std::to_string(page->size()) + "\r\n";
+    _response += "Retry-After: 1\r\n";
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    _body.addMemory(page);
+}
+
+// one line per limited location, the counters are shared by all workers
+void Request::serveCgiStatus() {
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < _configs.size(); ++i) {
+        for (size_t j = 0; j < _configs[i].locations.size(); ++j) {
+            const LocationConfig &location = _configs[i].locations[j];
+            if (!location.cgi_limiter) {
+                continue;
+            }
+            CgiLimiterStats stats = location.cgi_limiter->stats();
+            double timed = stats.waited + stats.timed_out;
+            report << _configs[i].listen_host << ":" << _configs[i].listen_port << " " << location.path
+                   << " running=" << stats.running << "/" << stats.max_concurrency
+                   << " queued=" << stats.queued << "/" << stats.queue_size
+                   << " admitted=" << stats.admitted << " waited=" << stats.waited
+                   << " rejected=" << stats.rejected << " timed_out=" << stats.timed_out
+                   << " wait_avg_ms=" << (timed > 0 ? stats.wait_total_ms / timed : 0.0)
+                   << " wait_max_ms=" << stats.wait_max_ms << "\n";
         }
     }
+    std::string content = report.str();
+    _response = _http_version + " " + HTTP_200 + "\r\n";
+    _response += "Content-Type: text/plain\r\n";
+    _response += "Content-Length: " + std::to_string(content.size()) + "\r\n";
+    _response += "Cache-Control: no-store\r\n";
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    _body.addMemory(std::move(content));
+}
 
-    // if no valid CGI extension is found, return false (not a CGI request)
-    return false;
+std::string Request::cgiCacheKey(LocationConfig* location) {
+    // _url still has its query string
+    std::string key = _method + " " + _url;
+    for (size_t i = 0; i < location->cgi_cache_key_headers.size(); ++i) {
+        const std::string &name = location->cgi_cache_key_headers[i];
+        key += "\n" + name + ": " + _request.getHeader(name);
+    }
+    return key;
+}
+
+void Request::serveCachedCgi(const CachedCgiResponse &cached) {
+    _response = _http_version + " " + cached.status + "\r\n";
+    _response += cached.headers;
+    if (!isBodilessStatus(cached.status)) {
+        _response += "Content-Length: " + std::to_string(cached.body->size()) + "\r\n";
+    }
+    _response += "Age: " + std::to_string(std::max<time_t>(0, time(NULL) - cached.stored)) + "\r\n";
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    // shared with the cache and every other request replaying it
+    _body.addMemory(cached.body);
 }
 
-// execute the CGI script. forks a new process to run the CGI script and manages input/output via pipes.
-void Request::executeCGI(std::string path, std::string method, std::string body) {
+// execute the CGI script. spawns a new process to run the CGI script and manages input/output via pipes.
+void Request::executeCGI(std::string path, std::string body) {
     try {
         // validate the CGI request and prepare the environment for execution
         // checks if the path and location are valid for CGI execution.
@@ -54,6 +221,11 @@ void Request::executeCGI(std::string path, std::string method, std::string body)
             return;
         }
 
+        // scripts with a runner go to a pre-forked interpreter, nothing is started for this request
+        if (executeCgiWorker(location, path, body)) {
+            return;
+        }
+
         // prepare pipes for communication between the parent and child processes
         // stdinPipe: for sending input to the CGI script (e.g., POST data)
         // stdoutPipe: for capturing the output of the CGI script
@@ -64,24 +236,22 @@ void Request::executeCGI(std::string path, std::string method, std::string body)
             return;  
         }
 
-        // fork the process to create a child process that will execute the CGI script
-        pid_t pid = fork();
+        // start the script without copying the server: posix_spawn() makes the pipes its stdio and runs it in the location root
+        pid_t pid = spawnCgiScript(stdinPipe, stdoutPipe, stderrPipe, location, path);
         if (pid == -1) {
-            // if forking fails, log the error and return a 500 Internal Server Error
-            std::cerr << "Failed to fork" << std::endl;
+            // if the script can't be started, log the error and return a 500 Internal Server Error
+            std::cerr << "Failed to start CGI script: " << strerror(errno) << std::endl;
+            int fds[] = {stdinPipe[0], stdinPipe[1], stdoutPipe[0], stdoutPipe[1], stderrPipe[0], stderrPipe[1]};
+            for (int fd : fds) {
+                close(fd);
+            }
             ServeErrorPage(500);
             return;
         }
 
-        if (pid == 0) {
-            // child process: responsible for executing the CGI script
-            // this process will handle reading input, executing the script, and writing output.
-            handleCgiChildProcess(stdinPipe, stdoutPipe, stderrPipe, location, path, method, body);
-        } else {
-            // parent process: responsible for managing input/output with the CGI script
-            // this process writes any input (like POST data) to the CGI script and captures its output and errors.
-            handleCgiParentProcess(stdinPipe, stdoutPipe, stderrPipe, body, pid);
-        }
+        // hands the script's pipes to the event loop, which feeds it the body (like POST data)
+        // and passes its output on to the client as it is written, its errors go to the log.
+        handleCgiParentProcess(stdinPipe, stdoutPipe, stderrPipe, std::move(body), pid, location->cgi_timeout);
     } catch (const std::runtime_error &e) {
         // if any runtime error occurs during CGI execution, log the error and send a 500 Internal Server Error
         std::cerr << "CGI runtime error: " << e.what() << std::endl;
@@ -89,6 +259,92 @@ void Request::executeCGI(std::string path, std::string method, std::string body)
     }
 }
 
+// hand the script to the pre-forked interpreters of its extension if the location has a runner for it.
+// the event loop's worker pool runs it and the output is streamed back through appendCgiOutput()
+bool Request::executeCgiWorker(LocationConfig* location, const std::string& scriptPath, std::string& body) {
+    std::string::size_type dotPos = scriptPath.find_last_of('.');
+    if (dotPos == std::string::npos) {
+        return false;
+    }
+    std::string ext = scriptPath.substr(dotPos);
+
+    for (size_t i = 0; i < location->cgi_extension.size() && i < location->cgi_worker_runner.size(); ++i) {
+        if (ext != location->cgi_extension[i] || location->cgi_worker_runner[i].empty() || i >= location->cgi_path.size()) {
+            continue;
+        }
+        // the body goes out in FastCGI records from memory
+        if (!loadSpooledBody(body)) {
+            ServeErrorPage(500);
+            return true;
+        }
+        _fastcgi = std::make_unique<FastCgiRequest>();
+        _fastcgi->worker = location->cgiWorkerConfig(i);
+        _fastcgi->params = cgiEnvironment(location, scriptPath);
+        _fastcgi->stdin_data = std::move(body);
+        _fastcgi->timeout = location->cgi_timeout;
+        _fastcgi->deadline = time(NULL) + location->cgi_timeout;
+        return true;
+    }
+    return false;
+}
+
+// hand the request to the location's FastCGI backend. the worker's connection pool sends it and
+// streams the response back through appendCgiOutput(), no process is started here
+void Request::executeFastCgi(LocationConfig* location) {
+    std::string scriptPath = _url;
+    if (validateCgiRequest(scriptPath) == nullptr) {
+        return;
+    }
+    if (!loadSpooledBody(_request.body)) {
+        ServeErrorPage(500);
+        return;
+    }
+
+    _fastcgi = std::make_unique<FastCgiRequest>();
+    _fastcgi->address = location->fastcgi_pass;
+    _fastcgi->params = cgiEnvironment(location, scriptPath);
+    // the body isn't needed here anymore, so it is moved rather than copied
+    _fastcgi->stdin_data = std::move(_request.body);
+    _fastcgi->timeout = location->cgi_timeout;
+    _fastcgi->deadline = time(NULL) + location->cgi_timeout;
+}
+
+// the CGI/1.1 meta-variables (RFC 3875 section 4.1) with the request headers as HTTP_* variables
+FastCgiParams Request::cgiEnvironment(LocationConfig* location, const std::string& scriptPath) {
+    std::string root = getAbsolutePath(location->root);
+    std::string query = _url.find("?") != std::string::npos ? _url.substr(_url.find("?") + 1) : "";
+    std::string locationPath = location->path == "/" ? "" : location->path;
+
+    FastCgiParams params = {
+        {"GATEWAY_INTERFACE", "CGI/1.1"},
+        {"SERVER_PROTOCOL", _http_version},
+        {"SERVER_SOFTWARE", "webserv"},
+        {"SERVER_NAME", _config.server_name},
+        {"SERVER_PORT", std::to_string(_port)},
+        {"REQUEST_METHOD", _method},
+        {"REQUEST_URI", _url},
+        {"QUERY_STRING", query},
+        {"DOCUMENT_ROOT", root},
+        {"SCRIPT_NAME", locationPath + "/" + scriptPath},
+        {"SCRIPT_FILENAME", root + "/" + scriptPath},
+        {"CONTENT_LENGTH", std::to_string(_request.content_length)},
+        {"CONTENT_TYPE", _request.getHeader("content-type")}
+    };
+
+    for (auto it = _request.headers.begin(); it != _request.headers.end(); ++it) {
+        // these two already have their own variables
+        if (it->first == "content-type" || it->first == "content-length") {
+            continue;
+        }
+        std::string name = "HTTP_" + it->first;
+        for (size_t i = 5; i < name.size(); ++i) {
+            name[i] = name[i] == '-' ? '_' : std::toupper(static_cast<unsigned char>(name[i]));
+        }
+        params.push_back(std::make_pair(name, it->second));
+    }
+    return params;
+}
+
 // this function ensures that the CGI request is valid and prepares the necessary environment for execution.
 LocationConfig* Request::validateCgiRequest(std::string& path) {
     // find the location configuration for the given URL (_url).
@@ -128,66 +384,43 @@ LocationConfig* Request::validateCgiRequest(std::string& path) {
     return location;
 }
 
-// this function is executed by the child process after the parent forks. It handles the actual CGI script execution.
-void Request::handleCgiChildProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], LocationConfig* location, const std::string& scriptPath, const std::string& method, const std::string& body) {
-    // close the unused ends of the pipes in the child process.
-    close(stdinPipe[1]); // close the write end of the stdin pipe
-    close(stdoutPipe[0]); // close the read end of the stdout pipe
-    close(stderrPipe[0]); // close the read end of the stderr pipe
-
-    // redirect the pipes to the standard input/output/error of the child process.
-    // this allows the CGI script to read from the stdinPipe and write to the stdoutPipe and stderrPipe.
-    dup2(stdinPipe[0], STDIN_FILENO); // redirect stdin to the read end of the pipe
-    dup2(stdoutPipe[1], STDOUT_FILENO); // redirect stdout to the write end of the pipe
-    dup2(stderrPipe[1], STDERR_FILENO); // redirect stderr to the write end of the pipe
-
-    // close the original pipe file descriptors after duplicating them.
-    close(stdinPipe[0]); // close the original read end of the stdin pipe
-    close(stdoutPipe[1]); // close the original write end of the stdout pipe
-    close(stderrPipe[1]); // close the original write end of the stderr pipe
-
-    // change the current working directory to the root directory of the location.
-    // this ensures that the script is executed relative to the correct directory.
-    if (chdir(location->root.c_str()) != 0) {
-        // if changing the directory fails, log an error to stderr and exit the child process.
-        write(STDERR_FILENO, "Failed to change directory to root\n", 35);
-        // exit the child process with an error status
-        _exit(1);
-    }
-
-    // prepare environment variables for the CGI script.
-    // these include the request method, content length, script name, query string, and content type.
-    std::vector<std::string> env_vars = {
-        "REQUEST_METHOD=" + method,                               // HTTP request method (e.g., GET, POST)
-        "CONTENT_LENGTH=" + std::to_string(body.length()),        // length of the body (used in POST requests)
-        "SCRIPT_NAME=" + scriptPath,                              // the path to the script
-        "QUERY_STRING=" + (_url.find("?") != std::string::npos ? _url.substr(_url.find("?") + 1) : ""),  // query string if present
-        "CONTENT_TYPE=application/x-www-form-urlencoded"          // content type for form submissions
-    };
-
-    // convert the environment variables to the format required by execve (array of char pointers).
-    std::vector<char*> envp;
-    for (size_t i = 0; i < env_vars.size(); ++i) {
-        // convert std::string to char*
-        envp.push_back(const_cast<char*>(env_vars[i].c_str()));
+// start the interpreter of the script's extension on the script. the pipe ends become its stdin, stdout and stderr,
+// it runs in the location root so the script path is relative to it. returns the pid, -1 with errno set on failure
+pid_t Request::spawnCgiScript(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], LocationConfig* location, const std::string& scriptPath) {
+    std::string interpreter = cgiInterpreter(location, scriptPath);
+    if (interpreter.empty()) {
+        errno = ENOEXEC;
+        return -1;
     }
-    // null-terminate the array
-    envp.push_back(nullptr);
 
-    // execute the CGI script using the relative script path.
-    if (!executeCgiScript(location, scriptPath, envp.data())) {
-        // if execution fails, log an error to stderr and exit the child process with an error status.
-        write(STDERR_FILENO, "CGI execution failed\n", 21);
-        // exit the child process with an error status
-        _exit(1);
+    SpawnOptions options;
+    options.path = interpreter; // CGI interpreter (e.g., /usr/bin/python3)
+    options.argv = {interpreter, scriptPath}; // the script being executed, relative to the location root
+    options.cwd = location->root;
+    // the script reads the request body from the stdin pipe, or straight from the file it was spooled to
+    options.stdin_fd = _request.spooled_body ? _request.spooled_body->fd() : stdinPipe[0];
+    options.stdout_fd = stdoutPipe[1];
+    options.stderr_fd = stderrPipe[1];
+
+    // the same CGI/1.1 environment the pre-forked workers and FastCGI backends get, request headers included
+    FastCgiParams params = cgiEnvironment(location, scriptPath);
+    for (auto it = params.begin(); it != params.end(); ++it) {
+        options.env.push_back(it->first + "=" + it->second);
     }
+
+    return spawnProcess(options);
 }
 
 // setup pipes for communication between parent and child process (including stderr)
-// this function creates three pipes: one for stdin, one for stdout, and one for stderr
+// this function creates three pipes: one for stdin, one for stdout, and one for stderr.
+// they are close-on-exec so scripts started by other workers don't inherit them, dup2() clears the flag on the child's stdio
 bool Request::setupPipes(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2]) {
+    // a spooled body needs no stdin pipe, the script gets the file itself
+    if (_request.spooled_body) {
+        stdinPipe[0] = -1;
+        stdinPipe[1] = -1;
     // create the stdin pipe. If it fails, log the error and return false
-    if (pipe(stdinPipe) == -1) {
+    } else if (pipe2(stdinPipe, O_CLOEXEC) == -1) {
         std::cerr << "Failed to create stdin pipe: " << strerror(errno) << std::endl;
         ServeErrorPage(500);
         // indicate failure
@@ -195,16 +428,22 @@ bool Request::setupPipes(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2])
     }
 
     // create the stdout pipe. If it fails, log the error and return false
-    if (pipe(stdoutPipe) == -1) {
+    if (pipe2(stdoutPipe, O_CLOEXEC) == -1) {
         std::cerr << "Failed to create stdout pipe: " << strerror(errno) << std::endl;
+        close(stdinPipe[0]);
+        close(stdinPipe[1]);
         ServeErrorPage(500);
         // indicate failure
         return false;
     }
 
     // Create the stderr pipe. If it fails, log the error and return false
-    if (pipe(stderrPipe) == -1) {
+    if (pipe2(stderrPipe, O_CLOEXEC) == -1) {
         std::cerr << "Failed to create stderr pipe: " << strerror(errno) << std::endl;
+        close(stdinPipe[0]);
+        close(stdinPipe[1]);
+        close(stdoutPipe[0]);
+        close(stdoutPipe[1]);
         ServeErrorPage(500);
         // indicate failure
         return false;
@@ -214,53 +453,28 @@ bool Request::setupPipes(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2])
     return true;
 }
 
-// Execute the CGI script using 'execve' based on the file extension and configured CGI path
-bool Request::executeCgiScript(LocationConfig* location, const std::string& scriptPath, char* const envp[]) {
-    // use the full script path (relative to the location root)
-    std::string scriptName = scriptPath;
-
+// the configured interpreter for the script's file extension, empty if there is none
+std::string Request::cgiInterpreter(LocationConfig* location, const std::string& scriptPath) {
     // find the last occurrence of a dot ('.') to determine the file extension
-    std::string::size_type dotPos = scriptName.find_last_of('.');
+    std::string::size_type dotPos = scriptPath.find_last_of('.');
     if (dotPos == std::string::npos) {
-        // if no file extension is found, log an error and return false
-        write(STDERR_FILENO, "Failed to determine file extension\n", 35);
-        return false;
+        return "";
     }
 
     // extract the file extension from the script name
-    std::string ext = scriptName.substr(dotPos);
+    std::string ext = scriptPath.substr(dotPos);
 
     // iterate over the configured CGI extensions in the location
-    for (size_t i = 0; i < location->cgi_extension.size(); ++i) {
-        // if the script extension matches a valid CGI extension
+    for (size_t i = 0; i < location->cgi_extension.size() && i < location->cgi_path.size(); ++i) {
         if (ext == location->cgi_extension[i]) {
-            // prepare the arguments for execve: CGI interpreter and script path
-            char *const cgiExecArgv[] = {
-                (char *)location->cgi_path[i].c_str(), // CGI interpreter (e.g., /usr/bin/python3)
-                (char *)scriptName.c_str(), // path to the script being executed
-                NULL // null-terminate the argument list
-            };
-
-            // execute the CGI script using execve with the CGI interpreter and environment variables
-            execve(location->cgi_path[i].c_str(), cgiExecArgv, envp);
-
-            // if execve fails, log the error message (using strerror to get system error description)
-            write(STDERR_FILENO, "Failed to execute CGI script: ", 30);
-            write(STDERR_FILENO, strerror(errno), strlen(strerror(errno)));
-            write(STDERR_FILENO, "\n", 1);
-
-            // return false as execve failed
-            return false;
+            return location->cgi_path[i];
         }
     }
-
-    // if no valid interpreter, return false
-    write(STDERR_FILENO, "No valid CGI interpreter found\n", 31);
-    return false;
+    return "";
 }
 
-// handle the parent process logic for managing the CGI process and collecting output and errors
-void Request::handleCgiParentProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], const std::string& body, pid_t pid) {
+// handle the parent process logic: the CGI process continues asynchronously in the event loop
+void Request::handleCgiParentProcess(int stdinPipe[2], int stdoutPipe[2], int stderrPipe[2], std::string body, pid_t pid, int timeout) {
     // close the unused read end of the stdin pipe (since the parent only writes to stdin)
     close(stdinPipe[0]);
 
@@ -268,147 +482,15 @@ void Request::handleCgiParentProcess(int stdinPipe[2], int stdoutPipe[2], int st
     close(stdoutPipe[1]);
     close(stderrPipe[1]);
 
-    // write the request body (for POST requests) to the CGI script via the stdin pipe
-    writeBodyToPipe(body, stdinPipe[1]);
-
-    // close the write end of stdin after sending the body to signal EOF to the CGI script
-    close(stdinPipe[1]);
-
-    // monitor the CGI process, passing the read ends of the stdout and stderr pipes to collect output and errors
-    if (!monitorCgiExecution(pid, stdoutPipe[0], stderrPipe[0])) {
-        // if monitoring fails (e.g., process timeout), exit early
-        return;
-    }
-
-    // close the remaining read ends of the stdout and stderr pipes after capturing the output and errors
-    close(stdoutPipe[0]);
-    close(stderrPipe[0]);
+    // the server registers the remaining ends with epoll, writes the body to stdin and feeds the output
+    // to appendCgiOutput(), no response exists until the script has sent its header block
+    _cgi = std::make_unique<CgiProcess>(pid, stdinPipe[1], stdoutPipe[0], stderrPipe[0], std::move(body), timeout);
 }
 
-// write the request body to the CGI script via the stdin pipe
-void Request::writeBodyToPipe(const std::string& body, int writeFd) {
-    // check if there is any body content to write
-    if (!body.empty()) {
-        ssize_t totalWritten = 0; // tracks how much of the body has been written
-        ssize_t bytesToWrite = body.length(); // the total number of bytes to write
-        const char* bodyData = body.c_str(); // pointer to the body content
-
-        // continue writing until all bytes have been written
-        while (totalWritten < bytesToWrite) {
-            // write a portion of the body to the write end of the pipe
-            ssize_t bytesWritten = write(writeFd, bodyData + totalWritten, bytesToWrite - totalWritten);
-            
-            // check if the write operation failed
-            if (bytesWritten == -1) {
-                std::cerr << "failed to write to stdin pipe" << std::endl;
-                ServeErrorPage(500);
-                // close the write end of the pipe
-                close(writeFd);
-                return;
-            }
-
-            // update the number of bytes written so far
-            totalWritten += bytesWritten;
-        }
-    }
-}
-
-// monitor the CGI process execution and handle timeouts or errors
-bool Request::monitorCgiExecution(pid_t pid, int stdoutPipe, int stderrPipe) {
-    int status; // stores the status of the child process
-    pid_t result;
-    const int timeout_seconds = 3; // set timeout for CGI execution (seconds)
-    time_t start_time = time(NULL); // record the start time
-
-    // loop to monitor the CGI process
-    while (true) {
-        result = waitpid(pid, &status, WNOHANG);  // non-blocking wait for the child process
-        if (result == 0) {
-            // check if the timeout has been exceeded
-            if (time(NULL) - start_time >= timeout_seconds) {
-                // kill the process if it exceeds the timeout
-                kill(pid, SIGKILL); // forcefully terminate the child process
-                waitpid(pid, &status, 0);  // wait for the process to terminate
-
-                std::cerr << "CGI script execution timed out" << std::endl;
-
-                ServeErrorPage(504); // serve a "Gateway Timeout" error
-
-                close(stdoutPipe); // close the stdout pipe
-                close(stderrPipe); // close the stderr pipe
-
-                return false;  // timeout occurred, return failure
-            }
-            usleep(10000); // sleep for 10ms before checking the process again
-        } else if (result == -1) {
-            // error occurred while waiting for the child process
-            std::cerr << "Failed to wait for CGI process" << std::endl;
-            ServeErrorPage(500);
-            close(stdoutPipe); // close the stdout pipe
-            close(stderrPipe); // close the stderr pipe
-            return false; // return failure due to waitpid error
-        } else {
-            // the child process has finished
-            break;
-        }
-    }
-
-    // check if the child process exited with an error status
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-        // log the error exit status
-        std::cerr << "CGI script exited with status " << WEXITSTATUS(status) << std::endl;
-        // capture and process the CGI output (both stdout and stderr)
-        processCgiOutput(stdoutPipe, stderrPipe);
-        return false; // return failure due to non-zero exit status
-    }
-
-    // if the process finished successfully, process the CGI output and errors
-    processCgiOutput(stdoutPipe, stderrPipe);
-    return true; // return success
-}
-
-// process the output from the CGI script and prepare the HTTP response
-void Request::processCgiOutput(int stdoutPipe, int stderrPipe) {
-    // buffer to hold data read from pipes
-    char buffer[1024];
-
-    std::string cgiOutput; // string to accumulate the standard output from the CGI script
-    std::string cgiErrors; // string to accumulate any errors (stderr) from the CGI script
-    ssize_t bytesRead;
-
-    // read from stdout (normal CGI output)
-    while ((bytesRead = read(stdoutPipe, buffer, sizeof(buffer))) > 0) {
-        cgiOutput.append(buffer, bytesRead); // append the data read from stdout to the cgiOutput string
-    }
-
-    // read from stderr (errors)
-    while ((bytesRead = read(stderrPipe, buffer, sizeof(buffer))) > 0) {
-        cgiErrors.append(buffer, bytesRead); // append the data read from stderr to the cgiErrors string
-    }
-
-    // prepare the full HTTP response body
-    std::string responseBody = "<html><body>";
-    // add CGI output to the response
-    responseBody += "<h1>CGI Output</h1><pre>" + cgiOutput + "</pre>";
-
-    if (!cgiErrors.empty()) {
-        // if there are errors, append the stderr output to the response to make the errors visible
-        responseBody += "<h2>CGI Errors</h2><pre>" + cgiErrors + "</pre>";
-    }
-
-    // close the HTML body
-    responseBody += "</body></html>";
-
-    // prepare the HTTP response with headers
-    _response = _http_version + " 200 OK\r\n";
-    _response += "Content-Type: text/html\r\n"; // set content type as HTML
-    _response += "Content-Length: " + std::to_string(responseBody.length()) + "\r\n"; // set content length header
-    _response += "\r\n"; // end of headers
-    _response += responseBody; // append the body of the HTTP response
-
-    // log CGI output and errors for debugging purposes
-    std::cout << "CGI Output: " << cgiOutput << std::endl; // log the CGI output
-    if (!cgiErrors.empty()) {
-        std::cerr << "CGI Errors: " << cgiErrors << std::endl; // log any errors from stderr
-    }
+// the script ran past the location's cgi_timeout (504) or misbehaved (502)
+void Request::failCgi(int error_code, const std::string &reason) {
+    std::cerr << "CGI request failed: " << reason << std::endl;
+    // the script is killed when the process is dropped, a FastCGI request was already aborted
+    _cgi.reset();
+    ServeErrorPage(error_code);
 }
@@ -0,0 +1,102 @@
+#include "CgiCache.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <unistd.h>
+
+size_t CachedCgiResponse::bytes() const {
+    return status.size() + headers.size() + (body ? body->size() : 0);
+}
+
+CgiCache::CgiCache(size_t max_size) : _max_size(max_size), _size(0) {}
+
+CgiCache::Lookup CgiCache::lookup(const std::string &key, time_t now, int notify_fd, CachedCgiResponse &out) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it != _entries.end()) {
+        Entry &entry = it->second;
+        if (entry.state == FILLING) {
+            if (std::find(entry.waiters.begin(), entry.waiters.end(), notify_fd) == entry.waiters.end()) {
+                entry.waiters.push_back(notify_fd);
+            }
+            return WAIT;
+        }
+        if (now < entry.expires) {
+            _lru.splice(_lru.begin(), _lru, entry.lru);
+            if (entry.state == PASSING) {
+                return PASS;
+            }
+            out = entry.response;
+            return HIT;
+        }
+        // expired, the caller refreshes it
+        erase(it);
+    }
+    _entries[key];
+    return MISS;
+}
+
+void CgiCache::store(const std::string &key, CachedCgiResponse response, time_t expires) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it == _entries.end() || it->second.state != FILLING) {
+        return;
+    }
+    Entry &entry = it->second;
+    entry.response = std::move(response);
+    entry.state = FRESH;
+    entry.expires = expires;
+    settle(key, entry);
+}
+
+void CgiCache::pass(const std::string &key, time_t expires) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it == _entries.end() || it->second.state != FILLING) {
+        return;
+    }
+    Entry &entry = it->second;
+    entry.state = PASSING;
+    entry.expires = expires;
+    settle(key, entry);
+}
+
+void CgiCache::abandon(const std::string &key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it == _entries.end() || it->second.state != FILLING) {
+        return;
+    }
+    wake(it->second);
+    _entries.erase(it);
+}
+
+// a finished run: its waiters are woken and it takes its place in the LRU, the least recently used go if it doesn't fit
+void CgiCache::settle(const std::string &key, Entry &entry) {
+    wake(entry);
+    _lru.push_front(key);
+    entry.lru = _lru.begin();
+    _size += key.size() + entry.response.bytes();
+    while (_size > _max_size && !_lru.empty()) {
+        erase(_entries.find(_lru.back()));
+    }
+}
+
+void CgiCache::erase(std::unordered_map<std::string, Entry>::iterator it) {
+    Entry &entry = it->second;
+    if (entry.state != FILLING) {
+        _size -= it->first.size() + entry.response.bytes();
+        _lru.erase(entry.lru);
+    }
+    _entries.erase(it);
+}
+
+// the waiting workers look their requests up again
+void CgiCache::wake(Entry &entry) {
+    uint64_t one = 1;
+    for (size_t i = 0; i < entry.waiters.size(); ++i) {
+        ssize_t ignored = write(entry.waiters[i], &one, sizeof(one));
+        (void)ignored;
+    }
+    entry.waiters.clear();
+}
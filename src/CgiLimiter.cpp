@@ -0,0 +1,81 @@
+#include "CgiLimiter.hpp"
+
+#include <algorithm>
+#include <unistd.h>
+
+CgiLimiter::CgiLimiter(size_t max_concurrency, size_t queue_size) : _next_ticket(1) {
+    _stats.max_concurrency = max_concurrency;
+    _stats.queue_size = queue_size;
+}
+
+CgiLimiter::Admission CgiLimiter::acquire(int notify_fd, uint64_t &ticket) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // requests already waiting go first, even if a slot happens to be free for a moment
+    if (_stats.running < _stats.max_concurrency && _queue.empty()) {
+        _stats.running++;
+        _stats.admitted++;
+        return RUN;
+    }
+    if (_queue.size() >= _stats.queue_size) {
+        _stats.rejected++;
+        return FULL;
+    }
+    ticket = _next_ticket++;
+    _queue.push_back(Waiter{ticket, notify_fd, Clock::now()});
+    _stats.queued = _queue.size();
+    return QUEUED;
+}
+
+bool CgiLimiter::claim(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _granted.erase(ticket) > 0;
+}
+
+bool CgiLimiter::leave(uint64_t ticket, bool timed_out) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _queue.begin(); it != _queue.end(); ++it) {
+        if (it->ticket != ticket) {
+            continue;
+        }
+        if (timed_out) {
+            _stats.timed_out++;
+            recordWait(it->since);
+        }
+        _queue.erase(it);
+        _stats.queued = _queue.size();
+        return true;
+    }
+    return false;
+}
+
+void CgiLimiter::release() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_queue.empty()) {
+        _stats.running--;
+        return;
+    }
+
+    // the slot stays taken, it only changes hands
+    Waiter next = _queue.front();
+    _queue.pop_front();
+    _stats.queued = _queue.size();
+    _stats.admitted++;
+    _stats.waited++;
+    recordWait(next.since);
+    _granted.insert(next.ticket);
+
+    uint64_t one = 1;
+    ssize_t ignored = write(next.notify_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+CgiLimiterStats CgiLimiter::stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void CgiLimiter::recordWait(Clock::time_point since) {
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    _stats.wait_total_ms += ms;
+    _stats.wait_max_ms = std::max(_stats.wait_max_ms, ms);
+}
@@ -0,0 +1,89 @@
+#include "../include/CgiProcess.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+CgiProcess::CgiProcess(pid_t child, int stdin_pipe, int stdout_pipe, int stderr_pipe, std::string body, int silence_timeout)
+    : pid(child), pidfd(-1), stdin_fd(stdin_pipe), stdout_fd(stdout_pipe), stderr_fd(stderr_pipe),
+      timeout(silence_timeout), deadline(time(NULL) + silence_timeout), input(std::move(body)), input_offset(0), exited(false), status(0) {
+    // the event loop must never wait on the script
+    int fds[] = {stdin_fd, stdout_fd, stderr_fd};
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+#ifdef SYS_pidfd_open
+    // without a pidfd the exit is picked up once the output pipes are closed, or by the timer
+    pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd != -1) {
+        fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+}
+
+CgiProcess::~CgiProcess() {
+    closeFd(stdin_fd);
+    closeFd(stdout_fd);
+    closeFd(stderr_fd);
+    closeFd(pidfd);
+
+    // the client went away or the script ran out of time
+    if (!exited) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+}
+
+bool CgiProcess::writeInput() {
+    while (input_offset < input.size()) {
+        ssize_t bytes = write(stdin_fd, input.data() + input_offset, input.size() - input_offset);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // a full pipe is retried when it is writable again, a script that doesn't read its body is fine
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        input_offset += bytes;
+    }
+    // everything was written, closing stdin signals EOF to the script
+    return false;
+}
+
+bool CgiProcess::readOutput(int fd, std::string &data) {
+    // a single read per event, a script writing faster than the client reads can't hold up the loop
+    char buffer[65536];
+    while (true) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            data.append(buffer, bytes);
+            return true;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        // EAGAIN means more may come, EOF or an error ends this pipe
+        return bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+bool CgiProcess::reap() {
+    if (exited) {
+        return true;
+    }
+    pid_t result = waitpid(pid, &status, WNOHANG);
+    // ECHILD: nothing left to wait for
+    exited = result == pid || (result == -1 && errno == ECHILD);
+    return exited;
+}
+
+void CgiProcess::closeFd(int &fd) {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,244 @@
+#include "../include/Request.hpp"
+
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <iterator>
+#include <cstdlib>
+#include <sys/wait.h>
+
+// feed a piece of the script's stdout. until the blank line ending the CGI header block
+// everything is held back, after that the body is passed on as it arrives
+bool Request::appendCgiOutput(std::string data) {
+    if (_cgi_headers_done) {
+        appendCgiBody(std::move(data));
+        return true;
+    }
+
+    _cgi_header_buffer += data;
+    // scripts end their header lines with "\n" as often as with "\r\n"
+    size_t crlf = _cgi_header_buffer.find("\r\n\r\n");
+    size_t lf = _cgi_header_buffer.find("\n\n");
+    size_t headerEnd = std::min(crlf, lf);
+    if (headerEnd == std::string::npos) {
+        return _cgi_header_buffer.size() <= MAX_HEADER_SIZE;
+    }
+    size_t bodyStart = headerEnd + (headerEnd == crlf ? 4 : 2);
+
+    if (!startCgiResponse(_cgi_header_buffer.substr(0, headerEnd))) {
+        return false;
+    }
+    _cgi_headers_done = true;
+    std::string body = _cgi_header_buffer.substr(bodyStart);
+    _cgi_header_buffer.clear();
+    appendCgiBody(std::move(body));
+    return true;
+}
+
+// RFC 3875 section 6.3: Status sets the status line, Location without Status is a redirect,
+// the other fields become response headers. the framing and hop-by-hop headers are ours
+bool Request::startCgiResponse(const std::string& headerBlock) {
+    std::string status = HTTP_200;
+    std::string headers;
+    bool hasStatus = false;
+    bool hasLocation = false;
+    bool hasLength = false;
+    std::string lengthHeader;
+    // what the CGI cache needs to replay it: the headers without our framing, and whether it may be shared
+    std::string cacheHeaders;
+    std::string cacheControl;
+    bool shareable = true;
+
+    std::istringstream lines(headerBlock);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0) {
+            return false;
+        }
+        std::string name = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+        if (lower == "status") {
+            // "404 Not Found", the reason phrase is optional
+            if (value.size() < 3 || !std::isdigit(static_cast<unsigned char>(value[0]))) {
+                return false;
+            }
+            status = value;
+            hasStatus = true;
+            continue;
+        }
+        if (lower == "connection" || lower == "keep-alive" || lower == "transfer-encoding" || lower == "date" || lower == "server") {
+            continue;
+        }
+        if (lower == "location") {
+            hasLocation = true;
+        } else if (lower == "content-length") {
+            hasLength = true;
+            lengthHeader = name + ": " + value + "\r\n";
+            continue;
+        } else if (lower == "cache-control") {
+            cacheControl = value;
+        } else if (lower == "set-cookie" || (lower == "vary" && value == "*")) {
+            shareable = false;
+        }
+        headers += name + ": " + value + "\r\n";
+        cacheHeaders += name + ": " + value + "\r\n";
+    }
+
+    if (hasLocation && !hasStatus) {
+        status = "302 Found";
+    }
+
+    if (_cgi_cache_filling) {
+        int lifetime = cgiCacheLifetime(status, cacheControl, shareable);
+        if (lifetime > 0) {
+            _cgi_cache_entry.status = status;
+            _cgi_cache_entry.headers = cacheHeaders;
+            _cgi_cache_expires = time(NULL) + lifetime;
+        } else {
+            passCgiCache();
+        }
+    }
+
+    // RFC 9112 section 6.3: 1xx, 204 and 304 end with their headers, whatever the script writes after them is dropped
+    if (isBodilessStatus(status)) {
+        _cgi_bodiless = true;
+    } else if (hasLength) {
+        headers += lengthHeader;
+    } else {
+        // without a length the end of the body has to be marked: chunked for HTTP/1.1, closing the connection for HTTP/1.0
+        if (_http_version == "HTTP/1.1") {
+            headers += "Transfer-Encoding: chunked\r\n";
+            _cgi_chunked = true;
+        } else {
+            _keep_alive = false;
+        }
+    }
+
+    _response = _http_version + " " + status + "\r\n";
+    _response += headers;
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    return true;
+}
+
+void Request::appendCgiBody(std::string data) {
+    if (data.empty() || _cgi_bodiless) {
+        return;
+    }
+    if (_cgi_cache_filling) {
+        _cgi_cache_body += data;
+        // too large to keep, it is passed on like any other response
+        if (_cgi_cache_body.size() > CGI_CACHE_MAX_ENTRY) {
+            passCgiCache();
+        }
+    }
+    if (!_cgi_chunked) {
+        _body.addMemory(std::move(data));
+        return;
+    }
+    std::ostringstream size;
+    size << std::hex << data.size() << "\r\n";
+    _body.addMemory(size.str());
+    _body.addMemory(std::move(data));
+    // shared by every chunk of every response, nothing to allocate
+    static const std::shared_ptr<const std::string> crlf = std::make_shared<const std::string>("\r\n");
+    _body.addMemory(crlf);
+}
+
+// the script's stderr goes to our log, never into the response
+void Request::appendCgiErrors(const std::string &data) {
+    std::string message = data;
+    while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) {
+        message.pop_back();
+    }
+    if (!message.empty()) {
+        bool backend = _fastcgi && _fastcgi->worker.runner.empty();
+        std::cerr << (backend ? "FastCGI stderr: " : "CGI stderr: ") << message << std::endl;
+    }
+}
+
+// once the header block is through, a forked script's stdout is queued as a pipe and spliced to the
+// socket by the response itself. only the header block and whatever came with it were copied
+void Request::relayCgiOutput(int fd) {
+    _body.addPipe(fd, _cgi_chunked);
+    _cgi_relayed = true;
+}
+
+// the script has finished, a response without a header block is a broken script
+bool Request::finishCgiResponse() {
+    // a failing script's output is still passed on, its exit status is only logged
+    if (_cgi && WIFEXITED(_cgi->status) && WEXITSTATUS(_cgi->status) != 0) {
+        std::cerr << "CGI script exited with status " << WEXITSTATUS(_cgi->status) << std::endl;
+    }
+    if (!_cgi_headers_done) {
+        return false;
+    }
+    // a relayed pipe ends its chunks itself
+    if (_cgi_chunked && !_cgi_relayed) {
+        _body.addMemory(std::string("0\r\n\r\n"));
+    }
+    // the requests waiting for this run are answered from the stored copy
+    if (_cgi_cache_filling) {
+        _cgi_cache_entry.body = std::make_shared<const std::string>(std::move(_cgi_cache_body));
+        _cgi_cache_entry.stored = time(NULL);
+        _cgi_location->cgi_cache->store(_cgi_cache_key, std::move(_cgi_cache_entry), _cgi_cache_expires);
+        _cgi_cache_filling = false;
+    }
+    _cgi.reset();
+    _fastcgi.reset();
+    return true;
+}
+
+bool Request::isBodilessStatus(const std::string &status) {
+    int code = std::atoi(status.c_str());
+    return (code >= 100 && code < 200) || code == 204 || code == 304;
+}
+
+// Cache-Control from the script decides, without it a response is kept for the location's cgi_cache_ttl
+// if RFC 9110 section 15.1 lets its status be cached heuristically
+int Request::cgiCacheLifetime(const std::string &status, const std::string &cacheControl, bool shareable) {
+    static const int heuristic[] = {200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501};
+    int code = std::atoi(status.c_str());
+    if (!shareable || std::find(std::begin(heuristic), std::end(heuristic), code) == std::end(heuristic)) {
+        return 0;
+    }
+
+    int lifetime = _cgi_location->cgi_cache_ttl;
+    bool sharedAge = false;
+    std::istringstream directives(cacheControl);
+    std::string directive;
+    while (std::getline(directives, directive, ',')) {
+        directive.erase(0, directive.find_first_not_of(" \t"));
+        directive.erase(directive.find_last_not_of(" \t") + 1);
+        std::transform(directive.begin(), directive.end(), directive.begin(), ::tolower);
+        if (directive == "no-store" || directive == "no-cache" || directive == "private") {
+            return 0;
+        }
+        // s-maxage is meant for shared caches like this one and wins over max-age
+        if (directive.compare(0, 9, "s-maxage=") == 0) {
+            lifetime = std::atoi(directive.c_str() + 9);
+            sharedAge = true;
+        } else if (directive.compare(0, 8, "max-age=") == 0 && !sharedAge) {
+            lifetime = std::atoi(directive.c_str() + 8);
+        }
+    }
+    return lifetime;
+}
+
+// waiting requests run the script themselves, and so does every request for the key until the location's TTL is up
+void Request::passCgiCache() {
+    _cgi_location->cgi_cache->pass(_cgi_cache_key, time(NULL) + _cgi_location->cgi_cache_ttl);
+    _cgi_cache_filling = false;
+    _cgi_cache_body.clear();
+    _cgi_cache_body.shrink_to_fit();
+}
@@ -0,0 +1,235 @@
+#include "CgiWorkerPool.hpp"
+#include "Spawn.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static std::string groupKey(const CgiWorkerConfig &config) {
+    return config.interpreter + " " + config.runner;
+}
+
+// resident set size of a process from /proc, 0 if it can't be read
+static size_t residentMemory(pid_t pid) {
+    std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+CgiWorkerPool::~CgiWorkerPool() {
+    for (auto it = _groups.begin(); it != _groups.end(); ++it) {
+        for (size_t i = 0; i < it->second.workers.size(); ++i) {
+            kill(it->second.workers[i].pid, SIGKILL);
+            waitpid(it->second.workers[i].pid, NULL, 0);
+        }
+    }
+    for (size_t i = 0; i < _exiting.size(); ++i) {
+        kill(_exiting[i].first, SIGKILL);
+        waitpid(_exiting[i].first, NULL, 0);
+    }
+}
+
+// locations sharing an interpreter and runner share their workers, the last one seen sets the limits
+CgiWorkerPool::Group &CgiWorkerPool::group(const CgiWorkerConfig &config) {
+    Group &group = _groups[groupKey(config)];
+    group.config = config;
+    return group;
+}
+
+void CgiWorkerPool::prepare(const CgiWorkerConfig &config) {
+    Group &warm = group(config);
+    while (warm.workers.size() < warm.config.min_workers && spawn(warm)) {
+    }
+}
+
+bool CgiWorkerPool::submit(const CgiWorkerConfig &config, int client_fd, FastCgiParams params, std::string stdin_data) {
+    Group &target = group(config);
+    _clients[client_fd] = groupKey(config);
+    target.queue.push_back(Pending{client_fd, std::move(params), std::move(stdin_data)});
+
+    // an idle or newly started worker takes it right away, otherwise it waits for the next one to finish
+    dispatchQueued(target);
+    if (target.workers.empty()) {
+        target.queue.pop_back();
+        _clients.erase(client_fd);
+        return false;
+    }
+    return true;
+}
+
+void CgiWorkerPool::finished(int client_fd) {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Group &owner = _groups[it->second];
+    _clients.erase(it);
+
+    for (size_t i = 0; i < owner.workers.size(); ++i) {
+        Worker &worker = owner.workers[i];
+        if (worker.client_fd != client_fd) {
+            continue;
+        }
+        worker.client_fd = -1;
+        worker.served++;
+        worker.idle_since = time(NULL);
+        // a worker whose socket broke is replaced, so is one that served enough requests or grew too large
+        if (!_fastcgi.hasConnection(worker.address) || needsRecycling(owner, worker)) {
+            retire(owner, i, false);
+        }
+        break;
+    }
+    dispatchQueued(owner);
+}
+
+void CgiWorkerPool::cancel(int client_fd) {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Group &owner = _groups[it->second];
+    _clients.erase(it);
+
+    for (auto pending = owner.queue.begin(); pending != owner.queue.end(); ++pending) {
+        if (pending->client_fd == client_fd) {
+            owner.queue.erase(pending);
+            return;
+        }
+    }
+    // a runner can't be interrupted in the middle of a script, the worker goes with it
+    for (size_t i = 0; i < owner.workers.size(); ++i) {
+        if (owner.workers[i].client_fd == client_fd) {
+            retire(owner, i, true);
+            break;
+        }
+    }
+    dispatchQueued(owner);
+}
+
+void CgiWorkerPool::maintain(time_t now) {
+    for (auto it = _groups.begin(); it != _groups.end(); ++it) {
+        Group &pool = it->second;
+        for (size_t i = pool.workers.size(); i-- > 0;) {
+            Worker &worker = pool.workers[i];
+            if (worker.client_fd != -1) {
+                continue;
+            }
+            // an idle runner that exited or crashed, or one more than the warm ones that wasn't needed for a while
+            bool gone = !_fastcgi.hasConnection(worker.address);
+            bool surplus = pool.workers.size() > pool.config.min_workers && now - worker.idle_since >= CGI_WORKER_IDLE_TIMEOUT;
+            if (gone || surplus) {
+                retire(pool, i, gone);
+            }
+        }
+        while (pool.workers.size() < pool.config.min_workers && spawn(pool)) {
+        }
+        dispatchQueued(pool);
+    }
+
+    // retired workers exit once they see their socket close, the ones that don't are killed
+    for (size_t i = _exiting.size(); i-- > 0;) {
+        pid_t result = waitpid(_exiting[i].first, NULL, WNOHANG);
+        if (result == _exiting[i].first || (result == -1 && errno == ECHILD)) {
+            _exiting.erase(_exiting.begin() + i);
+        } else if (now >= _exiting[i].second) {
+            kill(_exiting[i].first, SIGKILL);
+        }
+    }
+}
+
+// start an interpreter running the runner with its end of a socketpair as stdin
+bool CgiWorkerPool::spawn(Group &group) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
+        return false;
+    }
+
+    // stdout is the socket's business, stray prints of the runner go nowhere. stderr stays the server's log
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    SpawnOptions options;
+    options.path = group.config.interpreter;
+    options.argv = {group.config.interpreter, group.config.runner};
+    options.stdin_fd = sockets[1];
+    options.stdout_fd = devnull;
+    pid_t pid = spawnProcess(options);
+    if (devnull != -1) {
+        close(devnull);
+    }
+    if (pid == -1) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+
+    close(sockets[1]);
+    fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+    Worker worker;
+    worker.pid = pid;
+    worker.address = "worker:" + std::to_string(pid);
+    if (!_fastcgi.adopt(sockets[0], worker.address)) {
+        close(sockets[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return false;
+    }
+    group.workers.push_back(worker);
+    return true;
+}
+
+bool CgiWorkerPool::dispatch(Worker &worker, Pending &pending) {
+    if (!_fastcgi.submit(worker.address, pending.client_fd, pending.params, pending.stdin_data)) {
+        return false;
+    }
+    worker.client_fd = pending.client_fd;
+    return true;
+}
+
+// hand queued requests to idle workers, starting new ones up to max_workers
+void CgiWorkerPool::dispatchQueued(Group &group) {
+    while (!group.queue.empty()) {
+        size_t index = group.workers.size();
+        for (size_t i = 0; i < group.workers.size(); ++i) {
+            if (group.workers[i].client_fd == -1) {
+                index = i;
+                break;
+            }
+        }
+        if (index == group.workers.size() && (group.workers.size() >= group.config.max_workers || !spawn(group))) {
+            return;
+        }
+
+        // a worker whose socket is gone can't take it, it is replaced and the request stays first in line
+        if (!dispatch(group.workers[index], group.queue.front())) {
+            retire(group, index, true);
+            continue;
+        }
+        group.queue.pop_front();
+    }
+}
+
+// stop a worker: closing its socket ends the runner's read loop, kill_now doesn't wait for that
+void CgiWorkerPool::retire(Group &group, size_t index, bool kill_now) {
+    Worker &worker = group.workers[index];
+    _fastcgi.disconnect(worker.address);
+    if (kill_now) {
+        kill(worker.pid, SIGKILL);
+    }
+    _exiting.push_back(std::make_pair(worker.pid, time(NULL) + CGI_WORKER_EXIT_GRACE));
+    group.workers.erase(group.workers.begin() + index);
+}
+
+bool CgiWorkerPool::needsRecycling(const Group &group, const Worker &worker) const {
+    if (group.config.max_requests > 0 && worker.served >= group.config.max_requests) {
+        return true;
+    }
+    return group.config.max_memory > 0 && residentMemory(worker.pid) > group.config.max_memory;
+}
@@ -0,0 +1,94 @@
+#include "../include/Request.hpp"
+
+#include <sstream>
+#include <ctime>
+#include <cstdint>
+#include <unistd.h>
+
+// the ETag and Last-Modified header lines sent with every static file
+std::string Request::validatorHeaders(const std::string &etag, time_t lastModified) {
+    std::string headers = "ETag: " + etag + "\r\n";
+    headers += "Last-Modified: " + formatHttpDate(lastModified) + "\r\n";
+    return headers;
+}
+
+// strong ETag of the current version of a file
+std::string Request::buildETag(const FileCacheEntry &file, LocationConfig* location) {
+    std::ostringstream etag;
+    etag << std::hex << '"';
+
+    if (location->etag_content_hash && file.file && !file.file->content_hash.empty()) {
+        // the hash of the contents survives copies and deploys that change the inode or mtime,
+        // ServeFile has it computed on a disk thread before the response is built
+        etag << file.file->content_hash;
+    } else {
+        // inode, size and nanosecond mtime change whenever the file is replaced or written
+        etag << file.st.st_ino << '-' << file.st.st_size << '-'
+             << file.st.st_mtim.tv_sec << '.' << file.st.st_mtim.tv_nsec;
+    }
+
+    etag << '"';
+    return etag.str();
+}
+
+// FNV-1a over the whole file, the caller keeps it with the descriptor so it is computed once per open file
+std::string Request::hashFileContent(int fd) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    char buffer[65536];
+    off_t offset = 0;
+    ssize_t bytes;
+    while ((bytes = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        for (ssize_t i = 0; i < bytes; ++i) {
+            hash ^= static_cast<unsigned char>(buffer[i]);
+            hash *= 0x100000001b3ULL;
+        }
+        offset += bytes;
+    }
+
+    std::ostringstream hex;
+    hex << std::hex << hash << '-' << offset;
+    return hex.str();
+}
+
+// evaluate If-None-Match and If-Modified-Since (RFC 7232 section 6)
+bool Request::isNotModified(const std::string &etag, time_t lastModified) {
+    std::string ifNoneMatch = _request.getHeader("if-none-match");
+    if (!ifNoneMatch.empty()) {
+        // a list of entity tags, GET compares them weakly so a W/ prefix is ignored
+        std::istringstream tags(ifNoneMatch);
+        std::string tag;
+        while (std::getline(tags, tag, ',')) {
+            tag.erase(0, tag.find_first_not_of(" \t"));
+            tag.erase(tag.find_last_not_of(" \t") + 1);
+            if (tag.compare(0, 2, "W/") == 0) {
+                tag = tag.substr(2);
+            }
+            if (tag == "*" || tag == etag) {
+                return true;
+            }
+        }
+        // If-Modified-Since is ignored when If-None-Match is present
+        return false;
+    }
+
+    std::string ifModifiedSince = _request.getHeader("if-modified-since");
+    if (!ifModifiedSince.empty()) {
+        // only the IMF-fixdate format is accepted, anything else is ignored
+        std::tm since = {};
+        const char *end = strptime(ifModifiedSince.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &since);
+        if (end != nullptr && *end == '\0') {
+            return lastModified <= timegm(&since);
+        }
+    }
+
+    return false;
+}
+
+// 304 Not Modified: the validators but no body, the file contents are never touched
+void Request::sendNotModifiedResponse(const std::string &validators) {
+    _response = _http_version + " " + HTTP_304 + "\r\n";
+    _response += validators;
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+}
@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <limits.h>
 #include <iostream>
+#include <cerrno>
+#include <cstring>
 
 void Request::HandleDeleteRequest() {
     // retrieve the location configuration based on the requested URL
@@ -40,26 +42,34 @@ void Request::HandleDeleteRequest() {
     // build the full file path by appending the URL to the upload path
     std::string fileToDelete = uploadPath + _url;
 
-    // Check if the file exists
-    struct stat buffer;
-    if (stat(fileToDelete.c_str(), &buffer) != 0) {
-        // Serve a 404 Not Found page if the file does not exist
-        std::cerr << "Error: File not found: " << fileToDelete << std::endl;
-        ServeErrorPage(404);
-        return;
-    }
-
-    // attempt to delete the file
-    if (std::remove(fileToDelete.c_str()) == 0) {
-        // if file deletion succeeds, respond with a success message (200 OK)
-        std::string successMessage = "<html><body><h1>File deleted successfully!</h1></body></html>";
-        // set the response header for 200 OK
-        responseHeader(successMessage, HTTP_200);
-        // append the success message to the response
-        _response += successMessage;
-    } else {
-        // if file deletion fails, serve a 500 Internal Server Error page
-        std::cerr << "Error: Unable to delete file: " << fileToDelete << std::endl;
-    	ServeErrorPage(500);
-    }
+    // the file is stat'ed and removed on a disk thread: 0 if it is gone, otherwise the errno of the step that failed
+    auto missing = std::make_shared<int>(0);
+    auto failed = std::make_shared<int>(0);
+    offloadDisk([fileToDelete, missing, failed] {
+        // Check if the file exists
+        struct stat buffer;
+        if (stat(fileToDelete.c_str(), &buffer) != 0) {
+            *missing = errno;
+        } else if (std::remove(fileToDelete.c_str()) != 0) {
+            // attempt to delete the file
+            *failed = errno;
+        }
+    }, [this, fileToDelete, missing, failed] {
+        if (*missing) {
+            // Serve a 404 Not Found page if the file does not exist
+            std::cerr << "Error: File not found: " << fileToDelete << std::endl;
+            ServeErrorPage(404);
+        } else if (*failed) {
+            // if file deletion fails, serve a 500 Internal Server Error page
+            std::cerr << "Error: Unable to delete file: " << fileToDelete << ": " << strerror(*failed) << std::endl;
+            ServeErrorPage(500);
+        } else {
+            // if file deletion succeeds, respond with a success message (200 OK)
+            std::string successMessage = "<html><body><h1>File deleted successfully!</h1></body></html>";
+            // set the response header for 200 OK
+            responseHeader(successMessage, HTTP_200);
+            // the success message follows the headers
+            _body.addMemory(std::move(successMessage));
+        }
+    });
 }
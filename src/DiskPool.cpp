@@ -0,0 +1,64 @@
+#include "DiskPool.hpp"
+
+#include <cstdint>
+#include <unistd.h>
+
+DiskPool::DiskPool(size_t threads, size_t max_queued) : _max_queued(max_queued), _stopping(false) {
+    for (size_t i = 0; i < threads; ++i) {
+        _threads.emplace_back(&DiskPool::run, this);
+    }
+}
+
+DiskPool::~DiskPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _ready.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+}
+
+std::shared_ptr<DiskJob> DiskPool::submit(std::function<void()> work, int notify_fd) {
+    if (_threads.empty()) {
+        return nullptr;
+    }
+    auto job = std::make_shared<DiskJob>(std::move(work), notify_fd);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // a backlog this long means the disk is the bottleneck anyway, the event loop takes its share of it
+        if (_queue.size() >= _max_queued) {
+            return nullptr;
+        }
+        _queue.push_back(job);
+    }
+    _ready.notify_one();
+    return job;
+}
+
+void DiskPool::run() {
+    while (true) {
+        std::shared_ptr<DiskJob> job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.wait(lock, [this] { return _stopping || !_queue.empty(); });
+            if (_queue.empty()) {
+                return;
+            }
+            job = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        job->work();
+        // the captures go with the work, they may hold descriptors
+        job->work = nullptr;
+        job->done.store(true, std::memory_order_release);
+
+        if (job->notify_fd != -1) {
+            uint64_t one = 1;
+            ssize_t ignored = write(job->notify_fd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+}
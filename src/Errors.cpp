@@ -1,6 +1,5 @@
 #include "../include/Request.hpp"
 
-#include <fstream>
 #include <sstream>
 #include <ctime>
 #include <iomanip>
@@ -20,49 +19,67 @@ std::string getStatusMessage(int statuscode)
         return HTTP_404;
     case 405:
         return HTTP_405;
+    case 409:
+        return HTTP_409;
     case 413:
         return HTTP_413;
     case 415:
         return HTTP_415;
+    case 417:
+        return HTTP_417;
     case 500:
         return HTTP_500;
+    case 501:
+        return HTTP_501;
+    case 502:
+        return HTTP_502;
+    case 503:
+        return HTTP_503;
+    case 504:
+        return HTTP_504;
     default:
         return HTTP_200;
     }
 }
 
 void Request::ServeErrorPage(int error_code) {
+    // the error replaces anything that was already queued for the response
+    _body.clear();
+    _fastcgi.reset();
+
     // check if the error code has a custom error page in the server configuration
     auto it = _config.error_pages.find(error_code);
 
     // if a custom error page is found for the error code
     if (it != _config.error_pages.end()) {
-        // get the path of the custom error page
-        std::string error_page_path = it->second;
-        // open the custom error page file
-        std::ifstream ifstr(error_page_path, std::ios::binary);
-        
-        // if the custom error page exists, serve it
-        if (ifstr) {
-            // read the content of the file
-            std::string error_content((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
-            
+        // the page is kept open by the file cache like any static file, so only the first error of a
+        // worker opens it, on a disk thread
+        lookupFile(it->second, [this, error_code](const FileCacheEntry &page) {
+            // if the custom error page exists, serve it
+            if (!page.file) {
+                ServeFallbackErrorPage(error_code);
+                return;
+            }
+            size_t size = static_cast<size_t>(page.st.st_size);
+
             // build the HTTP response with the custom error page content
             _response = _http_version + " " + getStatusMessage(error_code) + "\r\n";
             _response += "Content-Type: text/html\r\n";
-            _response += "Content-Length: " + std::to_string(error_content.size()) + "\r\n";
+            _response += "Content-Length: " + std::to_string(size) + "\r\n";
             _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+            _response += connectionHeader();
             _response += "Server: " + _config.server_name + "\r\n\r\n";
-            
-            // append the error page content to the response
-            _response += error_content;
 
-            // the response is stored in _response and is ready to be sent
-            return;
-        }
+            // the error page is sent from the shared descriptor after the headers
+            _body.addFile(page.file, 0, size);
+        });
+        return;
     }
+    ServeFallbackErrorPage(error_code);
+}
 
-    // if no custom error page is found or the file doesn't exist, serve a default fallback page
+// if no custom error page is found or the file doesn't exist, serve a default fallback page
+void Request::ServeFallbackErrorPage(int error_code) {
     std::string fallback_content = R"(
         <!DOCTYPE html>
         <html lang="en">
@@ -82,6 +99,6 @@ void Request::ServeErrorPage(int error_code) {
 
     // add the fallback content to the HTTP response headers
     responseHeader(fallback_content, getStatusMessage(error_code));
-    // append the fallback content to the response
-    _response += fallback_content;
+    // the fallback content follows the headers
+    _body.addMemory(std::move(fallback_content));
 }
@@ -0,0 +1,119 @@
+#include "FastCgi.hpp"
+
+#include <algorithm>
+
+bool FastCgiParser::next(std::string &buffer, FastCgiRecord &record) {
+    // decoded records are dropped in one go once the buffer is drained, not one at a time
+    if (_offset == buffer.size()) {
+        buffer.clear();
+        _offset = 0;
+    }
+    if (buffer.size() - _offset < FCGI_HEADER_SIZE) {
+        return false;
+    }
+
+    const unsigned char *header = reinterpret_cast<const unsigned char *>(buffer.data() + _offset);
+    size_t content_length = (header[4] << 8) | header[5];
+    size_t padding_length = header[6];
+    size_t total = FCGI_HEADER_SIZE + content_length + padding_length;
+    if (buffer.size() - _offset < total) {
+        // keep only the partial record, so the buffer doesn't grow with everything decoded before it
+        buffer.erase(0, _offset);
+        _offset = 0;
+        return false;
+    }
+
+    record.type = header[1];
+    record.request_id = static_cast<uint16_t>((header[2] << 8) | header[3]);
+    record.content.assign(buffer, _offset + FCGI_HEADER_SIZE, content_length);
+    _offset += total;
+    return true;
+}
+
+void fastcgiAppendRecord(std::string &out, uint8_t type, uint16_t request_id, const char *data, size_t length) {
+    // records are padded to a multiple of 8 bytes, as the specification recommends
+    size_t padding = (8 - (length % 8)) % 8;
+    char header[FCGI_HEADER_SIZE] = {
+        1, // FCGI_VERSION_1
+        static_cast<char>(type),
+        static_cast<char>(request_id >> 8),
+        static_cast<char>(request_id & 0xff),
+        static_cast<char>(length >> 8),
+        static_cast<char>(length & 0xff),
+        static_cast<char>(padding),
+        0
+    };
+    out.append(header, FCGI_HEADER_SIZE);
+    out.append(data, length);
+    out.append(padding, '\0');
+}
+
+void fastcgiAppendBeginRequest(std::string &out, uint16_t request_id, bool keep_conn) {
+    char body[8] = {0, FCGI_RESPONDER, static_cast<char>(keep_conn ? FCGI_KEEP_CONN : 0), 0, 0, 0, 0, 0};
+    fastcgiAppendRecord(out, FCGI_BEGIN_REQUEST, request_id, body, sizeof(body));
+}
+
+void fastcgiAppendStream(std::string &out, uint8_t type, uint16_t request_id, const std::string &data) {
+    for (size_t offset = 0; offset < data.size(); offset += FCGI_MAX_CONTENT) {
+        size_t length = std::min(data.size() - offset, static_cast<size_t>(FCGI_MAX_CONTENT));
+        fastcgiAppendRecord(out, type, request_id, data.data() + offset, length);
+    }
+    fastcgiAppendRecord(out, type, request_id, "", 0);
+}
+
+// lengths below 128 take one byte, longer ones four with the high bit set
+static void appendLength(std::string &out, size_t length) {
+    if (length < 128) {
+        out += static_cast<char>(length);
+    } else {
+        out += static_cast<char>(((length >> 24) & 0x7f) | 0x80);
+        out += static_cast<char>((length >> 16) & 0xff);
+        out += static_cast<char>((length >> 8) & 0xff);
+        out += static_cast<char>(length & 0xff);
+    }
+}
+
+static bool readLength(const std::string &content, size_t &pos, size_t &length) {
+    if (pos >= content.size()) {
+        return false;
+    }
+    unsigned char first = content[pos];
+    if (first < 128) {
+        length = first;
+        pos += 1;
+        return true;
+    }
+    if (pos + 4 > content.size()) {
+        return false;
+    }
+    length = ((first & 0x7f) << 24) | (static_cast<unsigned char>(content[pos + 1]) << 16)
+           | (static_cast<unsigned char>(content[pos + 2]) << 8) | static_cast<unsigned char>(content[pos + 3]);
+    pos += 4;
+    return true;
+}
+
+std::string fastcgiEncodeParams(const FastCgiParams &params) {
+    std::string out;
+    for (size_t i = 0; i < params.size(); ++i) {
+        appendLength(out, params[i].first.size());
+        appendLength(out, params[i].second.size());
+        out += params[i].first;
+        out += params[i].second;
+    }
+    return out;
+}
+
+FastCgiParams fastcgiDecodeParams(const std::string &content) {
+    FastCgiParams params;
+    size_t pos = 0;
+    size_t name_length;
+    size_t value_length;
+    while (readLength(content, pos, name_length) && readLength(content, pos, value_length)) {
+        if (pos + name_length + value_length > content.size()) {
+            break;
+        }
+        params.push_back(std::make_pair(content.substr(pos, name_length), content.substr(pos + name_length, value_length)));
+        pos += name_length + value_length;
+    }
+    return params;
+}
@@ -0,0 +1,407 @@
+#include "FastCgiPool.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// resolve "unix:/path" or "host:port" (numeric hosts and localhost, no DNS lookups in the event loop)
+static bool parseAddress(const std::string &address, struct sockaddr_storage &storage, socklen_t &length) {
+    std::memset(&storage, 0, sizeof(storage));
+
+    if (address.compare(0, 5, "unix:") == 0) {
+        std::string path = address.substr(5);
+        struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un *>(&storage);
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        length = sizeof(struct sockaddr_un);
+        return true;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()
+        || address.find_first_not_of("0123456789", colon + 1) != std::string::npos || address.size() - colon > 6) {
+        return false;
+    }
+    std::string host = address.substr(0, colon);
+    int port = std::stoi(address.substr(colon + 1));
+    if (host == "localhost") {
+        host = "127.0.0.1";
+    }
+
+    struct sockaddr_in *in = reinterpret_cast<struct sockaddr_in *>(&storage);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1) {
+        return false;
+    }
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    length = sizeof(struct sockaddr_in);
+    return true;
+}
+
+bool FastCgiPool::isValidAddress(const std::string &address) {
+    struct sockaddr_storage storage;
+    socklen_t length;
+    return parseAddress(address, storage, length);
+}
+
+FastCgiPool::FastCgiPool() : _epoll_fd(-1) {}
+
+FastCgiPool::~FastCgiPool() {
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+        close(it->first);
+    }
+}
+
+bool FastCgiPool::submit(const std::string &address, int client_fd, const FastCgiParams &params, const std::string &stdin_data) {
+    Connection *conn = acquire(address);
+    if (!conn) {
+        return false;
+    }
+
+    // request ids only have to be unique on their connection
+    while (conn->next_id == 0 || conn->requests.count(conn->next_id)) {
+        conn->next_id++;
+    }
+    uint16_t id = conn->next_id++;
+    conn->requests[id] = client_fd;
+    _clients[client_fd] = std::make_pair(conn->fd, id);
+
+    // the whole request is queued at once: begin, the environment and the body, each stream closed by an empty record
+    fastcgiAppendBeginRequest(conn->write_buffer, id, true);
+    fastcgiAppendStream(conn->write_buffer, FCGI_PARAMS, id, fastcgiEncodeParams(params));
+    fastcgiAppendStream(conn->write_buffer, FCGI_STDIN, id, stdin_data);
+
+    // a warm connection gets the request right away, a broken one is reported by epoll
+    if (!conn->connecting) {
+        flush(*conn);
+    }
+    updateEvents(*conn);
+    return true;
+}
+
+// an idle connection first, then a multiplexing one with room, a new one last
+FastCgiPool::Connection *FastCgiPool::acquire(const std::string &address) {
+    Connection *shared = nullptr;
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+        Connection &conn = it->second;
+        if (conn.address != address) {
+            continue;
+        }
+        if (conn.requests.empty()) {
+            return &conn;
+        }
+        if (conn.multiplexed && conn.requests.size() < FASTCGI_MAX_MULTIPLEX) {
+            shared = &conn;
+        }
+    }
+    return shared ? shared : connectTo(address);
+}
+
+FastCgiPool::Connection *FastCgiPool::connectTo(const std::string &address) {
+    struct sockaddr_storage storage;
+    socklen_t length;
+    if (!parseAddress(address, storage, length)) {
+        return nullptr;
+    }
+
+    int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return nullptr;
+    }
+    if (storage.ss_family == AF_INET) {
+        // requests are small and latency matters more than packet count
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+
+    bool connecting = false;
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&storage), length) == -1) {
+        if (errno != EINPROGRESS) {
+            close(fd);
+            return nullptr;
+        }
+        connecting = true;
+    }
+
+    Connection &conn = _connections[fd];
+    conn.fd = fd;
+    conn.address = address;
+    conn.connecting = connecting;
+
+    // ask whether the backend takes several requests per connection, the answer arrives before any response
+    std::string query = fastcgiEncodeParams(FastCgiParams{std::make_pair("FCGI_MPXS_CONNS", "")});
+    fastcgiAppendRecord(conn.write_buffer, FCGI_GET_VALUES, 0, query.data(), query.size());
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        _connections.erase(fd);
+        close(fd);
+        return nullptr;
+    }
+    conn.events = event.events;
+    return &conn;
+}
+
+bool FastCgiPool::adopt(int fd, const std::string &address) {
+    Connection &conn = _connections[fd];
+    conn.fd = fd;
+    conn.address = address;
+    conn.connecting = false;
+    conn.adopted = true;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        _connections.erase(fd);
+        return false;
+    }
+    conn.events = event.events;
+    return true;
+}
+
+bool FastCgiPool::hasConnection(const std::string &address) const {
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+        if (it->second.address == address) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FastCgiPool::disconnect(const std::string &address) {
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+        Connection &conn = it->second;
+        if (conn.address != address) {
+            continue;
+        }
+        for (auto req = conn.requests.begin(); req != conn.requests.end(); ++req) {
+            if (req->second != -1) {
+                _clients.erase(req->second);
+            }
+        }
+        closeConnection(conn.fd);
+        return;
+    }
+}
+
+void FastCgiPool::abort(int client_fd) {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Connection &conn = _connections[it->second.first];
+    uint16_t id = it->second.second;
+    _clients.erase(it);
+
+    // the id stays taken until the backend confirms with FCGI_END_REQUEST, anything else for it is dropped
+    conn.requests[id] = -1;
+    conn.paused.erase(id);
+    fastcgiAppendRecord(conn.write_buffer, FCGI_ABORT_REQUEST, id, "", 0);
+    updateEvents(conn);
+}
+
+void FastCgiPool::pause(int client_fd) {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Connection &conn = _connections[it->second.first];
+    conn.paused.insert(it->second.second);
+    updateEvents(conn);
+}
+
+void FastCgiPool::resume(int client_fd) {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+    Connection &conn = _connections[it->second.first];
+    conn.paused.erase(it->second.second);
+    updateEvents(conn);
+}
+
+bool FastCgiPool::isPaused(int client_fd) const {
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return false;
+    }
+    const Connection &conn = _connections.at(it->second.first);
+    return conn.paused.count(it->second.second) > 0;
+}
+
+void FastCgiPool::handleEvent(int fd, uint32_t events, std::vector<Event> &out) {
+    auto it = _connections.find(fd);
+    if (it == _connections.end()) {
+        return;
+    }
+    Connection &conn = it->second;
+
+    if (conn.connecting) {
+        // the outcome of the non-blocking connect()
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+            fail(conn, out);
+            return;
+        }
+        conn.connecting = false;
+    }
+
+    if (!flush(conn) || ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !receive(conn, out))) {
+        fail(conn, out);
+        return;
+    }
+    updateEvents(conn);
+
+    // only a few idle connections per backend are worth keeping
+    if (conn.requests.empty() && !conn.adopted && idleConnections(conn.address) > FASTCGI_KEEPALIVE) {
+        closeConnection(fd);
+    }
+}
+
+// write queued records until the socket is full, a partial write only moves the cursor
+bool FastCgiPool::flush(Connection &conn) {
+    while (conn.write_offset < conn.write_buffer.size()) {
+        ssize_t bytes = send(conn.fd, conn.write_buffer.data() + conn.write_offset, conn.write_buffer.size() - conn.write_offset, 0);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.write_offset += bytes;
+    }
+    conn.write_buffer.clear();
+    conn.write_offset = 0;
+    return true;
+}
+
+// read what the backend sent and decode the complete records, false once the connection is gone
+bool FastCgiPool::receive(Connection &conn, std::vector<Event> &out) {
+    char buffer[65536];
+    bool open = true;
+    while (true) {
+        ssize_t bytes = read(conn.fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            conn.read_buffer.append(buffer, bytes);
+        } else if (bytes < 0 && errno == EINTR) {
+            continue;
+        } else {
+            open = bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+    }
+
+    // records that arrived before an EOF are still delivered
+    FastCgiRecord record;
+    while (conn.parser.next(conn.read_buffer, record)) {
+        handleRecord(conn, record, out);
+    }
+    return open;
+}
+
+void FastCgiPool::handleRecord(Connection &conn, FastCgiRecord &record, std::vector<Event> &out) {
+    // management records answer our FCGI_GET_VALUES
+    if (record.request_id == 0) {
+        if (record.type == FCGI_GET_VALUES_RESULT) {
+            FastCgiParams values = fastcgiDecodeParams(record.content);
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (values[i].first == "FCGI_MPXS_CONNS" && values[i].second == "1") {
+                    conn.multiplexed = true;
+                }
+            }
+        }
+        return;
+    }
+
+    auto it = conn.requests.find(record.request_id);
+    if (it == conn.requests.end()) {
+        return;
+    }
+    int client_fd = it->second;
+
+    if (record.type == FCGI_END_REQUEST) {
+        // protocol status 0 is a completed request, anything else is a refusal (overloaded, can't multiplex, ...)
+        bool complete = record.content.size() >= 8 && static_cast<unsigned char>(record.content[4]) == FCGI_REQUEST_COMPLETE;
+        finishRequest(conn, record.request_id);
+        if (client_fd != -1) {
+            out.push_back(Event{complete ? Event::END : Event::FAILED, client_fd, ""});
+        }
+        return;
+    }
+
+    // the empty record closing a stream carries nothing, output of aborted requests is dropped
+    if (client_fd == -1 || record.content.empty()) {
+        return;
+    }
+    if (record.type == FCGI_STDOUT) {
+        out.push_back(Event{Event::STDOUT, client_fd, std::move(record.content)});
+    } else if (record.type == FCGI_STDERR) {
+        out.push_back(Event{Event::STDERR, client_fd, std::move(record.content)});
+    }
+}
+
+void FastCgiPool::finishRequest(Connection &conn, uint16_t request_id) {
+    auto it = conn.requests.find(request_id);
+    if (it->second != -1) {
+        _clients.erase(it->second);
+    }
+    conn.paused.erase(request_id);
+    conn.requests.erase(it);
+}
+
+// read unless a client on this connection is behind, write while records are queued
+void FastCgiPool::updateEvents(Connection &conn) {
+    uint32_t events = conn.paused.empty() ? static_cast<uint32_t>(EPOLLIN) : 0;
+    if (conn.connecting || conn.write_offset < conn.write_buffer.size()) {
+        events |= EPOLLOUT;
+    }
+    if (events == conn.events) {
+        return;
+    }
+
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = conn.fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.events = events;
+}
+
+// the connection broke, every request still on it fails
+void FastCgiPool::fail(Connection &conn, std::vector<Event> &out) {
+    for (auto it = conn.requests.begin(); it != conn.requests.end(); ++it) {
+        if (it->second != -1) {
+            out.push_back(Event{Event::FAILED, it->second, ""});
+            _clients.erase(it->second);
+        }
+    }
+    closeConnection(conn.fd);
+}
+
+void FastCgiPool::closeConnection(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    _connections.erase(fd);
+}
+
+size_t FastCgiPool::idleConnections(const std::string &address) const {
+    size_t count = 0;
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+        if (it->second.address == address && it->second.requests.empty()) {
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,241 @@
+#include "FileCache.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// changes inside a watched directory that make cached entries stale
+#define FILE_CACHE_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE \
+                               | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+OpenFile::~OpenFile() {
+    close(fd);
+}
+
+// collapse repeated slashes and drop a trailing one so every path has a single key
+static std::string normalizePath(const std::string &path) {
+    std::string normalized;
+    normalized.reserve(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '/' && !normalized.empty() && normalized.back() == '/') {
+            continue;
+        }
+        normalized += path[i];
+    }
+    if (normalized.size() > 1 && normalized.back() == '/') {
+        normalized.pop_back();
+    }
+    return normalized;
+}
+
+// the directory an entry lives in, "." for plain relative names
+static std::string parentDirectory(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    if (slash == 0) {
+        return "/";
+    }
+    return path.substr(0, slash);
+}
+
+// the cache key of a name reported by inotify for a watched directory
+static std::string joinPath(const std::string &dir, const std::string &name) {
+    if (dir == ".") {
+        return name;
+    }
+    if (dir == "/") {
+        return "/" + name;
+    }
+    return dir + "/" + name;
+}
+
+FileCache::FileCache(size_t max_entries) : _max_entries(max_entries), _generation(0) {
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd == -1) {
+        // without invalidation the cache could serve stale files, so it stays empty
+        std::cerr << "Warning: inotify unavailable, file cache disabled: " << strerror(errno) << std::endl;
+    }
+}
+
+FileCache::~FileCache() {
+    clear();
+    if (_inotify_fd != -1) {
+        close(_inotify_fd);
+    }
+}
+
+bool FileCache::find(const std::string &path, FileCacheEntry &entry) {
+    // a hit costs no system call at all
+    auto it = _entries.find(normalizePath(path));
+    if (it == _entries.end()) {
+        return false;
+    }
+    // move the entry to the front of the LRU list
+    _lru.splice(_lru.begin(), _lru, it->second.lru_pos);
+    entry = it->second.entry;
+    return true;
+}
+
+// a miss goes to the disk once, the result is only kept if its directory can be watched
+void FileCache::store(const std::string &path, const FileCacheEntry &entry, uint64_t generation) {
+    // permission problems and the like are not remembered
+    if (!entry.exists && entry.error != ENOENT && entry.error != ENOTDIR) {
+        return;
+    }
+    // an event handled while the path was loaded may have been about it
+    if (generation != _generation) {
+        return;
+    }
+    std::string key = normalizePath(path);
+    if (watchParent(key)) {
+        insert(key, entry);
+    }
+}
+
+// stat the path and keep regular files open, error tells why a path does not exist
+FileCacheEntry FileCache::load(const std::string &path) {
+    FileCacheEntry entry;
+
+    // O_NONBLOCK so a FIFO under the root can't stall the event loop
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd == -1) {
+        entry.error = errno;
+        return entry;
+    }
+    if (fstat(fd, &entry.st) == -1) {
+        entry.error = errno;
+        close(fd);
+        return entry;
+    }
+    entry.exists = true;
+
+    // only regular files keep their descriptor, directories just need their stat
+    if (S_ISREG(entry.st.st_mode)) {
+        entry.file = std::make_shared<OpenFile>(fd);
+    } else {
+        close(fd);
+    }
+    return entry;
+}
+
+// make sure changes in the directory holding the path are reported
+bool FileCache::watchParent(const std::string &path) {
+    if (_inotify_fd == -1) {
+        return false;
+    }
+
+    std::string dir = parentDirectory(path);
+    if (_dir_watches.count(dir)) {
+        return true;
+    }
+
+    int wd = inotify_add_watch(_inotify_fd, dir.c_str(), FILE_CACHE_WATCH_MASK);
+    if (wd == -1) {
+        // the directory does not exist (or can't be watched), don't cache below it
+        return false;
+    }
+    _dir_watches[dir] = wd;
+    _watch_dirs[wd] = dir;
+    return true;
+}
+
+void FileCache::insert(const std::string &path, const FileCacheEntry &entry) {
+    // evict the least recently used entries to stay within the bound
+    while (!_lru.empty() && _entries.size() >= _max_entries) {
+        _entries.erase(_lru.back());
+        _lru.pop_back();
+    }
+
+    _lru.push_front(path);
+    Node node;
+    node.entry = entry;
+    node.lru_pos = _lru.begin();
+    _entries[path] = node;
+}
+
+void FileCache::invalidate(const std::string &path) {
+    auto it = _entries.find(path);
+    if (it == _entries.end()) {
+        return;
+    }
+    // an fd still used by a response stays open until that response is done
+    _lru.erase(it->second.lru_pos);
+    _entries.erase(it);
+}
+
+// drop everything below a directory that was removed, renamed or replaced
+void FileCache::invalidatePrefix(const std::string &dir) {
+    std::string prefix = dir == "." ? "" : dir + "/";
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            _lru.erase(it->second.lru_pos);
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileCache::clear() {
+    _entries.clear();
+    _lru.clear();
+}
+
+void FileCache::handleEvents() {
+    // inotify events are variable sized, the buffer must be aligned for them
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (true) {
+        ssize_t len = read(_inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            // EAGAIN: all pending events are handled
+            break;
+        }
+        _generation++;
+
+        for (char *ptr = buffer; ptr < buffer + len;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            // events were lost, nothing in the cache can be trusted anymore
+            if (event->mask & IN_Q_OVERFLOW) {
+                clear();
+                continue;
+            }
+
+            auto watch = _watch_dirs.find(event->wd);
+            if (watch == _watch_dirs.end()) {
+                continue;
+            }
+            std::string dir = watch->second;
+
+            // something inside the directory changed
+            if (event->len > 0) {
+                std::string changed = joinPath(dir, event->name);
+                invalidate(changed);
+                if (event->mask & IN_ISDIR) {
+                    invalidatePrefix(changed);
+                }
+            }
+
+            // the directory itself went away
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                invalidate(dir);
+                invalidatePrefix(dir);
+            }
+
+            // the kernel removed the watch, it is added again on the next lookup
+            if (event->mask & IN_IGNORED) {
+                invalidatePrefix(dir);
+                _dir_watches.erase(dir);
+                _watch_dirs.erase(watch);
+            }
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#include "FileUpload.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileSink::FileSink(const std::string &path, int fd, off_t offset) : _path(path), _fd(fd), _offset(offset), _status(0) {}
+
+FileSink::~FileSink() {
+    if (_fd != -1) {
+        close(_fd);
+    }
+}
+
+int FileSink::write(const char *data, size_t size) {
+    while (size > 0 && _status == 0) {
+        ssize_t bytes = pwrite(_fd, data, size, _offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            fail(500, "Error writing uploaded file");
+            break;
+        }
+        data += bytes;
+        size -= bytes;
+        _offset += bytes;
+    }
+    return _status;
+}
+
+// everything in the pipe goes into the file, the pipe is only read from here
+int FileSink::drain(int pipe, size_t size) {
+    while (size > 0 && _status == 0) {
+        ssize_t out = ::splice(pipe, NULL, _fd, &_offset, size, SPLICE_F_MOVE);
+        if (out < 0 && errno == EINTR) {
+            continue;
+        }
+        if (out <= 0) {
+            fail(500, "Error writing uploaded file");
+            break;
+        }
+        size -= out;
+    }
+    return _status;
+}
+
+void FileSink::fail(int status, const char *what) {
+    std::cerr << what << " " << _path << ": " << strerror(errno) << std::endl;
+    if (_status == 0) {
+        _status = status;
+    }
+}
+
+FileUpload::FileUpload(const std::string &path, size_t size) : FileSink(path, -1, 0), _size(size), _replaced(false) {}
+
+// the body never completed, the destination is left as it was
+FileUpload::~FileUpload() {
+    if (_fd != -1) {
+        close(_fd);
+        _fd = -1;
+        unlink(_tmp_path.c_str());
+    }
+}
+
+bool FileUpload::open(size_t size) {
+    if (!createDirectories(_path.substr(0, _path.rfind('/')))) {
+        fail(500, "Error creating the directory of");
+        return false;
+    }
+    _tmp_path = _path.substr(0, _path.rfind('/') + 1) + ".upload-XXXXXX";
+    _fd = mkostemp(&_tmp_path[0], O_CLOEXEC);
+    if (_fd == -1) {
+        fail(500, "Error opening file for writing");
+        return false;
+    }
+    // mkostemp() creates the file for the owner only, uploads are readable like ones written with ofstream
+    fchmod(_fd, 0644);
+
+    // a full disk fails the upload before the body is read, and the file is laid out in one piece.
+    // filesystems without fallocate() just grow the file as it is written
+    if (size > 0 && fallocate(_fd, 0, 0, size) == -1 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        fail(500, "Error reserving space for upload");
+        return false;
+    }
+    return true;
+}
+
+// the complete file replaces the destination in one step
+int FileUpload::finish() {
+    if (_status != 0) {
+        return _status;
+    }
+    // a body shorter than the space reserved for it leaves no zeroes at the end
+    if (ftruncate(_fd, _offset) == -1) {
+        fail(500, "Error truncating uploaded file");
+        return _status;
+    }
+    close(_fd);
+    _fd = -1;
+
+    struct stat st;
+    _replaced = stat(_path.c_str(), &st) == 0;
+    if (rename(_tmp_path.c_str(), _path.c_str()) == -1) {
+        std::cerr << "Error saving uploaded file " << _path << ": " << strerror(errno) << std::endl;
+        unlink(_tmp_path.c_str());
+        _status = 500;
+        return _status;
+    }
+    std::cout << "File uploaded successfully: " << _path << std::endl;
+    return 0;
+}
+
+bool createDirectories(const std::string &path) {
+    std::string current = path[0] == '/' ? "/" : "";
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        // skip empty directory names (in case of multiple slashes)
+        if (end > start) {
+            current += path.substr(start, end - start) + "/";
+            // 0755: read/write/execute for the owner, read/execute for others
+            if (mkdir(current.c_str(), 0755) == -1 && errno != EEXIST) {
+                std::cerr << "Failed to create directory: " << current << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// nothing of a failed upload is kept
+void FileUpload::fail(int status, const char *what) {
+    FileSink::fail(status, what);
+    if (_fd != -1) {
+        close(_fd);
+        _fd = -1;
+        unlink(_tmp_path.c_str());
+    }
+}
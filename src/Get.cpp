@@ -1,10 +1,10 @@
 #include "Request.hpp"
-#include "Header.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <iterator>
 #include <regex>
 
@@ -31,21 +31,23 @@ void Request::HandleGetRequest() {
 }
 
 void Request::ServeFileOrDirectory(const std::string &filePath, LocationConfig* location) {
-    struct stat pathStat;
-	// check if the file path exists and get its status
-    if (stat(filePath.c_str(), &pathStat) == -1) {
-		// serve 404 if the path doesn't exist
-        ServeErrorPage(404);
-        return;
-    }
+	// check if the file path exists and get its status, hot paths come from the cache without a syscall
+	// and the others from a disk thread
+    lookupFile(filePath, [this, filePath, location](const FileCacheEntry &entry) {
+        if (!entry.exists) {
+			// serve 404 if the path doesn't exist
+            ServeErrorPage(404);
+            return;
+        }
 
-	// if the path is a directory, handle the directory request
-    if (S_ISDIR(pathStat.st_mode)) {
-        HandleDirectoryRequest(filePath, location);
-    } else {
-		// otherwise, serve the file
-        ServeFile(filePath);
-    }
+		// if the path is a directory, handle the directory request
+        if (S_ISDIR(entry.st.st_mode)) {
+            HandleDirectoryRequest(filePath, location);
+        } else {
+			// otherwise, serve the file
+            ServeFile(filePath, entry, location);
+        }
+    });
 }
 
 void Request::HandleDirectoryRequest(const std::string &filePath, LocationConfig* location) {
@@ -60,44 +62,139 @@ void Request::HandleDirectoryRequest(const std::string &filePath, LocationConfig
 		// append the index file to the directory path
         fullPath += location->index;
 
-        struct stat fileStat;
-		// check if the index file exists and is a regular file
-        if (stat(fullPath.c_str(), &fileStat) == -1 || !S_ISREG(fileStat.st_mode)) {
-			// if the index file doesn't exist, check if autoindex is enabled
-            if (location->autoindex) {
-				// serve an generated directory listing
-                ServeAutoIndex(location->root, _url, _config.listen_host, _config.listen_port, location);
+        lookupFile(fullPath, [this, fullPath, location](const FileCacheEntry &index) {
+			// check if the index file exists and is a regular file
+            if (!index.exists || !S_ISREG(index.st.st_mode)) {
+				// if the index file doesn't exist, check if autoindex is enabled
+                if (location->autoindex) {
+					// serve an generated directory listing
+                    ServeAutoIndex(location->root, _url, location);
+                } else {
+					// serve 404 if autoindex is disabled and no index file is found
+                    ServeErrorPage(404);
+                }
             } else {
-				// serve 404 if autoindex is disabled and no index file is found
-                ServeErrorPage(404);
+				// serve the index file if it exists
+                ServeFile(fullPath, index, location);
             }
-        } else {
-			// serve the index file if it exists
-            ServeFile(fullPath);
-        }
+        });
     } else if (location->autoindex) {
 		// if autoindex is enabled but no index file is specified, serve the directory listing
-        ServeAutoIndex(location->root, _url, _config.listen_host, _config.listen_port, location);
+        ServeAutoIndex(location->root, _url, location);
     } else {
 		// serve 404 if neither index nor autoindex is available
         ServeErrorPage(404);
     }
 }
 
-void Request::ServeFile(const std::string &filePath) {
-	// open the file in binary mode
-    std::ifstream ifstr(filePath, std::ios::binary);
-    if (!ifstr) {
+// reads the whole (small) file from the shared descriptor, on a disk thread
+static bool readFile(int fd, std::string &content) {
+    size_t total = 0;
+    while (total < content.size()) {
+        ssize_t bytes = pread(fd, &content[total], content.size() - total, total);
+        if (bytes <= 0) {
+            return false;
+        }
+        total += bytes;
+    }
+    return true;
+}
+
+void Request::ServeFile(const std::string &filePath, const FileCacheEntry &file, LocationConfig* location) {
+	// the cache keeps regular files open, anything else can't be served
+    if (!file.file) {
 		// serve 404 if the file can't be opened
         ServeErrorPage(404);
         return;
     }
 
-	// read the file contents into a string
-    std::string content((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
+	// a content-based ETag reads the whole file once per open file, on a disk thread
+    if (location->etag_content_hash && file.file->content_hash.empty()) {
+        std::shared_ptr<OpenFile> open_file = file.file;
+        auto hash = std::make_shared<std::string>();
+        offloadDisk([open_file, hash] { *hash = hashFileContent(open_file->fd); }, [this, filePath, file, location, hash] {
+            file.file->content_hash = *hash;
+            ServeFile(filePath, file, location);
+        });
+        return;
+    }
+
+	// a client that already has this version of the file gets a 304 without the contents
+    std::string etag = buildETag(file, location);
+    std::string validators = validatorHeaders(etag, file.st.st_mtime);
+    if (isNotModified(etag, file.st.st_mtime)) {
+        sendNotModifiedResponse(validators);
+        return;
+    }
+
+	// a Range request is answered with 206 (or 416) straight from the file
+    if (!_request.getHeader("range").empty() && ServeRange(file, etag, validators)) {
+        return;
+    }
+
+	// tell clients they can resume or seek with Range requests
+    validators += "Accept-Ranges: bytes\r\n";
+
+	// small files of a location with a response cache are answered from memory
+    if (location->response_cache && static_cast<size_t>(file.st.st_size) <= location->cache_max_file_size) {
+		// the Content-Type depends on the URL, so it is part of the key
+        std::string cacheKey = contentTypeHeader() + filePath;
+        CachedResponse cached;
+        if (location->response_cache->get(cacheKey, file.st, cached)) {
+            ServeCachedResponse(cached);
+            return;
+        }
+
+		// a miss the cache would keep is read on a disk thread and offered to it, one it would turn
+		// away (not requested often enough yet) is sent with sendfile() like any other file
+        if (location->response_cache->admits(cacheKey, static_cast<size_t>(file.st.st_size))) {
+            std::shared_ptr<OpenFile> open_file = file.file;
+            auto content = std::make_shared<std::string>(static_cast<size_t>(file.st.st_size), '\0');
+            auto loaded = std::make_shared<bool>(false);
+            offloadDisk([open_file, content, loaded] { *loaded = readFile(open_file->fd, *content); }, [this, cacheKey, file, location, content, loaded, validators] {
+                if (!*loaded) {
+					// the file shrank or can't be read, it is sent from disk instead
+                    responseHeader(static_cast<size_t>(file.st.st_size), HTTP_200, validators);
+                    _body.addFile(file.file, 0, static_cast<size_t>(file.st.st_size));
+                    return;
+                }
+                CachedResponse cached;
+                LoadCachedResponse(cacheKey, file, location, std::move(*content), cached, validators);
+                ServeCachedResponse(cached);
+            });
+            return;
+        }
+    }
+
+	// add the response header with HTTP 200 OK status, the cached size becomes the Content-Length
+    responseHeader(static_cast<size_t>(file.st.st_size), HTTP_200, validators);
+	// the body is sent straight from the shared descriptor with sendfile() after the headers
+    _body.addFile(file.file, 0, static_cast<size_t>(file.st.st_size));
+}
+
+void Request::LoadCachedResponse(const std::string &cacheKey, const FileCacheEntry &file, LocationConfig* location, std::string content, CachedResponse &cached, const std::string &validators) {
+	// the headers that are the same for every request for this file
+    std::string headers = contentTypeHeader();
+    headers += "Content-Length: " + std::to_string(content.size()) + "\r\n";
+    headers += validators;
+
+    cached.headers = std::make_shared<const std::string>(std::move(headers));
+    cached.body = std::make_shared<const std::string>(std::move(content));
+    cached.ino = file.st.st_ino;
+    cached.size = file.st.st_size;
+    cached.mtime = file.st.st_mtim;
+
+	// the admission policy decides whether the response is kept
+    location->response_cache->put(cacheKey, cached);
+}
 
-	// add the response header with HTTP 200 OK status
-    responseHeader(content, HTTP_200);
-	// append the file content to the response
-    _response += content;
+void Request::ServeCachedResponse(const CachedResponse &cached) {
+	// only the status line, Date, Connection and Server are built per request
+    _response = _http_version + " " + HTTP_200 + "\r\n";
+    _response += *cached.headers;
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    // the cached body is shared with the cache, not copied
+    _body.addMemory(cached.body);
 }
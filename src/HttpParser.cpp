@@ -0,0 +1,360 @@
+#include "HttpParser.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+
+std::string HttpRequest::getHeader(const std::string &name) const {
+    auto it = headers.find(name);
+    if (it == headers.end()) {
+        return "";
+    }
+    return it->second;
+}
+
+HttpParser::HttpParser() : _body_buffer_size(SIZE_MAX) {
+    reset();
+}
+
+void HttpParser::reset() {
+    _state = REQUEST_LINE;
+    _line_start = 0;
+    _scan_pos = 0;
+    _body_start = 0;
+    _spooling = false;
+    _chunked = false;
+    _chunk_state = CHUNK_SIZE;
+    _chunk_left = 0;
+    _trailer_size = 0;
+    _body_size = 0;
+    _max_body_size = SIZE_MAX;
+    _request = HttpRequest();
+}
+
+HttpRequest HttpParser::takeRequest() {
+    return std::move(_request);
+}
+
+// a rejected request drops whatever was parsed so far, status is what it is answered with
+HttpParser::State HttpParser::fail(int status) {
+    _request = HttpRequest();
+    _request.error_status = status;
+    _state = ERROR;
+    return _state;
+}
+
+HttpParser::State HttpParser::parse(std::string &buffer) {
+    // read the request line and headers one line at a time
+    while (_state == REQUEST_LINE || _state == HEADERS) {
+        // resume the search for the line end where the previous call stopped
+        size_t eol = buffer.find("\r\n", _scan_pos);
+        if (eol == std::string::npos) {
+            // refuse header sections that never end
+            if (buffer.size() > MAX_HEADER_SIZE) {
+                return fail();
+            }
+            // the last byte may be the '\r' of a CRLF split across two reads
+            _scan_pos = std::max(_line_start, buffer.size() > 0 ? buffer.size() - 1 : 0);
+            return _state;
+        }
+
+        std::string line = buffer.substr(_line_start, eol - _line_start);
+        _line_start = eol + 2;
+        _scan_pos = _line_start;
+        if (_line_start > MAX_HEADER_SIZE) {
+            return fail();
+        }
+
+        if (_state == REQUEST_LINE) {
+            // empty lines before the request line are ignored (RFC 7230 section 3.5)
+            if (line.empty()) {
+                continue;
+            }
+            if (!parseRequestLine(line)) {
+                return fail();
+            }
+            _state = HEADERS;
+        } else if (line.empty()) {
+            // the empty line ends the header section, the body starts right after it
+            _body_start = _line_start;
+            int status = finishHeaders();
+            if (status != 0) {
+                return fail(status);
+            }
+            // a body's handler may want to take it as it arrives, the caller decides before any of it is read
+            if (_chunked || _request.content_length > 0) {
+                _state = HEADERS_DONE;
+                return _state;
+            }
+            _state = BODY;
+        } else if (!parseHeaderLine(line)) {
+            return fail();
+        }
+    }
+
+    if (_state == BODY && _chunked) {
+        return decodeChunked(buffer);
+    }
+    if (_state == BODY && (_request.body_sink || _spooling || _request.content_length > _body_buffer_size)) {
+        return drainBody(buffer);
+    }
+    // the body is only counted, it is copied out once all of it has arrived
+    if (_state == BODY && buffer.size() - _body_start >= _request.content_length) {
+        _request.body = buffer.substr(_body_start, _request.content_length);
+        _state = COMPLETE;
+    }
+
+    return _state;
+}
+
+void HttpParser::startBody(std::unique_ptr<BodySink> sink, size_t max_size) {
+    _request.body_sink = std::move(sink);
+    _max_body_size = max_size;
+    _state = BODY;
+}
+
+void HttpParser::rejectBody(int status) {
+    _request.error_status = status;
+    _state = ERROR;
+}
+
+bool HttpParser::canSplice(const std::string &buffer) const {
+    return _state == BODY && !_chunked && _request.body_sink && _request.body_sink->canSplice() && buffer.size() == _body_start;
+}
+
+ssize_t HttpParser::spliceBody(int fd) {
+    ssize_t bytes = _request.body_sink->splice(fd, _request.content_length - _body_size);
+    if (bytes > 0) {
+        _body_size += bytes;
+        if (_body_size == _request.content_length) {
+            finishBody();
+        }
+    } else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        int error = errno;
+        fail(500);
+        errno = error;
+    }
+    return bytes;
+}
+
+// a large body or one with a sink is written out as it arrives, so the buffer only ever holds what came in since the last read
+HttpParser::State HttpParser::drainBody(std::string &buffer) {
+    if (!_request.body_sink && !_spooling && !startSpool()) {
+        // without a temporary file the body is buffered in memory like a small one
+        return parse(buffer);
+    }
+
+    size_t bytes = std::min(buffer.size() - _body_start, _request.content_length - _body_size);
+    int status = storeBody(buffer.data() + _body_start, bytes);
+    if (status != 0) {
+        return fail(status);
+    }
+    // a pipelined request behind the body moves up to where the body started
+    buffer.erase(_body_start, bytes);
+
+    if (_body_size == _request.content_length) {
+        return finishBody();
+    }
+    return _state;
+}
+
+// the body from here on goes to a temporary file, along with what was kept in memory so far
+bool HttpParser::startSpool() {
+    _request.spooled_body = std::make_unique<SpooledBody>();
+    if (!_request.spooled_body->open() || !_request.spooled_body->append(_request.body.data(), _request.body.size())) {
+        std::cerr << "Failed to create a temporary file for a request body, buffering it in memory" << std::endl;
+        _request.spooled_body.reset();
+        _body_buffer_size = SIZE_MAX;
+        return false;
+    }
+    _request.body.clear();
+    _request.body.shrink_to_fit();
+    _spooling = true;
+    return true;
+}
+
+// decoded body bytes go to the sink if there is one, otherwise to memory until there are more than the
+// body buffer size, then to the spool file. 0 or the status the request is rejected with
+int HttpParser::storeBody(const char *data, size_t size) {
+    _body_size += size;
+    if (_request.body_sink) {
+        return _request.body_sink->write(data, size);
+    }
+    if (!_spooling && _request.body.size() + size > _body_buffer_size) {
+        startSpool();
+    }
+    if (!_spooling) {
+        _request.body.append(data, size);
+        return 0;
+    }
+    if (!_request.spooled_body->append(data, size)) {
+        std::cerr << "Failed to spool a request body to disk" << std::endl;
+        return 500;
+    }
+    return 0;
+}
+
+// Transfer-Encoding: chunked (RFC 9112 section 7.1), decoded as it arrives. each call takes what the
+// buffer holds, whole lines and any part of a chunk's data, and erases it, so a chunk or a size line may
+// be split across reads. the decoded data never stays in the buffer and the body is never reassembled
+HttpParser::State HttpParser::decodeChunked(std::string &buffer) {
+    size_t pos = _body_start;
+    while (_state == BODY) {
+        if (_chunk_state == CHUNK_DATA) {
+            size_t bytes = std::min(buffer.size() - pos, _chunk_left);
+            if (bytes == 0) {
+                break;
+            }
+            int status = storeBody(buffer.data() + pos, bytes);
+            if (status != 0) {
+                return fail(status);
+            }
+            pos += bytes;
+            _chunk_left -= bytes;
+            if (_chunk_left == 0) {
+                _chunk_state = CHUNK_DATA_END;
+            }
+            continue;
+        }
+
+        // everything else is a line: a chunk size, the CRLF after a chunk's data or a trailer field
+        size_t eol = buffer.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            if (buffer.size() - pos > MAX_CHUNK_LINE) {
+                return fail();
+            }
+            break;
+        }
+        std::string line = buffer.substr(pos, eol - pos);
+        pos = eol + 2;
+
+        if (_chunk_state == CHUNK_DATA_END) {
+            if (!line.empty()) {
+                return fail();
+            }
+            _chunk_state = CHUNK_SIZE;
+        } else if (_chunk_state == CHUNK_SIZE) {
+            // chunk extensions after the size are allowed and ignored
+            size_t digits = line.find_first_not_of("0123456789abcdefABCDEF");
+            if (digits == std::string::npos) {
+                digits = line.size();
+            }
+            if (digits == 0 || digits > 15 || (digits < line.size() && line[digits] != ';' && line[digits] != ' ' && line[digits] != '\t')) {
+                return fail();
+            }
+            size_t size = std::stoull(line.substr(0, digits), NULL, 16);
+            if (size > _max_body_size || _body_size + size > _max_body_size) {
+                return fail(413);
+            }
+            _chunk_left = size;
+            _chunk_state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+        } else if (line.empty()) {
+            // the empty line after the trailer fields ends the body
+            finishChunked();
+        } else {
+            // trailer fields are read and dropped, they are bounded like the header section
+            _trailer_size += line.size() + 2;
+            if (_trailer_size > MAX_HEADER_SIZE) {
+                return fail();
+            }
+        }
+    }
+
+    // a pipelined request behind the body moves up to where the body started
+    buffer.erase(_body_start, pos - _body_start);
+    return _state;
+}
+
+// a sink gets to reject a body that turned out to be incomplete or malformed
+HttpParser::State HttpParser::finishBody() {
+    if (_request.body_sink) {
+        int status = _request.body_sink->finish();
+        if (status != 0) {
+            return fail(status);
+        }
+    }
+    _state = COMPLETE;
+    return _state;
+}
+
+// from here on the request looks like one that was sent with a Content-Length
+HttpParser::State HttpParser::finishChunked() {
+    _request.content_length = _body_size;
+    _request.headers.erase("transfer-encoding");
+    _request.headers["content-length"] = std::to_string(_request.content_length);
+    return finishBody();
+}
+
+// split "METHOD target HTTP/x.y"
+bool HttpParser::parseRequestLine(const std::string &line) {
+    size_t method_end = line.find(' ');
+    if (method_end == std::string::npos || method_end == 0) {
+        return false;
+    }
+    size_t target_end = line.find(' ', method_end + 1);
+    if (target_end == std::string::npos || target_end == method_end + 1) {
+        return false;
+    }
+
+    _request.method = line.substr(0, method_end);
+    _request.target = line.substr(method_end + 1, target_end - method_end - 1);
+    _request.version = line.substr(target_end + 1);
+    return true;
+}
+
+// split "Name: value", names are stored lowercased since they are case-insensitive
+bool HttpParser::parseHeaderLine(const std::string &line) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0) {
+        return false;
+    }
+
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    // trim optional whitespace around the value
+    std::string value = line.substr(colon + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+
+    // repeated headers are combined into a comma separated list
+    auto it = _request.headers.find(name);
+    if (it != _request.headers.end()) {
+        it->second += ", " + value;
+    } else {
+        _request.headers[name] = value;
+    }
+    return true;
+}
+
+// validate the headers that decide how the body is read, 0 or the status the request is rejected with
+int HttpParser::finishHeaders() {
+    std::string encoding = _request.getHeader("transfer-encoding");
+    std::string length = _request.getHeader("content-length");
+    if (!encoding.empty()) {
+        // both at once is how requests are smuggled past proxies that pick the other one (RFC 9112 section 6.3)
+        if (!length.empty()) {
+            return 400;
+        }
+        std::transform(encoding.begin(), encoding.end(), encoding.begin(), ::tolower);
+        // chunked is the only coding understood, a body compressed on top of it can't be decoded
+        if (encoding != "chunked") {
+            return 501;
+        }
+        _chunked = true;
+        return 0;
+    }
+    if (length.empty()) {
+        _request.content_length = 0;
+        return 0;
+    }
+
+    // Content-Length must be a plain decimal number
+    if (length.find_first_not_of("0123456789") != std::string::npos || length.size() > 18) {
+        return 400;
+    }
+    _request.content_length = std::stoull(length);
+    return 0;
+}
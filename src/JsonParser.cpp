@@ -1,4 +1,11 @@
 #include "JsonParser.hpp"
+#include "ResponseCache.hpp"
+#include "CgiCache.hpp"
+#include "CgiLimiter.hpp"
+#include "UploadSessions.hpp"
+#include "FastCgiPool.hpp"
+
+#include <algorithm>
 
 void JsonParser::skipWhitespace() {
     // skips whitespace characters in the input string
@@ -60,6 +67,11 @@ int JsonParser::getNextInt() {
         throw std::runtime_error(std::string("Error: Expected a number but found '") + input_[pos_] + "' at position " + std::to_string(pos_));
     }
 
+    // a sign belongs to the number, callers decide whether a negative one makes sense
+    if (input_[pos_] == '-') {
+        pos_++;
+    }
+
     // move the position forward while characters are digits
     while (pos_ < input_.length() && std::isdigit(input_[pos_])) {
         pos_++;
@@ -76,6 +88,16 @@ int JsonParser::getNextInt() {
     }
 }
 
+// every number in the config is a count, a size, a port, a status code or seconds, none of them can be negative.
+// for the size_t ones a negative value would wrap around to a huge count, for timeouts it would expire everything at once
+int JsonParser::getNextNonNegative(const std::string &key) {
+    int value = getNextInt();
+    if (value < 0) {
+        throw std::runtime_error("Error: '" + key + "' must not be negative");
+    }
+    return value;
+}
+
 bool JsonParser::getNextBool() {
     // skip leading whitespace
     skipWhitespace();
@@ -94,6 +116,34 @@ bool JsonParser::getNextBool() {
     }
 }
 
+size_t JsonParser::getNextSize() {
+    return parseSize(getNextString());
+}
+
+size_t JsonParser::parseSize(const std::string &size_str) {
+    // sizes are written like client_max_body_size: "512", "64K", "10M" or "1G"
+    size_t digits = 0;
+    while (digits < size_str.length() && std::isdigit(size_str[digits])) {
+        digits++;
+    }
+    std::string unit = size_str.substr(digits);
+    if (digits == 0 || digits > 12 || unit.length() > 1) {
+        throw std::runtime_error("Error: Invalid size '" + size_str + "'");
+    }
+
+    size_t size = std::stoull(size_str.substr(0, digits));
+    if (unit == "K") {
+        size *= 1024;
+    } else if (unit == "M") {
+        size *= 1024 * 1024;
+    } else if (unit == "G") {
+        size *= 1024 * 1024 * 1024;
+    } else if (!unit.empty()) {
+        throw std::runtime_error("Error: Invalid size unit in '" + size_str + "'");
+    }
+    return size;
+}
+
 std::vector<std::string> JsonParser::getNextStringArray() {
     // skip leading whitespace
     skipWhitespace();
@@ -210,15 +260,65 @@ LocationConfig JsonParser::parseLocationConfig() {
         } else if (key == "redirection") {
             loc.redirection = getNextString();
         } else if (key == "return_code") {
-            loc.return_code = getNextInt();
+            loc.return_code = getNextNonNegative(key);
         } else if (key == "cgi_extension") {
             loc.cgi_extension = getNextStringArray();
         } else if (key == "cgi_path") {
             loc.cgi_path = getNextStringArray();
+        } else if (key == "fastcgi_pass") {
+            loc.fastcgi_pass = getNextString();
+            if (!FastCgiPool::isValidAddress(loc.fastcgi_pass)) {
+                throw std::runtime_error("Error: Invalid fastcgi_pass address " + loc.fastcgi_pass);
+            }
+        } else if (key == "cgi_worker_runner") {
+            loc.cgi_worker_runner = getNextStringArray();
+        } else if (key == "cgi_workers") {
+            loc.cgi_workers = getNextNonNegative(key);
+        } else if (key == "cgi_workers_max") {
+            loc.cgi_workers_max = getNextNonNegative(key);
+        } else if (key == "cgi_worker_requests") {
+            loc.cgi_worker_requests = getNextNonNegative(key);
+        } else if (key == "cgi_worker_memory") {
+            loc.cgi_worker_memory = getNextSize();
+        } else if (key == "cgi_timeout") {
+            loc.cgi_timeout = getNextNonNegative(key);
+        } else if (key == "cgi_cache_ttl") {
+            loc.cgi_cache_ttl = getNextNonNegative(key);
+        } else if (key == "cgi_cache_key_headers") {
+            loc.cgi_cache_key_headers = getNextStringArray();
+            // request headers are looked up by their lowercase name
+            for (size_t i = 0; i < loc.cgi_cache_key_headers.size(); ++i) {
+                std::string &name = loc.cgi_cache_key_headers[i];
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            }
+        } else if (key == "cgi_cache_max_size") {
+            loc.cgi_cache_max_size = getNextSize();
+        } else if (key == "cgi_max_concurrency") {
+            loc.cgi_max_concurrency = getNextNonNegative(key);
+        } else if (key == "cgi_queue_size") {
+            loc.cgi_queue_size = getNextNonNegative(key);
+        } else if (key == "cgi_queue_timeout") {
+            loc.cgi_queue_timeout = getNextNonNegative(key);
+        } else if (key == "cgi_status") {
+            loc.cgi_status = getNextBool();
         } else if (key == "upload_path") {
             loc.upload_path = getNextString();
+        } else if (key == "client_max_body_size") {
+            loc.max_body_size = getNextSize();
+        } else if (key == "resumable_uploads") {
+            loc.resumable_uploads = getNextBool();
+        } else if (key == "resumable_max_size") {
+            loc.resumable_max_size = getNextSize();
+        } else if (key == "resumable_timeout") {
+            loc.resumable_timeout = getNextNonNegative(key);
         } else if (key == "index") {
             loc.index = getNextString();
+        } else if (key == "etag_content_hash") {
+            loc.etag_content_hash = getNextBool();
+        } else if (key == "cache_max_size") {
+            loc.cache_max_size = getNextSize();
+        } else if (key == "cache_max_file_size") {
+            loc.cache_max_file_size = getNextSize();
         } else {
             throw std::runtime_error("Error: Unknown key in location config");
         }
@@ -237,6 +337,33 @@ LocationConfig JsonParser::parseLocationConfig() {
         }
     }
 
+    if (loc.cgi_workers > loc.cgi_workers_max) {
+        throw std::runtime_error("Error: cgi_workers must not be more than cgi_workers_max");
+    }
+    if (!loc.cgi_worker_runner.empty() && (loc.cgi_workers_max == 0 || loc.cgi_workers_max > 256)) {
+        throw std::runtime_error("Error: cgi_workers_max must be between 1 and 256");
+    }
+
+    // the response cache is created once here, all workers share it through the config copies
+    if (loc.cache_max_size > 0) {
+        loc.response_cache = std::make_shared<ResponseCache>(loc.cache_max_size, loc.cache_max_file_size);
+    }
+    // so is the CGI cache, a script's response is run once for all workers
+    if (loc.cgi_cache_ttl > 0) {
+        loc.cgi_cache = std::make_shared<CgiCache>(loc.cgi_cache_max_size);
+    }
+    // and the CGI limiter, the cap holds for the location as a whole
+    if (loc.cgi_max_concurrency > 0) {
+        loc.cgi_limiter = std::make_shared<CgiLimiter>(loc.cgi_max_concurrency, loc.cgi_queue_size);
+    }
+    // and the resumable uploads, any worker may receive a part of any of them
+    if (loc.resumable_uploads) {
+        if (loc.upload_path.empty()) {
+            throw std::runtime_error("Error: resumable_uploads needs an upload_path");
+        }
+        loc.upload_sessions = std::make_shared<UploadSessions>(loc.resumable_timeout);
+    }
+
     return loc;
 }
 
@@ -265,7 +392,7 @@ ServerConfig JsonParser::parseServerConfig() {
             server.listen_host = getNextString();
             has_listen_host = true;  // Mark listen_host as provided
         } else if (key == "listen_port") {
-            server.listen_port = getNextInt();
+            server.listen_port = getNextNonNegative(key);
             has_listen_port = true;  // Mark listen_port as provided
         } else if (key == "server_name") {
             server.server_name = getNextString();
@@ -273,7 +400,15 @@ ServerConfig JsonParser::parseServerConfig() {
             server.error_pages = parseErrorPages();
         } else if (key == "client_max_body_size") {
             server.client_max_body_size = getNextString();
+            // checked here, the parser enforces it while the body is still arriving
+            server.max_body_size = parseSize(server.client_max_body_size);
             has_client_max_body_size = true;  // Mark client_max_body_size as provided
+        } else if (key == "client_body_buffer_size") {
+            server.client_body_buffer_size = getNextSize();
+        } else if (key == "keepalive_timeout") {
+            server.keepalive_timeout = getNextNonNegative(key);
+        } else if (key == "keepalive_requests") {
+            server.keepalive_requests = getNextNonNegative(key);
         } else if (key == "locations") {
             // start of locations array
             expect('[');
@@ -320,6 +455,13 @@ ServerConfig JsonParser::parseServerConfig() {
         throw std::runtime_error("Error: 'client_max_body_size' is required but missing in server configuration.");
     }
 
+    // locations without a limit of their own take the server's, so every limit is known before a request arrives
+    for (auto &loc : server.locations) {
+        if (loc.max_body_size == SIZE_MAX) {
+            loc.max_body_size = server.max_body_size;
+        }
+    }
+
     return server;
 }
 
@@ -357,6 +499,12 @@ std::vector<ServerConfig> JsonParser::parse() {
             }
             // end of servers array
             expect(']');
+        } else if (key == "workers") {
+            global_.workers = getNextNonNegative(key);
+        } else if (key == "worker_cpu_affinity") {
+            global_.worker_cpu_affinity = getNextBool();
+        } else if (key == "disk_threads") {
+            global_.disk_threads = getNextNonNegative(key);
         } else {
             throw std::runtime_error("Error: Unknown key at the root level");
         }
@@ -5,6 +5,10 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <csignal>
+#include <sys/resource.h>
+#include <vector>
 
 int main(int argc, char **argv) {
     if (argc != 2) {
@@ -12,6 +16,16 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // a client closing a kept-alive connection mid-write must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // every worker's file cache keeps descriptors open, so allow as many as the hard limit permits
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
     // open the configuration file
     std::ifstream config_file(argv[1]);
     if (!config_file.is_open()) {
@@ -37,8 +51,30 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // initialize and start the server with the parsed configurations
-    Server server(servers);
+    // one event loop per worker thread, defaulting to one per CPU
+    const GlobalConfig &global = parser.getGlobalConfig();
+    int cpu_count = static_cast<int>(std::thread::hardware_concurrency());
+    if (cpu_count <= 0) {
+        cpu_count = 1;
+    }
+    int worker_count = global.workers > 0 ? global.workers : cpu_count;
+
+    // the disk threads are shared, a worker's slow file only occupies one of them
+    DiskPool disk_pool(global.disk_threads);
+
+    // start every worker; each one owns its own epoll instance, clients and listening sockets
+    std::vector<std::thread> workers;
+    for (int i = 0; i < worker_count; ++i) {
+        int cpu = global.worker_cpu_affinity ? i % cpu_count : -1;
+        workers.emplace_back([&servers, i, cpu, &disk_pool]() {
+            Server server(servers, i, cpu, &disk_pool);
+        });
+    }
+
+    // the workers run until the process is terminated
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
 
     return 0;
 }
@@ -0,0 +1,272 @@
+#include "MultipartUpload.hpp"
+#include "FileUpload.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the body starts with a boundary that has no CRLF in front of it, an assumed one lets it match like the others
+MultipartUpload::MultipartUpload(const std::string &boundary, const std::string &dir) : _delimiter("\r\n--" + boundary), _dir(dir), _state(PREAMBLE), _lookbehind("\r\n"), _status(0), _fd(-1) {
+    size_t last = _delimiter.size() - 1;
+    for (size_t i = 0; i < 256; ++i) {
+        _skip[i] = _delimiter.size();
+    }
+    for (size_t i = 0; i < last; ++i) {
+        _skip[static_cast<unsigned char>(_delimiter[i])] = last - i;
+    }
+}
+
+// a part that never got its closing boundary leaves nothing behind
+MultipartUpload::~MultipartUpload() {
+    if (_fd != -1) {
+        close(_fd);
+        unlink(_tmp_path.c_str());
+    }
+}
+
+void MultipartUpload::open() {
+    if (!createDirectories(_dir)) {
+        fail(500);
+    }
+}
+
+int MultipartUpload::write(const char *data, size_t size) {
+    while (size > 0 && _status == 0) {
+        size_t used = size;
+        if (_state == PREAMBLE || _state == PART_DATA) {
+            used = scanData(data, size);
+        } else if (_state == DELIMITER_END) {
+            used = readDelimiterEnd(data, size);
+        } else if (_state == PART_HEADERS) {
+            used = readHeaders(data, size);
+        }
+        data += used;
+        size -= used;
+    }
+    return _status;
+}
+
+// a body that ends before its last boundary is malformed, whatever part was being written is dropped
+int MultipartUpload::finish() {
+    if (_status == 0 && _state != EPILOGUE) {
+        fail(400);
+    }
+    return _status;
+}
+
+// Horspool: compare the last byte of the window first and shift by how far that byte is from the end of the delimiter
+size_t MultipartUpload::search(const char *text, size_t size) const {
+    size_t last = _delimiter.size() - 1;
+    size_t pos = 0;
+    while (pos + last < size) {
+        unsigned char c = text[pos + last];
+        if (c == static_cast<unsigned char>(_delimiter[last]) && std::memcmp(text + pos, _delimiter.data(), last) == 0) {
+            return pos;
+        }
+        pos += _skip[c];
+    }
+    return std::string::npos;
+}
+
+// pass on everything up to the next delimiter, or all but the last delimiter length - 1 bytes if there is none yet
+size_t MultipartUpload::scanData(const char *data, size_t size) {
+    size_t keep = _delimiter.size() - 1;
+    size_t held = _lookbehind.size();
+    size_t match;
+
+    if (held > 0) {
+        // a delimiter starting in the held back bytes ends within the next keep bytes
+        std::string joined = _lookbehind + std::string(data, std::min(size, keep));
+        match = search(joined.data(), joined.size());
+        if (match != std::string::npos) {
+            emit(joined.data(), match);
+            _lookbehind.clear();
+            endPart();
+            return match + _delimiter.size() - held;
+        }
+        if (size < keep) {
+            // still too short to rule out a delimiter at the end
+            size_t decided = joined.size() > keep ? joined.size() - keep : 0;
+            emit(joined.data(), decided);
+            _lookbehind = joined.substr(decided);
+            return size;
+        }
+        // none of the held back bytes starts one
+        emit(_lookbehind.data(), held);
+        _lookbehind.clear();
+    }
+
+    match = search(data, size);
+    if (match != std::string::npos) {
+        emit(data, match);
+        endPart();
+        return match + _delimiter.size();
+    }
+    size_t decided = size > keep ? size - keep : 0;
+    emit(data, decided);
+    _lookbehind.assign(data + decided, size - decided);
+    return size;
+}
+
+// after a delimiter: "--" if it was the last one, otherwise optional padding and CRLF before the part's headers
+size_t MultipartUpload::readDelimiterEnd(const char *data, size_t size) {
+    size_t used = 0;
+    while (used < size) {
+        _line += data[used++];
+        if (_line == "--") {
+            _state = EPILOGUE;
+            return used;
+        }
+        if (_line.size() >= 2 && _line.compare(_line.size() - 2, 2, "\r\n") == 0) {
+            if (_line.find_first_not_of(" \t") != _line.size() - 2) {
+                fail(400);
+                return size;
+            }
+            _line.clear();
+            _state = PART_HEADERS;
+            return used;
+        }
+        if (_line.size() > MAX_DELIMITER_LINE) {
+            fail(400);
+            return size;
+        }
+    }
+    return used;
+}
+
+// collect the part's header block up to the empty line that ends it
+size_t MultipartUpload::readHeaders(const char *data, size_t size) {
+    size_t before = _line.size();
+    size_t take = std::min(size, MAX_PART_HEADERS + 4 - before);
+    _line.append(data, take);
+
+    size_t block_end = std::string::npos;
+    if (_line.compare(0, 2, "\r\n") == 0) {
+        // a part without any headers
+        block_end = 2;
+    } else {
+        size_t empty_line = _line.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+        if (empty_line != std::string::npos) {
+            block_end = empty_line + 4;
+        }
+    }
+    if (block_end == std::string::npos) {
+        if (_line.size() >= MAX_PART_HEADERS + 4) {
+            fail(400);
+            return size;
+        }
+        return take;
+    }
+
+    startPart(_line.substr(0, block_end));
+    _line.clear();
+    return block_end - before;
+}
+
+// content of a file part goes to its file, the preamble and plain fields are dropped
+void MultipartUpload::emit(const char *data, size_t size) {
+    while (size > 0 && _fd != -1) {
+        ssize_t bytes = ::write(_fd, data, size);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            std::cerr << "Error writing uploaded file " << _file_path << ": " << strerror(errno) << std::endl;
+            fail(500);
+            return;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+}
+
+// a file part is written under a temporary name, it only shows up in the upload directory once it is complete
+void MultipartUpload::startPart(const std::string &headers) {
+    _state = PART_DATA;
+    std::string name = filename(headers);
+    if (name.empty()) {
+        return;
+    }
+
+    _file_path = _dir + "/" + name;
+    _tmp_path = _dir + "/.upload-XXXXXX";
+    _fd = mkostemp(&_tmp_path[0], O_CLOEXEC);
+    if (_fd == -1) {
+        std::cerr << "Error opening file for writing: " << _file_path << ": " << strerror(errno) << std::endl;
+        fail(500);
+        return;
+    }
+    // mkostemp() creates the file for the owner only, uploads are readable like ones written with ofstream
+    fchmod(_fd, 0644);
+}
+
+// a delimiter was found: the part before it is complete
+void MultipartUpload::endPart() {
+    if (_state == PART_DATA && _fd != -1) {
+        close(_fd);
+        _fd = -1;
+        if (rename(_tmp_path.c_str(), _file_path.c_str()) == -1) {
+            std::cerr << "Error saving uploaded file " << _file_path << ": " << strerror(errno) << std::endl;
+            unlink(_tmp_path.c_str());
+            fail(500);
+            return;
+        }
+        std::cout << "File uploaded successfully: " << _file_path << std::endl;
+    }
+    _line.clear();
+    _state = DELIMITER_END;
+}
+
+void MultipartUpload::fail(int status) {
+    if (_status == 0) {
+        _status = status;
+    }
+    if (_fd != -1) {
+        close(_fd);
+        _fd = -1;
+        unlink(_tmp_path.c_str());
+    }
+}
+
+std::string MultipartUpload::boundary(const std::string &contentType) {
+    size_t boundaryPos = contentType.find("boundary=");
+    if (contentType.find("multipart/form-data") == std::string::npos || boundaryPos == std::string::npos) {
+        return "";
+    }
+    // the boundary value runs up to the next parameter
+    std::string boundary = contentType.substr(boundaryPos + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    boundary.erase(boundary.find_last_not_of(" \t\r\n") + 1);
+    // the boundary may be quoted
+    if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+        boundary = boundary.substr(1, boundary.size() - 2);
+    }
+    return boundary;
+}
+
+std::string MultipartUpload::filename(const std::string &partHeaders) {
+    size_t filenamePos = partHeaders.find("filename=\"");
+    if (filenamePos == std::string::npos) {
+        return "";
+    }
+    size_t filenameEndPos = partHeaders.find("\"", filenamePos + 10);
+    if (filenameEndPos == std::string::npos) {
+        return "";
+    }
+    std::string name = partHeaders.substr(filenamePos + 10, filenameEndPos - (filenamePos + 10));
+
+    // some browsers send the full client-side path, and a name with directories could leave the upload directory
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    if (name == "." || name == "..") {
+        return "";
+    }
+    return name;
+}
@@ -2,44 +2,19 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <iostream>
+#include <cerrno>
+#include <cstring>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
 #include <cctype>
 #include <map>
-#include <regex>
-
-// converts max body size from configuration string (e.g., "1M", "1K") to bytes.
-ssize_t Request::convertMaxBodySize(const std::string &input) {
-    // regex for valid formats like 1K, 1M, 1G, or plain numbers
-    std::regex valid_format("^\\d+(K|M|G)?$");
-    if (!std::regex_match(input, valid_format)) {
-        // serve 400 Bad Request for invalid format
-        std::cerr << "Invalid client_max_body_size format: " << input << std::endl;
-        ServeErrorPage(400);
-        return -1;
-    }
-
-    // extract numeric value and convert units (K/M/G) to bytes
-    ssize_t size = std::stoi(input);
-    if (input.back() == 'K')
-        size *= 1024; // convert Kilobytes to bytes
-    else if (input.back() == 'M')
-        size *= 1024 * 1024; // convert Megabytes to bytes
-    else if (input.back() == 'G')
-        size *= 1024 * 1024 * 1024; // convert Gigabytes to bytes
-
-    return size;
-}
 
 // handle POST request including body size checks and content type parsing.
-void Request::HandlePostRequest(const std::string &requestBody) {
-    // convert the max body size from config (e.g., "1M" to 1,048,576 bytes).
-    size_t maxBodySize = convertMaxBodySize(_config.client_max_body_size);
-    
-    // if maxBodySize is invalid (-1), an error page has already been served, so return.
-    if (maxBodySize == -1)
-        return;
+void Request::HandlePostRequest() {
+    // the limit of the location, converted from the config (e.g., "1M" to 1,048,576 bytes) when it was loaded.
+    auto location = findLocation(_url);
+    size_t maxBodySize = location ? location->max_body_size : _config.max_body_size;
 
     // Extract Content-Length from headers and check if it exceeds the max allowed body size.
     size_t contentLength = extractContentLength();
@@ -58,57 +33,40 @@ void Request::HandlePostRequest(const std::string &requestBody) {
         return;
     }
 
+    // the handlers work on the body in memory, a spooled one is read back on a disk thread now that it is known to fit
+    if (_request.spooled_body) {
+        std::shared_ptr<SpooledBody> spool = std::move(_request.spooled_body);
+        auto body = std::make_shared<std::string>();
+        auto error = std::make_shared<int>(0);
+        offloadDisk([spool, body, error] {
+            if (!spool->read(*body))
+                *error = errno;
+        }, [this, contentType, body, error] {
+            if (*error) {
+                std::cerr << "Failed to read a spooled request body: " << strerror(*error) << std::endl;
+                ServeErrorPage(500);
+                return;
+            }
+            _request.body = std::move(*body);
+            processRequestBody(contentType, _request.body);
+        });
+        return;
+    }
+
     // route the request body to the appropriate content-type handler based on Content-Type.
-    processRequestBody(contentType, requestBody);
+    processRequestBody(contentType, _request.body);
 }
 
 // extract Content-Length header value from the request headers.
 size_t Request::extractContentLength() {
-    // default content length is 0 (if not specified).
-    size_t contentLength = 0;
-    
-    // find the position of the "Content-Length:" header in the request headers.
-    size_t contentLengthPos = _headers.find("Content-Length:");
-    
-    // if the "Content-Length:" header is found in the headers.
-    if (contentLengthPos != std::string::npos) {
-        // find the end of the Content-Length value by looking for the end of the line ("\r\n").
-        size_t contentLengthEnd = _headers.find("\r\n", contentLengthPos);
-        
-        // extract the string value of the Content-Length between the header position and the end of the line.
-        std::string contentLengthStr = _headers.substr(contentLengthPos + 15, contentLengthEnd - (contentLengthPos + 15));
-        
-        // convert the extracted string to an unsigned long long integer (stoull).
-        contentLength = std::stoull(contentLengthStr);
-    }
-    
-    // return the extracted content length (or 0 if not present).
-    return contentLength;
+    // the parser already validated and converted Content-Length (0 if not present).
+    return _request.content_length;
 }
 
 // extract Content-Type header value and normalize it
 std::string Request::extractContentType() {
-    // create a string stream to iterate through the headers line by line
-    std::istringstream headerStream(_headers);
-    // variables to store each line and the extracted Content-Type value
-    std::string line, contentType;
-    
-    // loop through each header line until the end of headers ("\r") is found.
-    while (std::getline(headerStream, line) && line != "\r") {
-        // check if the current line contains the "Content-Type:" header.
-        if (line.find("Content-Type:") != std::string::npos) {
-            // extract the value after "Content-Type:" by moving 13 positions ahead of the header.
-            size_t ctStart = line.find("Content-Type:") + 13;
-            // get the substring after "Content-Type:"
-            contentType = line.substr(ctStart);
-            
-            // trim any trailing whitespace characters (spaces, tabs, newlines).
-            contentType.erase(contentType.find_last_not_of(" \t\r\n") + 1);
-
-            // exit the loop after finding the Content-Type header.
-            break;  
-        }
-    }
+    // take the Content-Type value from the parsed headers
+    std::string contentType = _request.getHeader("content-type");
 
     // normalize content type:
     // 1. convert all characters to lowercase to handle case insensitivity.
@@ -141,7 +99,7 @@ void Request::processRequestBody(const std::string &contentType, const std::stri
     // check if the content type is JSON ("application/json")
     else if (contentType == "application/json") {
         // call the handler for JSON data
-        handleJson(requestBody);
+        handleJson();
     } 
     // handle unsupported content types
     else {
@@ -189,7 +147,7 @@ void Request::handlePlainText(const std::string &requestBody) {
 }
 
 // handle JSON data
-void Request::handleJson(const std::string &requestBody) {
+void Request::handleJson() {
     // example response message indicating JSON was received (can implement but gotta decide tho)
     std::string htmlContent = "<html><body><h1>Received JSON data!</h1></body></html>";
     // Send the HTML response back to the client
@@ -216,43 +174,40 @@ void Request::handleMultipartFormData(const std::string &requestBody) {
         return;
     }
 
-    // convert the relative upload path to an absolute path
-    std::string uploadDir = getAbsolutePath(location->upload_path);
-
-    // process the multipart form-data content in the request body using the boundary
-    processMultipartData(requestBody, boundary, uploadDir);
-
     // after file uploads are processed successfully, send a success response
     std::string htmlContent = "<html><body><h1>File uploaded successfully!</h1></body></html>";
-    
-    // send the success HTML response to the client
-    sendHtmlResponse(htmlContent);
+
+    // the files were normally written while the body arrived
+    if (_request.body_sink) {
+        // send the success HTML response to the client
+        sendHtmlResponse(htmlContent);
+        return;
+    }
+
+    // a body that was buffered is parsed the same way now, its files are written on a disk thread
+    std::string uploadDir = getAbsolutePath(location->upload_path);
+    auto body = std::make_shared<std::string>(requestBody);
+    auto status = std::make_shared<int>(0);
+    offloadDisk([boundary, uploadDir, body, status] {
+        MultipartUpload upload(boundary, uploadDir);
+        upload.open();
+        *status = upload.write(body->data(), body->size());
+        if (*status == 0)
+            *status = upload.finish();
+    }, [this, status, htmlContent] {
+        if (*status != 0) {
+            // 400 for a malformed body, 500 if a file couldn't be written
+            ServeErrorPage(*status);
+            return;
+        }
+        sendHtmlResponse(htmlContent);
+    });
 }
 
 // extract boundary from headers for multipart form-data
 std::string Request::extractBoundary() {
-    // variable to store the extracted boundary
-    std::string boundary;
-    // variable to store each line of the headers
-    std::string line;
-    // stream to read the headers line by line
-    std::istringstream headerStream(_headers);
-
-    // loop through each line in the headers
-    while (std::getline(headerStream, line) && line != "\r") {
-        // check if the line contains the "Content-Type: multipart/form-data" with a boundary
-        if (line.find("Content-Type: multipart/form-data; boundary=") != std::string::npos) {
-            // locate the start of the boundary value
-            size_t boundaryStart = line.find("boundary=") + 9;
-            // extract the boundary value from the header line
-            boundary = line.substr(boundaryStart);
-            // trim any trailing spaces, tabs, or newline characters from the boundary string
-            boundary.erase(boundary.find_last_not_of(" \t\r\n") + 1);
-
-            // exit the loop once the boundary is found
-            break;
-        }
-    }
+    // the boundary is a parameter of the Content-Type header
+    std::string boundary = MultipartUpload::boundary(_request.getHeader("content-type"));
 
     // if the boundary is empty (not found), log an error and serve a 400 Bad Request
     if (boundary.empty()) {
@@ -264,105 +219,110 @@ std::string Request::extractBoundary() {
     return boundary;
 }
 
-// process each part of multipart/form-data and save uploaded files
-void Request::processMultipartData(const std::string &requestBody, const std::string &boundary, const std::string &uploadDir) {
-    // create boundary markers to delimit the parts of the multipart data
-    std::string boundaryMarker = "--" + boundary; // start boundary marker
-    std::string endBoundaryMarker = boundaryMarker + "--"; // end boundary marker (used to indicate the last part)
-
-    // find the position of the start and end boundaries in the request body
-    size_t startPos = requestBody.find(boundaryMarker); // position of the first boundary marker
-    size_t endPos = requestBody.rfind(endBoundaryMarker); // position of the final boundary marker
+// route a copy of the request line and headers the way the complete request will be routed
+BodyRoute Request::routeBody(const std::vector<ServerConfig> &configs, int port, const HttpRequest &request) {
+    HttpRequest headers;
+    headers.method = request.method;
+    headers.target = request.target;
+    headers.version = request.version;
+    headers.headers = request.headers;
+    headers.content_length = request.content_length;
+
+    Request route(configs, std::move(headers), port, 0, nullptr, -1, -1);
+    return route.planBody();
+}
 
-    // validate if boundaries are present in the request
-    if (startPos == std::string::npos || endPos == std::string::npos) {
-        std::cerr << "Invalid multipart request: boundaries not found!" << std::endl;
-        return;  // exit if the boundaries are invalid
+// the errors HandleRequest and the upload handlers would find without looking at the body are answered
+// before it is read, the client is told to go ahead with it otherwise
+BodyRoute Request::planBody() {
+    BodyRoute route;
+    ParseLine();
+    ServerConfig* selected_config = selectServerConfig(_request.getHeader("host"));
+    if (selected_config == nullptr)
+        return route;
+    _config = *selected_config;
+    route.max_size = _config.max_body_size;
+
+    // 100-continue is the only expectation there is (RFC 9110 section 10.1.1)
+    std::string expect = _request.getHeader("expect");
+    std::transform(expect.begin(), expect.end(), expect.begin(), ::tolower);
+    if (!expect.empty() && expect != "100-continue") {
+        route.status = 417;
+        return route;
     }
 
-    // move past the initial boundary marker to the actual content
-    startPos += boundaryMarker.length() + 2; // skip the boundary marker and the subsequent CRLF
-
-    // loop to process each part (file or form data) until the end boundary is reached
-    while (startPos < endPos) {
-        // find the end of the headers for the current part (headers end with an empty line)
-        size_t headerEndPos = requestBody.find("\r\n\r\n", startPos);
-        if (headerEndPos == std::string::npos)
-            return; // exit if headers are incomplete
-
-        // extract the headers for the current part
-        std::string partHeaders = requestBody.substr(startPos, headerEndPos - startPos);
-
-        // extract the filename from the headers (if it's a file part)
-        std::string filename = extractFilename(partHeaders);
-
-        // move to the file content after the headers
-        startPos = headerEndPos + 4;  // skip past the header end marker (CRLF CRLF)
-
-        // find the boundary marker for the next part
-        size_t nextBoundary = requestBody.find(boundaryMarker, startPos);
-        if (nextBoundary == std::string::npos)
-            return;  // exit if the next boundary is missing
-
-        // extract the file content between the boundaries
-        std::string fileContent = requestBody.substr(startPos, nextBoundary - startPos - 2); // -2 to remove trailing CRLF
-
-        // save the uploaded file to the specified upload directory
-        saveUploadedFile(uploadDir, filename, fileContent);
-
-        // move to the next part by skipping past the boundary marker and its trailing CRLF
-        startPos = nextBoundary + boundaryMarker.length() + 2;
+    // a trailing slash is redirected before anything else is checked
+    LocationConfig* location = findLocation(_url);
+    if (!_needs_redirect) {
+        if (location == nullptr || !isMethodAllowed(location, _method)) {
+            route.status = 405;
+            return route;
+        }
+        route.max_size = location->max_body_size;
     }
-}
-
-// extract the filename from multipart headers
-std::string Request::extractFilename(const std::string &partHeaders) {
-    // find the position of the "filename=" in the headers
-    size_t filenamePos = partHeaders.find("filename=\"");
-    if (filenamePos == std::string::npos) {
-        // return an empty string if no filename is found
-        return "";
+    if (extractContentLength() > route.max_size) {
+        std::cerr << "Request body too large: " << extractContentLength() << " bytes (Max allowed: " << route.max_size << " bytes)" << std::endl;
+        route.status = 413;
+        return route;
     }
-    
-    // find the end position of the filename by locating the closing quote
-    size_t filenameEndPos = partHeaders.find("\"", filenamePos + 10);
-    
-    // extract and return the filename by using substr between the found positions
-    return partHeaders.substr(filenamePos + 10, filenameEndPos - (filenamePos + 10));
+
+    // an HTTP/1.0 client can't have meant it
+    route.send_continue = !expect.empty() && _request.version == "HTTP/1.1";
+    if (!_needs_redirect)
+        uploadSink(location, route);
+    return route;
 }
 
-// save the uploaded file to the specified path
-void Request::saveUploadedFile(const std::string &uploadDir, const std::string &filename, const std::string &fileContent) {
-    // return early if no filename was provided
-    if (filename.empty())
+// a multipart POST that HandleRequest will pass on to handleMultipartFormData has its files written out as it
+// arrives, the body of a PUT goes to its file and a part of a resumable upload to its place in the upload.
+// anything else is read as usual. nothing is created here, the sinks open their files on a disk thread
+void Request::uploadSink(LocationConfig* location, BodyRoute &route) {
+    if (!location->redirection.empty() || location->cgi_status)
+        return;
+    // scripts get the body on their stdin, an extension the location doesn't run is refused before it is sent
+    CgiMatch match = matchCgiExtension(location, _url);
+    if (match == UNSUPPORTED_EXTENSION && location->fastcgi_pass.empty()) {
+        route.status = 415;
+        return;
+    }
+    if (!location->fastcgi_pass.empty() || match == CGI_SCRIPT || location->upload_path.empty())
         return;
 
-    // ensure the upload directory exists
-    createDir(uploadDir); 
-
-    // construct the full file path by appending the filename to the directory
-    std::string filePath = uploadDir + "/" + filename;
+    std::string id;
+    if (location->upload_sessions && queryParam("upload", id)) {
+        // a part for an unknown upload or beyond its end is refused before it is sent
+        if (_method == "PATCH")
+            route.status = uploadPart(location, route.sink);
+        return;
+    }
 
-    // open a file stream to write the uploaded file in binary mode
-    std::ofstream outFile(filePath, std::ios::binary);
-    if (!outFile) {
-        // if fails
-        std::cerr << "Error opening file for writing: " << filePath << std::endl;
+    if (_method == "PUT") {
+        std::string target = uploadTarget(location);
+        if (target.empty())
+            return;
+        // a chunked body has no length yet, its file grows as it is decoded
+        route.sink = std::make_unique<FileUpload>(target, _request.content_length);
+        route.open_sink = true;
         return;
     }
+    if (_method != "POST")
+        return;
 
-    // write the file content to the output file
-    outFile.write(fileContent.c_str(), fileContent.size());
-    // close the file stream
-    outFile.close();
+    // only a body processRequestBody() hands to handleMultipartFormData() is parsed as it arrives
+    if (extractContentType().find("multipart/form-data") == std::string::npos)
+        return;
+    std::string boundary = MultipartUpload::boundary(_request.getHeader("content-type"));
+    if (boundary.empty())
+        return;
 
-    std::cout << "File uploaded successfully: " << filePath << std::endl;
+    route.sink = std::make_unique<MultipartUpload>(boundary, getAbsolutePath(location->upload_path));
+    route.open_sink = true;
 }
 
 // send HTML response back to the client
 void Request::sendHtmlResponse(const std::string &htmlContent) {
     // add response header for HTTP 200 OK status
     responseHeader(htmlContent, HTTP_200);  
-    // append the HTML content to the response body
-    _response += htmlContent;
+    // the HTML content follows the headers
+    _body.addMemory(htmlContent);
 }
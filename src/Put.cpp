@@ -0,0 +1,99 @@
+#include "../include/Request.hpp"
+
+#include <sstream>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+// store the raw request body as the file named by the URL, replacing it if it exists
+void Request::HandlePutRequest() {
+    // retrieve the location configuration based on the requested URL
+    auto location = findLocation(_url);
+
+    // ensure that the location has an upload path configured
+    if (location == nullptr || location->upload_path.empty()) {
+        std::cerr << "Upload path not specified in the config for the current location!" << std::endl;
+        ServeErrorPage(500);
+        return;
+    }
+
+    // reject a body larger than the location accepts
+    if (extractContentLength() > location->max_body_size) {
+        std::cerr << "Request body too large: " << extractContentLength() << " bytes (Max allowed: " << location->max_body_size << " bytes)" << std::endl;
+        ServeErrorPage(413);
+        return;
+    }
+
+    // the URL has to name a file inside the upload directory
+    std::string target = uploadTarget(location);
+    if (target.empty()) {
+        std::cerr << "Error: PUT target outside the upload directory: " << _url << std::endl;
+        ServeErrorPage(403);
+        return;
+    }
+
+    // the body was normally written to the file while it arrived
+    QueuedSink *sink = dynamic_cast<QueuedSink *>(_request.body_sink.get());
+    FileUpload *upload = sink ? dynamic_cast<FileUpload *>(sink->target()) : nullptr;
+    if (upload != nullptr) {
+        putResponse(upload->replaced());
+        return;
+    }
+
+    // an empty body, or one read before it was known where it goes, is written now, on a disk thread
+    std::shared_ptr<SpooledBody> spool = std::move(_request.spooled_body);
+    auto body = std::make_shared<std::string>(std::move(_request.body));
+    auto status = std::make_shared<int>(0);
+    auto replaced = std::make_shared<bool>(false);
+    offloadDisk([target, spool, body, status, replaced] {
+        if (spool && !spool->read(*body)) {
+            std::cerr << "Failed to read a spooled request body: " << strerror(errno) << std::endl;
+            *status = 500;
+            return;
+        }
+        FileUpload buffered(target);
+        buffered.open(body->size());
+        *status = buffered.write(body->data(), body->size());
+        if (*status == 0)
+            *status = buffered.finish();
+        *replaced = buffered.replaced();
+    }, [this, status, replaced] {
+        if (*status != 0) {
+            ServeErrorPage(*status);
+            return;
+        }
+        putResponse(*replaced);
+    });
+}
+
+// 201 for a new file, 200 if an existing one was replaced
+void Request::putResponse(bool replaced) {
+    std::string message = replaced ? "<html><body><h1>File replaced successfully!</h1></body></html>" : "<html><body><h1>File created successfully!</h1></body></html>";
+    responseHeader(message, replaced ? HTTP_200 : HTTP_201);
+    _body.addMemory(std::move(message));
+}
+
+// the part of the URL after the location's path, under the upload directory. its parent directories are
+// created along with the file, empty if the URL names no file or has "." or ".." segments that could leave the directory
+std::string Request::uploadTarget(LocationConfig* location) {
+    std::string name = _url.substr(0, _url.find('?'));
+    if (name.find(location->path) == 0) {
+        name = name.substr(location->path.length());
+    }
+
+    // check every segment of the remaining path
+    std::istringstream segments(name);
+    std::string segment;
+    std::string relative;
+    while (std::getline(segments, segment, '/')) {
+        if (segment.empty())
+            continue;
+        if (segment == "." || segment == "..")
+            return "";
+        relative += "/" + segment;
+    }
+    if (relative.empty())
+        return "";
+
+    return getAbsolutePath(location->upload_path) + relative;
+}
@@ -0,0 +1,97 @@
+#include "QueuedSink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+QueuedSink::Pipe::~Pipe() {
+    if (fds[0] != -1) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+QueuedSink::QueuedSink(std::unique_ptr<BodySink> target, DiskPool *pool, int notify_fd)
+    : _target(std::move(target)), _pool(pool), _notify_fd(notify_fd), _piped(0), _finishing(false), _status(std::make_shared<int>(0)) {
+    _file = dynamic_cast<FileSink *>(_target.get());
+}
+
+// closing the target's files, and removing them if the body never completed, is disk work as well. nobody
+// waits for it, so no worker is notified
+QueuedSink::~QueuedSink() {
+    if (_pool) {
+        _pool->submit([target = std::move(_target), pipe = std::move(_pipe)] {}, -1);
+    }
+}
+
+int QueuedSink::write(const char *data, size_t size) {
+    if (*_status == 0) {
+        _queued.append(data, size);
+    }
+    return *_status;
+}
+
+int QueuedSink::finish() {
+    _finishing = true;
+    return *_status;
+}
+
+bool QueuedSink::canSplice() const {
+    return _file != nullptr && *_status == 0;
+}
+
+// whatever the socket holds right now goes into the pipe, the next flush moves it on into the file
+ssize_t QueuedSink::splice(int fd, size_t size) {
+    if (!_pipe) {
+        auto pipe = std::make_shared<Pipe>();
+        if (pipe2(pipe->fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+            *_status = 500;
+            errno = EIO;
+            return -1;
+        }
+        // a larger pipe moves more per round, the default one holds 64K
+        fcntl(pipe->fds[1], F_SETPIPE_SZ, UPLOAD_SPLICE_SIZE);
+        _pipe = pipe;
+    }
+
+    ssize_t in = ::splice(fd, NULL, _pipe->fds[1], NULL, std::min(size, static_cast<size_t>(UPLOAD_SPLICE_SIZE)), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (in > 0) {
+        _piped += in;
+    }
+    return in;
+}
+
+std::shared_ptr<DiskJob> QueuedSink::flush() {
+    auto data = std::make_shared<std::string>(std::move(_queued));
+    _queued.clear();
+    size_t piped = _piped;
+    _piped = 0;
+    bool finishing = _finishing;
+    _finishing = false;
+
+    // the job only touches what it captured, the target and pipe stay alive with it
+    std::shared_ptr<BodySink> target = _target;
+    FileSink *file = _file;
+    std::shared_ptr<Pipe> pipe = _pipe;
+    std::shared_ptr<int> status = _status;
+    auto work = [target, file, pipe, data, piped, finishing, status] {
+        int result = *status;
+        if (result == 0 && !data->empty()) {
+            result = target->write(data->data(), data->size());
+        }
+        if (result == 0 && piped > 0) {
+            result = file->drain(pipe->fds[0], piped);
+        }
+        if (result == 0 && finishing) {
+            result = target->finish();
+        }
+        *status = result;
+    };
+
+    std::shared_ptr<DiskJob> job = _pool ? _pool->submit(work, _notify_fd) : nullptr;
+    if (!job) {
+        work();
+    }
+    return job;
+}
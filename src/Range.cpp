@@ -0,0 +1,148 @@
+#include "../include/Request.hpp"
+
+#include <sstream>
+#include <random>
+#include <ctime>
+#include <cstdint>
+
+// answer a Range request for a static file (RFC 7233). returns false when the Range header
+// has to be ignored and the whole file is sent with a 200 instead
+bool Request::ServeRange(const FileCacheEntry &file, const std::string &etag, const std::string &extraHeaders) {
+    // If-Range: only send a part if the client still has the current version
+    if (!ifRangeMatches(etag, file.st.st_mtime)) {
+        return false;
+    }
+
+    off_t size = file.st.st_size;
+    std::vector<std::pair<off_t, off_t>> ranges;
+    if (!parseRanges(_request.getHeader("range"), size, ranges)) {
+        // malformed or unsupported Range headers are ignored
+        return false;
+    }
+
+    // none of the ranges overlaps the file
+    if (ranges.empty()) {
+        std::string headers = "Content-Range: bytes */" + std::to_string(size) + "\r\n";
+        responseHeader(0, HTTP_416, headers);
+        return true;
+    }
+
+    std::string headers = extraHeaders + "Accept-Ranges: bytes\r\n";
+
+    // a single range is sent as is, with its position in Content-Range
+    if (ranges.size() == 1) {
+        off_t first = ranges[0].first;
+        off_t last = ranges[0].second;
+        headers += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size) + "\r\n";
+        responseHeader(static_cast<size_t>(last - first + 1), HTTP_206, headers);
+
+        _body.addFile(file.file, first, static_cast<size_t>(last - first + 1));
+        return true;
+    }
+
+    // several ranges become a multipart/byteranges body, the boundary must not show up in the data
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+    std::ostringstream boundary;
+    boundary << std::hex << generator() << generator();
+
+    // every part gets its own small header block in front of its file region
+    std::string partType = contentTypeHeader();
+    size_t contentLength = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::string partHeaders = "\r\n--" + boundary.str() + "\r\n" + partType;
+        partHeaders += "Content-Range: bytes " + std::to_string(ranges[i].first) + "-" + std::to_string(ranges[i].second) + "/" + std::to_string(size) + "\r\n\r\n";
+        size_t length = static_cast<size_t>(ranges[i].second - ranges[i].first + 1);
+        contentLength += partHeaders.size() + length;
+        _body.addMemory(std::move(partHeaders));
+        _body.addFile(file.file, ranges[i].first, length);
+    }
+    std::string closing = "\r\n--" + boundary.str() + "--\r\n";
+    contentLength += closing.size();
+    _body.addMemory(std::move(closing));
+
+    // the multipart Content-Type replaces the file's own type
+    _response = _http_version + " " + HTTP_206 + "\r\n";
+    _response += "Content-Type: multipart/byteranges; boundary=" + boundary.str() + "\r\n";
+    _response += "Content-Length: " + std::to_string(contentLength) + "\r\n";
+    _response += headers;
+    _response += "Date: " + getCurrentTimeHttpFormat() + "\r\n";
+    _response += connectionHeader();
+    _response += "Server: " + _config.server_name + "\r\n\r\n";
+    return true;
+}
+
+// parse "bytes=0-99,200-,-50" into inclusive [first, last] pairs clipped to the file size.
+// returns false if the header must be ignored, an empty list means nothing is satisfiable
+bool Request::parseRanges(const std::string &header, off_t size, std::vector<std::pair<off_t, off_t>> &ranges) {
+    if (header.compare(0, 6, "bytes=") != 0) {
+        return false;
+    }
+
+    std::istringstream specs(header.substr(6));
+    std::string spec;
+    size_t count = 0;
+    while (std::getline(specs, spec, ',')) {
+        // too many parts is a known way to make servers do a lot of work for little data
+        if (++count > MAX_RANGES) {
+            return false;
+        }
+
+        spec.erase(0, spec.find_first_not_of(" \t"));
+        spec.erase(spec.find_last_not_of(" \t") + 1);
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) {
+            return false;
+        }
+        std::string from = spec.substr(0, dash);
+        std::string to = spec.substr(dash + 1);
+        if (from.find_first_not_of("0123456789") != std::string::npos || to.find_first_not_of("0123456789") != std::string::npos
+            || from.size() > 18 || to.size() > 18 || (from.empty() && to.empty())) {
+            return false;
+        }
+
+        off_t first;
+        off_t last;
+        if (from.empty()) {
+            // "-N" is the last N bytes
+            off_t suffix = std::stoll(to);
+            if (suffix == 0) {
+                continue;
+            }
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        } else {
+            first = std::stoll(from);
+            last = to.empty() ? size - 1 : std::stoll(to);
+            // "5-3" is a syntax error, the whole header is ignored then
+            if (!to.empty() && last < first) {
+                return false;
+            }
+            // a range starting past the end can't be satisfied, "<size>-" neither. others are clipped
+            if (first >= size) {
+                continue;
+            }
+            if (last >= size) {
+                last = size - 1;
+            }
+        }
+        ranges.push_back(std::make_pair(first, last));
+    }
+    return count > 0;
+}
+
+// If-Range holds either an entity tag or a date, both must match exactly
+bool Request::ifRangeMatches(const std::string &etag, time_t lastModified) {
+    std::string ifRange = _request.getHeader("if-range");
+    if (ifRange.empty()) {
+        return true;
+    }
+
+    // entity tags are compared strongly, so a weak tag never matches
+    if (ifRange[0] == '"' || ifRange.compare(0, 2, "W/") == 0) {
+        return ifRange == etag;
+    }
+
+    std::tm date = {};
+    const char *end = strptime(ifRange.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &date);
+    return end != nullptr && *end == '\0' && timegm(&date) == lastModified;
+}
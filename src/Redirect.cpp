@@ -29,6 +29,7 @@ void Request::sendRedirectResponse(const std::string &redirection_url, int retur
     response << "Content-Type: text/html\r\n";
     response << "Content-Length: 0\r\n";
     response << "Date: " << getCurrentTimeHttpFormat() << "\r\n";
+    response << connectionHeader();
     response << "Server: " << _config.server_name << "\r\n\r\n";
 
     // set the constructed response to the member variable
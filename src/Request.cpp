@@ -1,5 +1,4 @@
 #include "Request.hpp"
-#include "Header.hpp"
 
 #include <iomanip>
 #include <fstream>
@@ -7,29 +6,103 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 
-Request::Request(const std::vector<ServerConfig> &configs, const std::string &request_data, int port): _configs(configs), _request(request_data), _port(port) {}
+Request::Request(const std::vector<ServerConfig> &configs, HttpRequest request, int port, size_t request_count, FileCache *file_cache, int cgi_cache_fd, int cgi_queue_fd, DiskPool *disk_pool, int disk_fd): _configs(configs), _request(std::move(request)), _port(port), _request_count(request_count), _file_cache(file_cache), _cgi_cache_fd(cgi_cache_fd), _cgi_queue_fd(cgi_queue_fd), _disk_pool(disk_pool), _disk_fd(disk_fd) {}
 
-Request::~Request() {}
+Request::~Request() {
+    // a claimed CGI cache key whose response never made it is handed to the next waiting request
+    if (_cgi_cache_filling) {
+        _cgi_location->cgi_cache->abandon(_cgi_cache_key);
+    }
+    // a request that leaves the queue after it was handed a slot passes the slot on, like one whose script is done
+    if (_cgi_queued && !_cgi_location->cgi_limiter->leave(_cgi_queue_ticket, false)) {
+        _cgi_slot = _cgi_location->cgi_limiter->claim(_cgi_queue_ticket);
+    }
+    if (_cgi_slot) {
+        _cgi_location->cgi_limiter->release();
+    }
+}
+
+ResponseBody Request::releaseResponse() {
+    ResponseBody response;
+    response.addMemory(std::move(_response));
+    response.append(std::move(_body));
+    _response.clear();
+    return response;
+}
+
+// the work may only touch what it captured, done runs on the event loop and continues the response.
+// without a pool, or with its queue full, both run right away
+void Request::offloadDisk(std::function<void()> work, std::function<void()> done) {
+    _disk_job = _disk_pool ? _disk_pool->submit(work, _disk_fd) : nullptr;
+    if (!_disk_job) {
+        work();
+        done();
+        return;
+    }
+    _disk_done = std::move(done);
+}
+
+void Request::resumeDisk() {
+    // done may start the next job of the request
+    std::function<void()> done = std::move(_disk_done);
+    _disk_done = nullptr;
+    _disk_job.reset();
+    done();
+}
+
+// a hit costs no system call, a miss is stat'ed and opened on a disk thread and kept for the next request
+void Request::lookupFile(const std::string &path, std::function<void(const FileCacheEntry &)> then) {
+    // a request built outside an event loop, like the one routeBody() asks, has no cache to keep it in
+    if (!_file_cache) {
+        then(FileCache::load(path));
+        return;
+    }
+    FileCacheEntry entry;
+    if (_file_cache->find(path, entry)) {
+        then(entry);
+        return;
+    }
+    uint64_t generation = _file_cache->generation();
+    auto loaded = std::make_shared<FileCacheEntry>();
+    offloadDisk([path, loaded] { *loaded = FileCache::load(path); }, [this, path, loaded, generation, then] {
+        _file_cache->store(path, *loaded, generation);
+        then(*loaded);
+    });
+}
+
+// nothing to do for a body that was small enough to stay in memory. the file is closed once it has been read
+bool Request::loadSpooledBody(std::string &body) {
+    if (!_request.spooled_body) {
+        return true;
+    }
+    bool loaded = _request.spooled_body->read(body);
+    if (!loaded) {
+        std::cerr << "Failed to read a spooled request body: " << strerror(errno) << std::endl;
+    }
+    _request.spooled_body.reset();
+    return loaded;
+}
 
 // parse the incoming HTTP request
 void Request::ParseRequest() {
-    // step 1: parse the headers and body
-    ParseHeadersAndBody();
-
-    // step 2: ensure headers are valid
-    if (_headers.empty()) {
-        // return error if headers are missing
-        ServeErrorPage(400);
+    // step 1: the request was split into request line, headers and body by HttpParser,
+    // a malformed request arrives without a method
+    if (_request.method.empty()) {
+        // return error if the request could not be parsed, 413 or 501 for a body that couldn't be read
+        _http_version = "HTTP/1.1";
+        ServeErrorPage(_request.error_status);
         return;
     }
 
-    // step 3: parse the request line (GET /path HTTP/1.1)
-    std::string requestLine = ExtractRequestLine();
-    ParseLine(requestLine);
+    // step 2: take over the request line (GET /path HTTP/1.1)
+    ParseLine();
 
-    // step 4: select the appropriate server configuration based on the Host header
-    std::string host_header = Header::getHost(_headers);
+    // step 3: select the appropriate server configuration based on the Host header
+    std::string host_header = _request.getHeader("host");
     ServerConfig* selected_config = selectServerConfig(host_header);
     if (selected_config == nullptr) {
         // return error if no config is found
@@ -39,54 +112,28 @@ void Request::ParseRequest() {
     // save the selected configuration
     _config = *selected_config;
 
+    // step 4: decide whether the connection can be reused once the response is sent,
+    // not after a body that was refused from the headers alone and may still be on its way
+    if (_request.error_status != 0) {
+        ServeErrorPage(_request.error_status);
+        return;
+    }
+    _keep_alive = ShouldKeepAlive();
+
     // step 5: handle redirection, location finding, and request handling
     HandleRequest();
 }
 
-void Request::ParseHeadersAndBody() {
-    // split the request into headers and body
-    std::pair<std::string, std::string> headersAndBody = Header::parseHeaders(_request);
-    // store the headers
-    _headers = headersAndBody.first;
-    // store the body
-    _body = headersAndBody.second;
-}
-
-std::string Request::ExtractRequestLine() {
-    // extract the first line (the request line) from the headers
-    size_t line_end_pos = _headers.find("\r\n");
-    if (line_end_pos != std::string::npos) {
-        // return the request line
-        return _headers.substr(0, line_end_pos);
-    }
-    return std::string();
-}
-
-// parse the request line to extract the method, URL, and HTTP version
-void Request::ParseLine(const std::string &line) {
-    size_t pos = 0;
-    size_t prev = 0;
-
-    // extract the HTTP method
-    pos = line.find(" ");
-    if (pos == std::string::npos) {
-        throw std::runtime_error("Error: Invalid HTTP request line (method)");
-    }
+// take the method, URL, and HTTP version from the parsed request line
+void Request::ParseLine() {
     // save the method
-    _method = line.substr(prev, pos - prev);
-    prev = pos + 1;
+    _method = _request.method;
 
-    // extract the URL
-    pos = line.find(" ", prev);
-    if (pos == std::string::npos) {
-        throw std::runtime_error("Error: Invalid HTTP request line (URL)");
-    }
     // save the original URL
-    std::string original_url = line.substr(prev, pos - prev);
-    prev = pos + 1;
+    std::string original_url = _request.target;
 
-    // extract the HTTP version
-    _http_version = line.substr(prev);
+    // save the HTTP version
+    _http_version = _request.version;
 
     // validate HTTP version
     if (_http_version.empty() || (_http_version != "HTTP/1.1" && _http_version != "HTTP/1.0")) {
@@ -155,6 +202,24 @@ ServerConfig* Request::selectServerConfig(const std::string &host_header) {
     return &const_cast<ServerConfig&>(_configs[0]);
 }
 
+// persistent connections are the default in HTTP/1.1, HTTP/1.0 clients have to ask for them
+bool Request::ShouldKeepAlive() {
+    // keep-alive is disabled for this server block or the connection has served its share of requests
+    if (_config.keepalive_timeout <= 0 || _request_count >= static_cast<size_t>(_config.keepalive_requests)) {
+        return false;
+    }
+
+    std::string connection = _request.getHeader("connection");
+    std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    if (connection == "close") {
+        return false;
+    }
+    if (_http_version == "HTTP/1.0") {
+        return connection == "keep-alive";
+    }
+    return true;
+}
+
 // handle the flow after selecting the server config (redirection, methods, CGI)
 void Request::HandleRequest() {
     // if the URL was normalized and needs redirection, send a 301 redirect
@@ -178,16 +243,27 @@ void Request::HandleRequest() {
         return;
     }
 
-    // check if the request is for CGI
-    if (isCgiRequest(_url)) {
-        // execute CGI if applicable
-        executeCGI(_url, _method, _body);
+    // a status location reports how busy the scripts of every location are
+    if (location->cgi_status) {
+        serveCgiStatus();
+        return;
+    }
+
+    // a FastCGI location hands every request to its backend, other scripts are recognised by their extension
+    std::string upload_id;
+    if (!location->fastcgi_pass.empty() || isCgiRequest(_url)) {
+        startCgi(location);
+    } else if (location->upload_sessions && queryParam("upload", upload_id)) {
+        // ?upload addresses a resumable upload of the file instead of the file itself
+        HandleUploadSession(location);
     } else {
         // handle the different HTTP methods (GET, POST, DELETE)
         if (_method == "GET") {
             HandleGetRequest();
         } else if (_method == "POST") {
-            HandlePostRequest(_body);
+            HandlePostRequest();
+        } else if (_method == "PUT") {
+            HandlePutRequest();
         } else if (_method == "DELETE") {
             HandleDeleteRequest();
         } else {
@@ -0,0 +1,324 @@
+#include "../include/ResponseBody.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+ResponseBody &ResponseBody::operator=(ResponseBody &&src) {
+    if (this != &src) {
+        clear();
+        _chunks = std::move(src._chunks);
+        _pipe_buffer = std::move(src._pipe_buffer);
+        _pipe_offset = src._pipe_offset;
+        _buffered = src._buffered;
+        _streaming = src._streaming;
+        _stream_ended = src._stream_ended;
+        src._chunks.clear();
+        src._pipe_buffer.clear();
+        src._pipe_offset = 0;
+        src._buffered = 0;
+        src._streaming = false;
+        src._stream_ended = false;
+    }
+    return *this;
+}
+
+ResponseBody::~ResponseBody() {
+    clear();
+}
+
+void ResponseBody::addMemory(std::string data) {
+    if (data.empty()) {
+        return;
+    }
+    addMemory(std::make_shared<const std::string>(std::move(data)));
+}
+
+void ResponseBody::addMemory(std::shared_ptr<const std::string> data) {
+    if (!data || data->empty()) {
+        return;
+    }
+    _buffered += data->size();
+    Chunk chunk;
+    chunk.kind = MEMORY;
+    chunk.data = std::move(data);
+    _chunks.push_back(std::move(chunk));
+}
+
+void ResponseBody::addFile(std::shared_ptr<OpenFile> file, off_t offset, size_t length) {
+    if (!file || length == 0) {
+        return;
+    }
+    Chunk chunk;
+    chunk.kind = FILE_RANGE;
+    chunk.file = std::move(file);
+    chunk.offset = offset;
+    chunk.length = length;
+    _chunks.push_back(std::move(chunk));
+}
+
+void ResponseBody::addPipe(int fd, bool chunked) {
+    Chunk chunk;
+    chunk.kind = PIPE;
+    chunk.fd = fd;
+    chunk.chunked = chunked;
+    _chunks.push_back(std::move(chunk));
+}
+
+void ResponseBody::append(ResponseBody &&other) {
+    // only the front chunk can be partly sent, so a fresh body's chunks can be moved over as is
+    for (size_t i = 0; i < other._chunks.size(); ++i) {
+        _chunks.push_back(std::move(other._chunks[i]));
+    }
+    _buffered += other._buffered;
+    other._chunks.clear();
+    other._buffered = 0;
+}
+
+int ResponseBody::pipeFd() const {
+    if (_chunks.empty() || _chunks.front().kind != PIPE) {
+        return -1;
+    }
+    return _chunks.front().fd;
+}
+
+// feed the socket chunk by chunk until it is full, a pipe runs dry or everything is out
+ResponseBody::Status ResponseBody::writeTo(int socket_fd) {
+    while (!_chunks.empty()) {
+        Chunk &chunk = _chunks.front();
+        if (chunk.kind == MEMORY) {
+            // the memory chunks pop themselves as they complete
+            Status status = writeMemory(socket_fd);
+            if (status != DONE) {
+                return status;
+            }
+            continue;
+        }
+
+        Status status = chunk.kind == FILE_RANGE ? writeFile(socket_fd, chunk) : writePipe(socket_fd, chunk);
+        if (status != DONE) {
+            return status;
+        }
+        popFront();
+    }
+    // a streamed response continues once its producer adds more
+    if (_streaming && !_stream_ended) {
+        return WAITING;
+    }
+    _streaming = false;
+    _stream_ended = false;
+    return DONE;
+}
+
+// flush the run of memory chunks at the front with one gathered write per round until the
+// socket is full, a partly written chunk only advances its cursor
+ResponseBody::Status ResponseBody::writeMemory(int socket_fd) {
+    while (!_chunks.empty() && _chunks.front().kind == MEMORY) {
+        struct iovec iov[MAX_IOVECS];
+        size_t count = 0;
+        while (count < _chunks.size() && count < MAX_IOVECS && _chunks[count].kind == MEMORY) {
+            const Chunk &chunk = _chunks[count];
+            iov[count].iov_base = const_cast<char *>(chunk.data->data() + chunk.sent);
+            iov[count].iov_len = chunk.data->size() - chunk.sent;
+            ++count;
+        }
+
+        // sendmsg() is writev() with flags: hold back a partial packet while more of the response follows
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t bytes = sendmsg(socket_fd, &msg, count < _chunks.size() ? MSG_MORE : 0);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? BLOCKED : FAILED;
+        }
+
+        // drop the chunks that went out completely and move the cursor of the one cut short
+        size_t left = static_cast<size_t>(bytes);
+        while (left > 0) {
+            Chunk &chunk = _chunks.front();
+            size_t remaining = chunk.data->size() - chunk.sent;
+            if (left < remaining) {
+                chunk.sent += left;
+                _buffered -= left;
+                break;
+            }
+            left -= remaining;
+            popFront();
+        }
+    }
+    return DONE;
+}
+
+ResponseBody::Status ResponseBody::writeFile(int socket_fd, Chunk &chunk) {
+    while (chunk.length > 0) {
+        ssize_t bytes = sendfile(socket_fd, chunk.file->fd, &chunk.offset, chunk.length);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? BLOCKED : FAILED;
+        }
+        if (bytes == 0) {
+            // the file was truncated under us, the promised Content-Length can't be met
+            return FAILED;
+        }
+        chunk.length -= bytes;
+    }
+    return DONE;
+}
+
+// the pipe is only read again once everything read from it before has reached the socket,
+// so a fast producer is throttled by the pipe buffer instead of growing ours.
+// _pipe_buffer holds the chunk framing, or the data itself where splice() isn't possible
+ResponseBody::Status ResponseBody::writePipe(int socket_fd, Chunk &chunk) {
+    while (true) {
+        while (_pipe_offset < _pipe_buffer.size()) {
+            ssize_t bytes = send(socket_fd, _pipe_buffer.data() + _pipe_offset, _pipe_buffer.size() - _pipe_offset, MSG_MORE);
+            if (bytes < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK ? BLOCKED : FAILED;
+            }
+            _pipe_offset += bytes;
+        }
+        _pipe_buffer.clear();
+        _pipe_offset = 0;
+        if (chunk.eof) {
+            return DONE;
+        }
+
+        Status status = chunk.spliced ? splicePipe(socket_fd, chunk) : readPipe(chunk);
+        if (status != DONE) {
+            return status;
+        }
+    }
+}
+
+// move the next piece from the pipe to the socket inside the kernel. DONE means progress was made
+// (or the pipe ended), the caller flushes whatever framing that left in _pipe_buffer and comes back
+ResponseBody::Status ResponseBody::splicePipe(int socket_fd, Chunk &chunk) {
+    if (chunk.chunked && chunk.frame_left == 0) {
+        // a chunk covers what the pipe holds right now, so its size is known before any of it is moved
+        int available = 0;
+        if (ioctl(chunk.fd, FIONREAD, &available) == -1) {
+            return FAILED;
+        }
+        if (available == 0) {
+            // nothing yet, or nothing ever again: only a pipe whose writers are gone reports a hangup
+            struct pollfd state = {chunk.fd, POLLIN, 0};
+            if (poll(&state, 1, 0) == -1) {
+                return errno == EINTR ? DONE : FAILED;
+            }
+            if (state.revents & POLLIN) {
+                return DONE;
+            }
+            if (!(state.revents & POLLHUP)) {
+                return WAITING;
+            }
+            _pipe_buffer = "0\r\n\r\n";
+            chunk.eof = true;
+            return DONE;
+        }
+        char size[32];
+        _pipe_buffer.assign(size, snprintf(size, sizeof(size), "%x\r\n", available));
+        chunk.frame_left = available;
+        return DONE;
+    }
+
+    size_t wanted = chunk.chunked ? chunk.frame_left : PIPE_SPLICE_SIZE;
+    ssize_t bytes = splice(chunk.fd, NULL, socket_fd, NULL, wanted, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+    if (bytes > 0) {
+        if (chunk.chunked) {
+            chunk.frame_left -= bytes;
+            if (chunk.frame_left == 0) {
+                _pipe_buffer = "\r\n";
+            }
+        }
+        return DONE;
+    }
+    if (bytes == 0) {
+        // the writers are gone. a chunk announced in full can't come up short, the pipe holds it
+        chunk.eof = true;
+        return chunk.frame_left == 0 ? DONE : FAILED;
+    }
+    if (errno == EINTR) {
+        return DONE;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // either end may be the one that isn't ready: data in the pipe means the socket is full
+        int available = 0;
+        ioctl(chunk.fd, FIONREAD, &available);
+        return available > 0 ? BLOCKED : WAITING;
+    }
+    if (errno == EINVAL) {
+        // the socket type doesn't take spliced pages, copy through user space instead
+        chunk.spliced = false;
+        return DONE;
+    }
+    return FAILED;
+}
+
+// the copying fallback: one read into _pipe_buffer, framed as a chunk if needed
+ResponseBody::Status ResponseBody::readPipe(Chunk &chunk) {
+    // the rest of a chunk announced before splice() was refused comes first
+    size_t wanted = chunk.frame_left > 0 && chunk.frame_left < PIPE_READ_SIZE ? chunk.frame_left : PIPE_READ_SIZE;
+    _pipe_buffer.resize(wanted);
+    ssize_t bytes = read(chunk.fd, &_pipe_buffer[0], _pipe_buffer.size());
+    if (bytes < 0) {
+        _pipe_buffer.clear();
+        if (errno == EINTR) {
+            return DONE;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? WAITING : FAILED;
+    }
+    _pipe_buffer.resize(bytes);
+    if (bytes == 0) {
+        chunk.eof = true;
+        if (chunk.chunked) {
+            _pipe_buffer = "0\r\n\r\n";
+        }
+        return chunk.frame_left == 0 ? DONE : FAILED;
+    }
+    if (chunk.frame_left > 0) {
+        chunk.frame_left -= bytes;
+        if (chunk.frame_left == 0) {
+            _pipe_buffer += "\r\n";
+        }
+    } else if (chunk.chunked) {
+        char size[32];
+        _pipe_buffer.insert(0, size, snprintf(size, sizeof(size), "%zx\r\n", static_cast<size_t>(bytes)));
+        _pipe_buffer += "\r\n";
+    }
+    return DONE;
+}
+
+void ResponseBody::popFront() {
+    Chunk &chunk = _chunks.front();
+    if (chunk.kind == MEMORY) {
+        _buffered -= chunk.data->size() - chunk.sent;
+    }
+    if (chunk.kind == PIPE && chunk.fd != -1) {
+        close(chunk.fd);
+        _pipe_buffer.clear();
+        _pipe_offset = 0;
+    }
+    _chunks.pop_front();
+}
+
+void ResponseBody::clear() {
+    while (!_chunks.empty()) {
+        popFront();
+    }
+    _streaming = false;
+    _stream_ended = false;
+}
@@ -0,0 +1,206 @@
+#include "ResponseCache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+#define SKETCH_MAX_COUNT 15 // counters saturate here, like the 4-bit counters of TinyLFU
+#define SKETCH_ROWS 4
+
+size_t CachedResponse::bytes() const {
+    return headers->size() + body->size();
+}
+
+bool CachedResponse::matches(const struct stat &st) const {
+    return ino == st.st_ino && size == st.st_size
+        && mtime.tv_sec == st.st_mtim.tv_sec && mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+
+
+/* --------------------------------- *\
+|-----------FrequencySketch-----------|
+\* --------------------------------- */
+
+ResponseCache::FrequencySketch::FrequencySketch(size_t expected_entries) : _additions(0) {
+    // one row is a power of two wide so the hash can be masked
+    size_t width = 64;
+    while (width < expected_entries) {
+        width <<= 1;
+    }
+    _mask = width - 1;
+    _counters.assign(width * SKETCH_ROWS, 0);
+    // counts are halved after this many increments so old popularity fades out
+    _sample_size = width * 10;
+}
+
+size_t ResponseCache::FrequencySketch::index(uint64_t hash, int row) const {
+    static const uint64_t seeds[SKETCH_ROWS] = {
+        0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL
+    };
+    uint64_t mixed = (hash + seeds[row]) * seeds[(row + 1) % SKETCH_ROWS];
+    mixed ^= mixed >> 29;
+    return row * (_mask + 1) + (mixed & _mask);
+}
+
+void ResponseCache::FrequencySketch::increment(uint64_t hash) {
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        uint8_t &counter = _counters[index(hash, row)];
+        if (counter < SKETCH_MAX_COUNT) {
+            counter++;
+        }
+    }
+
+    // aging: halve every counter once enough requests were sampled
+    if (++_additions >= _sample_size) {
+        for (size_t i = 0; i < _counters.size(); ++i) {
+            _counters[i] >>= 1;
+        }
+        _additions /= 2;
+    }
+}
+
+uint8_t ResponseCache::FrequencySketch::frequency(uint64_t hash) const {
+    // the smallest counter has the fewest collisions
+    uint8_t frequency = SKETCH_MAX_COUNT;
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        frequency = std::min(frequency, _counters[index(hash, row)]);
+    }
+    return frequency;
+}
+
+
+
+/* ------------------------------- *\
+|-----------ResponseCache-----------|
+\* ------------------------------- */
+
+ResponseCache::ResponseCache(size_t max_size, size_t max_file_size) {
+    // enough shards to spread the lock contention, but each one must still hold a few files
+    size_t shard_count = max_size / (4 * std::max<size_t>(max_file_size, 1));
+    shard_count = std::clamp<size_t>(shard_count, 1, RESPONSE_CACHE_MAX_SHARDS);
+    size_t shard_capacity = max_size / shard_count;
+
+    // the admission window takes 1% of each shard, the rest is the main region
+    _window_capacity = std::max<size_t>(shard_capacity / 100, 1);
+    _main_capacity = shard_capacity - std::min(_window_capacity, shard_capacity);
+
+    // size the sketch for entries of a few kilobytes
+    size_t expected_entries = std::max<size_t>(shard_capacity / 4096, 64);
+    for (size_t i = 0; i < shard_count; ++i) {
+        _shards.push_back(std::make_unique<Shard>(expected_entries));
+    }
+}
+
+ResponseCache::Shard &ResponseCache::shardFor(uint64_t hash) {
+    return *_shards[(hash >> 7) % _shards.size()];
+}
+
+void ResponseCache::erase(Shard &shard, std::list<Entry>::iterator it) {
+    size_t bytes = it->response.bytes();
+    shard.index.erase(it->key);
+    if (it->region == WINDOW) {
+        shard.window_bytes -= bytes;
+        shard.window.erase(it);
+    } else {
+        shard.main_bytes -= bytes;
+        shard.main.erase(it);
+    }
+}
+
+bool ResponseCache::get(const std::string &key, const struct stat &st, CachedResponse &out) {
+    uint64_t hash = std::hash<std::string>{}(key);
+    Shard &shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // every request counts towards the popularity of the path, hit or miss
+    shard.sketch.increment(hash);
+
+    auto found = shard.index.find(key);
+    if (found == shard.index.end()) {
+        return false;
+    }
+
+    // the file changed on disk since the response was cached
+    std::list<Entry>::iterator it = found->second;
+    if (!it->response.matches(st)) {
+        erase(shard, it);
+        return false;
+    }
+
+    // mark the entry as most recently used within its region
+    std::list<Entry> &region = it->region == WINDOW ? shard.window : shard.main;
+    region.splice(region.begin(), region, it);
+
+    out = it->response;
+    return true;
+}
+
+void ResponseCache::put(const std::string &key, const CachedResponse &response) {
+    // responses that could never fit the main region are not worth keeping
+    if (response.bytes() > _main_capacity) {
+        return;
+    }
+
+    uint64_t hash = std::hash<std::string>{}(key);
+    Shard &shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // replace an outdated version of the same path
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+        erase(shard, found->second);
+    }
+
+    // new entries always start in the window
+    shard.window.push_front(Entry{key, hash, response, WINDOW});
+    shard.index[key] = shard.window.begin();
+    shard.window_bytes += response.bytes();
+
+    // entries pushed out of the window compete for a place in the main region
+    while (shard.window_bytes > _window_capacity && !shard.window.empty()) {
+        admitFromWindow(shard);
+    }
+}
+
+bool ResponseCache::admits(const std::string &key, size_t bytes) {
+    if (bytes > _main_capacity) {
+        return false;
+    }
+
+    uint64_t hash = std::hash<std::string>{}(key);
+    Shard &shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // the same test admitFromWindow() makes once the entry leaves the window: room to spare, or
+    // more popular than the victim it would evict
+    if (shard.main_bytes + bytes <= _main_capacity || shard.main.empty()) {
+        return true;
+    }
+    return shard.sketch.frequency(hash) > shard.sketch.frequency(shard.main.back().hash);
+}
+
+// the least recently used window entry either replaces main entries or is dropped
+void ResponseCache::admitFromWindow(Shard &shard) {
+    std::list<Entry>::iterator candidate = std::prev(shard.window.end());
+    size_t bytes = candidate->response.bytes();
+
+    // TinyLFU: only admit the candidate if it is more popular than the main region's victim
+    if (shard.main_bytes + bytes > _main_capacity && !shard.main.empty()) {
+        const Entry &victim = shard.main.back();
+        if (shard.sketch.frequency(candidate->hash) <= shard.sketch.frequency(victim.hash)) {
+            erase(shard, candidate);
+            return;
+        }
+    }
+
+    // make room for the candidate
+    while (shard.main_bytes + bytes > _main_capacity && !shard.main.empty()) {
+        erase(shard, std::prev(shard.main.end()));
+    }
+
+    // move it to the front of the main region
+    shard.window_bytes -= bytes;
+    shard.main_bytes += bytes;
+    candidate->region = MAIN;
+    shard.main.splice(shard.main.begin(), shard.window, candidate);
+}
@@ -0,0 +1,187 @@
+#include "../include/Request.hpp"
+
+#include <sstream>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+// a resumable upload is addressed by the URL of the file it creates plus ?upload=<id>:
+//   POST   file?upload          with Upload-Length, creates the upload, 201 with its URL in Location
+//   PATCH  file?upload=<id>     with Upload-Offset, writes the body there, parts may arrive in any order and at once
+//   GET    file?upload=<id>     the byte ranges received so far in Upload-Ranges
+//   POST   file?upload=<id>     moves the complete file into place, 409 while ranges are missing
+//   DELETE file?upload=<id>     drops the upload
+void Request::HandleUploadSession(LocationConfig* location) {
+    std::string id;
+    queryParam("upload", id);
+
+    // the URL has to name a file inside the upload directory
+    std::string target = uploadTarget(location);
+    if (target.empty()) {
+        std::cerr << "Error: upload target outside the upload directory: " << _url << std::endl;
+        ServeErrorPage(403);
+        return;
+    }
+
+    if (id.empty()) {
+        if (_method != "POST") {
+            ServeErrorPage(405);
+            return;
+        }
+        // the length has to be known up front, the file is laid out before any part arrives
+        std::string length = _request.getHeader("upload-length");
+        if (length.empty() || length.size() > 18 || length.find_first_not_of("0123456789") != std::string::npos) {
+            std::cerr << "Error: resumable upload without a valid Upload-Length" << std::endl;
+            ServeErrorPage(400);
+            return;
+        }
+        off_t size = std::stoll(length);
+        if (static_cast<size_t>(size) > location->resumable_max_size) {
+            std::cerr << "Upload too large: " << size << " bytes (Max allowed: " << location->resumable_max_size << " bytes)" << std::endl;
+            ServeErrorPage(413);
+            return;
+        }
+        // the file is created and laid out on a disk thread
+        std::shared_ptr<UploadSessions> sessions = location->upload_sessions;
+        auto session = std::make_shared<std::shared_ptr<UploadSession>>();
+        auto created = std::make_shared<std::string>();
+        offloadDisk([sessions, target, size, session, created] { *session = sessions->create(target, size, *created); }, [this, session, created] {
+            if (*session == nullptr) {
+                ServeErrorPage(500);
+                return;
+            }
+            std::string url = _url.substr(0, _url.find('?')) + "?upload=" + *created;
+            uploadSessionResponse(**session, HTTP_201, "Upload created", "Location: " + url + "\r\n");
+        });
+        return;
+    }
+
+    // an upload is only found under the URL of its own file
+    auto session = location->upload_sessions->find(id);
+    if (session == nullptr || session->path() != target) {
+        ServeErrorPage(404);
+        return;
+    }
+
+    if (_method == "GET") {
+        uploadSessionResponse(*session, HTTP_200, "Upload in progress");
+    } else if (_method == "PATCH") {
+        // the body was normally written in place while it arrived
+        if (_request.body_sink != nullptr) {
+            uploadSessionResponse(*session, HTTP_200, "Part received");
+            return;
+        }
+        // an empty body, or one read before it was known where it goes, is written now, on a disk thread
+        std::shared_ptr<BodySink> buffered;
+        {
+            std::unique_ptr<BodySink> part;
+            int status = uploadPart(location, part);
+            if (status != 0) {
+                ServeErrorPage(status);
+                return;
+            }
+            buffered = std::move(part);
+        }
+        std::shared_ptr<SpooledBody> spool = std::move(_request.spooled_body);
+        auto body = std::make_shared<std::string>(std::move(_request.body));
+        auto status = std::make_shared<int>(0);
+        offloadDisk([buffered, spool, body, status] {
+            if (spool && !spool->read(*body)) {
+                std::cerr << "Failed to read a spooled request body: " << strerror(errno) << std::endl;
+                *status = 500;
+                return;
+            }
+            *status = buffered->write(body->data(), body->size());
+            if (*status == 0)
+                *status = buffered->finish();
+        }, [this, session, status] {
+            if (*status != 0) {
+                ServeErrorPage(*status);
+                return;
+            }
+            uploadSessionResponse(*session, HTTP_200, "Part received");
+        });
+    } else if (_method == "POST") {
+        // the file is renamed into place on a disk thread
+        auto replaced = std::make_shared<bool>(false);
+        auto status = std::make_shared<int>(0);
+        offloadDisk([session, replaced, status] { *status = session->commit(*replaced); }, [this, location, id, session, replaced, status] {
+            if (*status == 409) {
+                uploadSessionResponse(*session, HTTP_409, "Upload incomplete");
+                return;
+            }
+            if (*status != 0) {
+                ServeErrorPage(*status);
+                return;
+            }
+            location->upload_sessions->remove(id);
+            // 201 for a new file, 200 if an existing one was replaced, like PUT
+            std::string message = *replaced ? "<html><body><h1>File replaced successfully!</h1></body></html>" : "<html><body><h1>File created successfully!</h1></body></html>";
+            responseHeader(message, *replaced ? HTTP_200 : HTTP_201);
+            _body.addMemory(std::move(message));
+        });
+    } else if (_method == "DELETE") {
+        // parts still being written finish into a file that is removed after them
+        session->abort();
+        location->upload_sessions->remove(id);
+        sendHtmlResponse("<html><body><h1>Upload aborted</h1></body></html>");
+    } else {
+        ServeErrorPage(405);
+    }
+}
+
+// the upload named by the query and the Upload-Offset its part starts at. a part has to fit into the
+// upload, a chunked one is held to that while it is written
+int Request::uploadPart(LocationConfig* location, std::unique_ptr<BodySink> &sink) {
+    std::string id;
+    auto session = queryParam("upload", id) && !id.empty() ? location->upload_sessions->find(id) : nullptr;
+    if (session == nullptr || session->path() != uploadTarget(location)) {
+        std::cerr << "Error: unknown upload " << id << " for " << _url << std::endl;
+        return 404;
+    }
+
+    std::string offset = _request.getHeader("upload-offset");
+    if (offset.empty() || offset.size() > 18 || offset.find_first_not_of("0123456789") != std::string::npos) {
+        std::cerr << "Error: upload part without a valid Upload-Offset" << std::endl;
+        return 400;
+    }
+    off_t start = std::stoll(offset);
+    if (start > session->length() || static_cast<off_t>(extractContentLength()) > session->length() - start) {
+        std::cerr << "Error: upload part runs past the end of " << session->path() << std::endl;
+        return 400;
+    }
+
+    // a part that can't be opened because the upload was finished meanwhile reports it from finish()
+    sink = std::make_unique<UploadPart>(session, start);
+    return 0;
+}
+
+// the state of an upload in headers a client can resume from, and as a page for a person
+void Request::uploadSessionResponse(UploadSession &session, const std::string &status_code, const std::string &message, const std::string &extra_headers) {
+    std::string ranges = session.ranges();
+    std::string headers = "Upload-Length: " + std::to_string(session.length()) + "\r\n";
+    headers += "Upload-Ranges: " + ranges + "\r\n";
+    headers += extra_headers;
+
+    std::string body = "<html><body><h1>" + message + "</h1><p>Received bytes " + (ranges.empty() ? "none" : ranges) + " of " + std::to_string(session.length()) + "</p></body></html>";
+    responseHeader(body.size(), status_code, headers);
+    _body.addMemory(std::move(body));
+}
+
+// name or name=value in the query string of the URL
+bool Request::queryParam(const std::string &name, std::string &value) {
+    size_t query = _url.find('?');
+    if (query == std::string::npos)
+        return false;
+
+    std::istringstream params(_url.substr(query + 1));
+    std::string param;
+    while (std::getline(params, param, '&')) {
+        size_t equals = param.find('=');
+        if (param.substr(0, equals) != name)
+            continue;
+        value = equals == std::string::npos ? "" : param.substr(equals + 1);
+        return true;
+    }
+    return false;
+}
@@ -1,9 +1,12 @@
 #include "Server.hpp"
 #include "Request.hpp"
-#include "Header.hpp"
 #include "Colors.hpp"
 
 #include <fcntl.h>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -20,19 +23,29 @@
 |-----------Server-----------|
 \* ------------------------ */
 
-Server::Server(const std::vector<ServerConfig> &servers) {
+Server::Server(const std::vector<ServerConfig> &servers, int worker_id, int cpu, DiskPool *disk_pool) : _worker_id(worker_id), _cgi_workers(_fastcgi), _disk_pool(disk_pool), _last_timer_run(time(NULL)) {
+    // pin this event loop to its CPU if affinity was requested
+    if (cpu >= 0) {
+        PinToCpu(cpu);
+    }
+
     // create sockets for each server block in the config and bind them to their respective ports
     CreateListeningSockets(servers);
 
     // set up the epoll instance that will handle all I/O events for the server
     EpollCreate();
 
-    // output all the addresses and ports the server is listening on
-    std::cout << YELLOW << "Server is listening on addresses:" << BLUE << std::endl;
-    for (size_t i = 0; i < _listening_sockets.size(); ++i) {
-        std::cout << _listening_sockets[i].host << ":" << _listening_sockets[i].port << std::endl;
+    // start the pre-forked CGI interpreters so the first requests don't wait for them
+    StartCgiWorkers(servers);
+
+    // output all the addresses and ports the server is listening on (once, not per worker)
+    if (_worker_id == 0) {
+        std::cout << YELLOW << "Server is listening on addresses:" << BLUE << std::endl;
+        for (size_t i = 0; i < _listening_sockets.size(); ++i) {
+            std::cout << _listening_sockets[i].host << ":" << _listening_sockets[i].port << std::endl;
+        }
+        std::cout << RESET << std::endl;
     }
-    std::cout << RESET << std::endl;
 
     // enter the main loop to wait for events and process them
     EpollWait(servers);
@@ -43,6 +56,9 @@ Server::~Server() {
     for (size_t i = 0; i < _listening_sockets.size(); ++i) {
         close(_listening_sockets[i].sock_fd);
     }
+    close(_cgi_cache_fd);
+    close(_cgi_queue_fd);
+    close(_disk_fd);
     // close the epoll file descriptor
     close(_epoll_fd);
 }
@@ -95,7 +111,8 @@ void Server::HandleDuplicateHostPort(ServerConfig &current, std::map<int, std::s
 
 // Create a socket, bind it, and add it to the listening sockets list
 void Server::CreateAndBindSocket(ServerConfig &current) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    // close-on-exec, so scripts and pre-forked interpreters don't keep the port bound after the server exits
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (sock == -1) exit(EXIT_FAILURE);
 
     int opt = 1;
@@ -104,6 +121,12 @@ void Server::CreateAndBindSocket(ServerConfig &current) {
         exit(EXIT_FAILURE);
     }
 
+    // every worker binds its own copy of the socket, the kernel balances new connections between them
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        close(sock);
+        exit(EXIT_FAILURE);
+    }
+
     SetNonBlocking(sock);
     InitializeSocketAddress(current);
 
@@ -147,11 +170,47 @@ void Server::InitializeSocketAddress(ServerConfig &current) {
 
 void Server::EpollCreate() {
     // create an epoll instance
-    _epoll_fd = epoll_create1(0);
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (_epoll_fd == -1) {
         exit(EXIT_FAILURE);
     }
 
+    // the FastCGI backend sockets are registered with this instance as they are opened
+    _fastcgi.attach(_epoll_fd);
+
+    // the CGI caches wake this worker through it when a script its requests wait for has finished
+    _cgi_cache_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _event.events = EPOLLIN;
+    _event.data.fd = _cgi_cache_fd;
+    if (_cgi_cache_fd == -1 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _cgi_cache_fd, &_event) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // and the CGI limiters when a request queued here was handed a slot
+    _cgi_queue_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _event.events = EPOLLIN;
+    _event.data.fd = _cgi_queue_fd;
+    if (_cgi_queue_fd == -1 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _cgi_queue_fd, &_event) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // and the disk threads when file system work one of its requests waits for is done
+    _disk_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _event.events = EPOLLIN;
+    _event.data.fd = _disk_fd;
+    if (_disk_fd == -1 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _disk_fd, &_event) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // watch the file cache's inotify descriptor so changed files are invalidated right away
+    if (_file_cache.getInotifyFd() != -1) {
+        _event.events = EPOLLIN;
+        _event.data.fd = _file_cache.getInotifyFd();
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _file_cache.getInotifyFd(), &_event) == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // add all listening sockets to the epoll instance to monitor for incoming connections
     for (size_t i = 0; i < _listening_sockets.size(); ++i) {
         ListeningSocket &ls = _listening_sockets[i];
@@ -168,13 +227,30 @@ void Server::EpollCreate() {
 
 
 
+// every location with a runner gets its warm interpreters in this worker
+void Server::StartCgiWorkers(const std::vector<ServerConfig> &servers) {
+    for (size_t i = 0; i < servers.size(); ++i) {
+        for (size_t j = 0; j < servers[i].locations.size(); ++j) {
+            const LocationConfig &location = servers[i].locations[j];
+            for (size_t k = 0; k < location.cgi_worker_runner.size() && k < location.cgi_path.size(); ++k) {
+                if (!location.cgi_worker_runner[k].empty()) {
+                    _cgi_workers.prepare(location.cgiWorkerConfig(k));
+                }
+            }
+        }
+    }
+}
+
+
+
 /* --------------------------- *\
 |-----------EpollWait-----------|
 \* --------------------------- */
 
 void Server::EpollWait(const std::vector<ServerConfig> &servers) {
     while (true) {
-        int nfds = epoll_wait(_epoll_fd, _events, MAX_EVENTS, -1);
+        // wake up periodically even without traffic so idle connections can be closed
+        int nfds = epoll_wait(_epoll_fd, _events, MAX_EVENTS, TIMER_INTERVAL_MS);
         if (nfds == -1) {
             if (errno == EINTR)
                 continue;  // Restart loop if interrupted by a signal
@@ -187,6 +263,9 @@ void Server::EpollWait(const std::vector<ServerConfig> &servers) {
 
             if (HandleEvent(fd, events, servers)) continue;
         }
+
+        // close idle keep-alive connections and stop CGI scripts that ran out of time
+        RunTimers(servers);
     }
 }
 
@@ -194,12 +273,62 @@ void Server::EpollWait(const std::vector<ServerConfig> &servers) {
 bool Server::HandleEvent(int fd, uint32_t events, const std::vector<ServerConfig> &servers) {
     if (HandleListeningSocket(fd)) return true;
 
-    // Handle client I/O events
+    // files under a location root changed
+    if (fd == _file_cache.getInotifyFd()) {
+        _file_cache.handleEvents();
+        return true;
+    }
+
+    // a script requests were waiting for in a CGI cache has finished
+    if (fd == _cgi_cache_fd) {
+        HandleCgiCacheEvent(servers);
+        return true;
+    }
+
+    // a script finished somewhere and its slot went to a request queued in this worker
+    if (fd == _cgi_queue_fd) {
+        HandleCgiQueueEvent(servers);
+        return true;
+    }
+
+    // a disk thread finished a stat, read, listing or delete for a request of this worker
+    if (fd == _disk_fd) {
+        HandleDiskEvent(servers);
+        return true;
+    }
+
+    // a CGI script's stdin is writable, its output is readable or it exited
+    if (_cgi_clients.count(fd)) {
+        HandleCgiEvent(fd, servers);
+        return true;
+    }
+
+    // a FastCGI backend connection is writable or has records
+    if (_fastcgi.owns(fd)) {
+        HandleFastCgiEvent(fd, events, servers);
+        return true;
+    }
+
+    // a pipe a response is streamed from has data (or hit EOF), continue writing that response
+    auto pipe = _pipe_clients.find(fd);
+    if (pipe != _pipe_clients.end()) {
+        // a script whose stdout is relayed wrote more, that keeps it alive like output read in HandleCgiEvent
+        auto it = _clients.find(pipe->second);
+        if (it != _clients.end() && it->second.cgi_request && it->second.cgi_request->getCgi()) {
+            CgiProcess &cgi = *it->second.cgi_request->getCgi();
+            cgi.deadline = time(NULL) + cgi.timeout;
+        }
+        HandleClientWrite(pipe->second, servers);
+        return true;
+    }
+
+    // Handle client I/O events. once a handler has closed the connection the rest of the event is stale,
+    // another worker may already have been handed the same descriptor number
     if (events & EPOLLIN) {
         HandleClientRead(fd, servers);
     }
-    if (events & EPOLLOUT) {
-        HandleClientWrite(fd);
+    if ((events & EPOLLOUT) && _clients.count(fd)) {
+        HandleClientWrite(fd, servers);
     }
     if (events & (EPOLLHUP | EPOLLERR)) {
         CloseClient(fd);
@@ -230,35 +359,76 @@ void Server::HandleClientRead(int client_fd, const std::vector<ServerConfig> &co
     ClientContext* client = GetClientContext(client_fd);
     if (!client) return;
 
+    // nothing more is read from a connection that is only waiting to be closed
+    if (client->lingering) {
+        DrainLingeringClient(client_fd);
+        return;
+    }
+
     // Read incoming data from the client into the read buffer
-    if (!ReadClientData(client_fd, client)) return;
+    if (!ReadClientData(client_fd, client, configs)) return;
+    client->last_activity = time(NULL);
+
+    // a request arriving while the previous response is still being produced or sent waits its turn
+    if (!client->response.empty() || client->cgi_request)
+        return;
 
     // Check if the full request has been received (headers and body)
-    if (IsFullRequestReceived(*client)) {
+    if (IsFullRequestReceived(*client, configs)) {
         // Process the request and prepare the response
-        ProcessClientRequest(client_fd, client, configs);
+        if (!ProcessClientRequest(client_fd, client, configs))
+            return;
+        // write right away, most responses fit into the socket buffer without waiting for EPOLLOUT
+        HandleClientWrite(client_fd, configs);
     }
 }
 
-// Helper function to find and return the client context
+// Helper function to find and return the client context. an event for a descriptor that isn't a
+// client (anymore), like a CGI pipe closed earlier in the same batch, is ignored
 ClientContext* Server::GetClientContext(int client_fd) {
     auto it = _clients.find(client_fd);
     if (it == _clients.end()) {
-        CloseClient(client_fd);  // Close connection if client not found
         return nullptr;
     }
     return &it->second;  // Return the client context
 }
 
 // Helper function to read incoming data from the client
-bool Server::ReadClientData(int client_fd, ClientContext* client) {
+bool Server::ReadClientData(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs) {
     char buffer[4096];
     while (true) {
+        // a request refused before all of it was read is answered right away, the rest of it is never buffered
+        // and the connection is closed after the error
+        if (client->parser.getState() == HttpParser::ERROR)
+            break;
+        // the body stays in the socket until the files it goes to exist, ResumeBody reads on from there
+        if (client->body_job)
+            break;
+
+        // an upload written to a file is moved there straight from the socket, it never passes through the read buffer
+        if (client->parser.canSplice(client->read_buffer)) {
+            ssize_t bytes_moved = client->parser.spliceBody(client_fd);
+            if (bytes_moved == 0) {
+                CloseClient(client_fd);
+                return false;
+            }
+            if (bytes_moved < 0 && errno != EINTR)
+                break;
+            // the pipe is emptied into the file before more is taken from the socket
+            FlushBody(*client);
+            continue;
+        }
+
         ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer));
         
         if (bytes_read > 0) {
             // Append data to the client's read buffer
             client->read_buffer.append(buffer, bytes_read);
+            // headers are parsed as they arrive so an upload's sink is known before its body piles up in the buffer,
+            // a body being spooled is moved to its file as it comes in, a fast client can't fill memory with it
+            if ((client->parser.readingHeaders() || client->read_buffer.size() >= READ_SPOOL_INTERVAL) && client->response.empty() && !client->cgi_request) {
+                IsFullRequestReceived(*client, configs);
+            }
         } else if (bytes_read == 0) {
             // Client closed the connection
             CloseClient(client_fd);
@@ -272,13 +442,117 @@ bool Server::ReadClientData(int client_fd, ClientContext* client) {
 }
 
 // Helper function to check if the full request has been received (headers and body)
-bool Server::IsFullRequestReceived(const ClientContext &client) {
-    size_t header_end_pos = client.read_buffer.find("\r\n\r\n");
-    if (header_end_pos != std::string::npos) {
-        size_t content_length = Header::getContentLength(client.read_buffer);
-        return client.read_buffer.size() >= header_end_pos + 4 + content_length;
+bool Server::IsFullRequestReceived(ClientContext &client, const std::vector<ServerConfig> &configs) {
+    if (client.body_job)
+        return false;
+    // the parser resumes where the previous read left off, so earlier bytes are never scanned again
+    HttpParser::State state = client.parser.parse(client.read_buffer);
+    if (state == HttpParser::HEADERS_DONE) {
+        // the headers are in but none of the body has been taken yet: a body the request is refused for is
+        // never read, and an upload can be written out as it arrives
+        ListeningSocket* matched_socket = FindListeningSocket(client.listening_socket_fd);
+        BodyRoute route;
+        if (matched_socket) {
+            route = Request::routeBody(configs, matched_socket->port, client.parser.getRequest());
+        }
+        if (route.status != 0) {
+            client.parser.rejectBody(route.status);
+            return true;
+        }
+        if (OpenBodySink(client, route)) {
+            return false;
+        }
+        StartBody(client, route);
+        state = client.parser.parse(client.read_buffer);
+    }
+    // the request is only complete once all of its upload is on disk
+    if (FlushBody(client))
+        return false;
+    state = client.parser.getState();
+    // a malformed request is also "received", it is answered with 400 Bad Request
+    return state == HttpParser::COMPLETE || state == HttpParser::ERROR;
+}
+
+// an upload's directories and files are created on a disk thread before its body is read. true while that
+// runs, the route is kept with the client until ResumeBody. without a free disk thread it is done right here
+bool Server::OpenBodySink(ClientContext &client, BodyRoute &route) {
+    if (!route.open_sink) {
+        return false;
+    }
+    route.open_sink = false;
+    auto pending = std::make_shared<BodyRoute>(std::move(route));
+    // the route goes with the job, the connection may be closed before it is done
+    client.body_job = _disk_pool ? _disk_pool->submit([pending] { pending->sink->open(); }, _disk_fd) : nullptr;
+    if (client.body_job) {
+        client.body_route = pending;
+        _disk_waiting.insert(client.fd);
+        return true;
+    }
+    route = std::move(*pending);
+    route.sink->open();
+    return false;
+}
+
+// from here on the body is read into the route's sink, the client is told to send it if it waits for that.
+// the sink only gets what was read on a disk thread, through FlushBody
+void Server::StartBody(ClientContext &client, BodyRoute &route) {
+    if (route.send_continue) {
+        SendContinue(client);
+    }
+    std::unique_ptr<BodySink> sink;
+    if (route.sink) {
+        sink = std::make_unique<QueuedSink>(std::move(route.sink), _disk_pool, _disk_fd);
+    }
+    client.parser.startBody(std::move(sink), route.max_size);
+}
+
+// what the parser gave the upload's sink since the last flush is written out on a disk thread. true while
+// that runs, the rest of the body is left in the socket until ResumeBody. without a free disk thread it is
+// written right here
+bool Server::FlushBody(ClientContext &client) {
+    QueuedSink *sink = static_cast<QueuedSink *>(client.parser.getRequest().body_sink.get());
+    if (sink == nullptr || !sink->pending()) {
+        return false;
+    }
+    client.body_job = sink->flush();
+    if (client.body_job) {
+        _disk_waiting.insert(client.fd);
+        return true;
+    }
+    BodyFlushed(client);
+    return false;
+}
+
+// a file that couldn't be written, or a body the sink found malformed, fails the request like it would
+// have while it was read
+void Server::BodyFlushed(ClientContext &client) {
+    QueuedSink *sink = static_cast<QueuedSink *>(client.parser.getRequest().body_sink.get());
+    if (sink != nullptr && sink->status() != 0) {
+        client.parser.rejectBody(sink->status());
+    }
+}
+
+// the files of the upload exist, or what was read of its body is written, the body that waited in the socket is read now
+void Server::ResumeBody(int client_fd, ClientContext &client, const std::vector<ServerConfig> &configs) {
+    std::shared_ptr<BodyRoute> route = std::move(client.body_route);
+    client.body_job.reset();
+    if (route) {
+        StartBody(client, *route);
+    } else {
+        BodyFlushed(client);
+    }
+    HandleClientRead(client_fd, configs);
+}
+
+// the interim response a client sending Expect: 100-continue waits for. nothing else is being written
+// on the connection while a request is read, so it goes straight into the empty socket buffer
+void Server::SendContinue(ClientContext &client) {
+    static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    ssize_t sent = send(client.fd, interim, sizeof(interim) - 1, MSG_NOSIGNAL);
+    if (sent != static_cast<ssize_t>(sizeof(interim) - 1)) {
+        // the client sends the body anyway once it is tired of waiting
+        std::cerr << "Failed to send 100 Continue to client " << client.fd << std::endl;
     }
-    return false;  // Full request not received yet
 }
 
 ListeningSocket* Server::FindListeningSocket(int listening_socket_fd) {
@@ -291,32 +565,68 @@ ListeningSocket* Server::FindListeningSocket(int listening_socket_fd) {
     return nullptr;
 }
 
-// Helper function to process the client's request and prepare the response
-void Server::ProcessClientRequest(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs) {
+// Helper function to process the client's request and prepare the response.
+// returns false if the connection was closed instead
+bool Server::ProcessClientRequest(int client_fd, ClientContext* client, const std::vector<ServerConfig> &configs) {
     ListeningSocket* matched_socket = FindListeningSocket(client->listening_socket_fd);
     if (!matched_socket) {
         // if no matching socket is found, close the connection
         CloseClient(client_fd);
-        return;
+        return false;
     }
 
     // get the correct port associated with the socket
     int port = matched_socket->port;
-    // create request object with config and port
-    Request request(configs, client->read_buffer, port);
-    // parse the request headers and body
-    request.ParseRequest();
+    // a pipelined request behind this one stays in the buffer, nothing is kept after a malformed one
+    if (client->parser.getState() == HttpParser::ERROR) {
+        client->read_buffer.clear();
+        client->linger = true;
+    } else {
+        client->read_buffer.erase(0, client->parser.getRequestLength());
+    }
 
-    // store the response in the write buffer for the client
-    client->write_buffer = request.getResponse();
+    // create request object from the parsed request with config and port
+    std::unique_ptr<Request> request = std::make_unique<Request>(configs, client->parser.takeRequest(), port, client->requests_served + 1, &_file_cache, _cgi_cache_fd, _cgi_queue_fd, _disk_pool, _disk_fd);
+    client->parser.reset();
+    // handle the request and build the response
+    request->ParseRequest();
 
-    // modify the epoll event to wait for the socket to be ready to write the response
-    _event.events = EPOLLOUT | EPOLLET;
-    _event.data.fd = client_fd;
-    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client_fd, &_event) == -1) {
-        // if epoll modification fails, close the connection
-        CloseClient(client_fd);
+    // remember whether the connection is reused once the response has been written
+    client->keep_alive = request->keepAlive();
+    client->keepalive_timeout = request->getKeepAliveTimeout();
+
+    return StartResponse(client_fd, *client, std::move(request));
+}
+
+// hand the request's response to the connection, or park the request while it is produced.
+// returns false if the connection was closed instead
+bool Server::StartResponse(int client_fd, ClientContext &client, std::unique_ptr<Request> request) {
+    // the same script is running for another request, this one is looked up again once it is done.
+    // a request over its location's CGI limit waits here for a slot the same way, and one whose
+    // files are being read or written on a disk thread for that to finish
+    if (request->cgiCacheWaiting() || request->cgiQueued() || request->diskWaiting()) {
+        // the events only visit the requests parked for them
+        if (request->cgiCacheWaiting())
+            _cgi_cache_waiting.insert(client_fd);
+        if (request->cgiQueued())
+            _cgi_queued.insert(client_fd);
+        if (request->diskWaiting())
+            _disk_waiting.insert(client_fd);
+        client.cgi_request = std::move(request);
+        return true;
+    }
+    // a CGI script keeps running inside the event loop, its response is streamed as it writes
+    if (request->getCgi()) {
+        return StartCgi(client_fd, client, std::move(request));
     }
+    // a FastCGI response is streamed into the connection as the backend sends it
+    if (request->getFastCgi()) {
+        return StartFastCgi(client_fd, client, std::move(request));
+    }
+
+    // take over the headers and the body, file regions and pipes are only read while sending
+    client.response = request->releaseResponse();
+    return true;
 }
 
 
@@ -325,30 +635,637 @@ void Server::ProcessClientRequest(int client_fd, ClientContext* client, const st
 |-----------ClientWrite-----------|
 \* ----------------------------- */
 
-void Server::HandleClientWrite(int client_fd) {
-    // find the client context by file descriptor
+void Server::HandleClientWrite(int client_fd, const std::vector<ServerConfig> &configs) {
+    // find the client context by file descriptor, the connection may have been closed already
     auto it = _clients.find(client_fd);
     if (it == _clients.end()) {
-        CloseClient(client_fd);
         return;
     }
     ClientContext &client = it->second;
 
-    // if there's nothing to write, return
-    if (client.write_buffer.empty())
+    // keep going while the socket takes everything, pipelined requests are answered in the same pass
+    while (!client.response.empty()) {
+        // send as much of the response as the socket takes, the sources are only read as it drains
+        ResponseBody::Status status = client.response.writeTo(client_fd);
+        WatchResponsePipe(client_fd, client, status);
+
+        // the client caught up, let its FastCGI backend send more
+        if (client.cgi_request && client.response.bufferedBytes() < CGI_MAX_BUFFERED / 2) {
+            ResumeFastCgi(client_fd, client);
+        }
+
+        if (status == ResponseBody::FAILED) {
+            // the client went away or a source broke, the response can't be completed
+            CloseClient(client_fd);
+            return;
+        }
+        if (status == ResponseBody::BLOCKED) {
+            // the socket is full, continue on the next EPOLLOUT
+            SetClientEvents(client_fd, client, EPOLLOUT | EPOLLET);
+            return;
+        }
+        if (status == ResponseBody::WAITING) {
+            // a pipe is empty or the backend hasn't sent more yet, continue when it has
+            return;
+        }
+
+        // once the response is sent, either wait for the next request or close the connection
+        if (!client.keep_alive) {
+            if (client.linger) {
+                LingerClient(client_fd, client);
+            } else {
+                CloseClient(client_fd);
+            }
+            return;
+        }
+        ResetClientForNextRequest(client);
+
+        // a pipelined request may already be waiting in the read buffer
+        if (!IsFullRequestReceived(client, configs)) {
+            // switch the socket back to waiting for readable data
+            SetClientEvents(client_fd, client, EPOLLIN | EPOLLET);
+            return;
+        }
+        if (!ProcessClientRequest(client_fd, &client, configs))
+            return;
+    }
+}
+
+// change what epoll reports for a client socket, skipping the syscall if nothing changes.
+// returns false if the connection was closed instead
+bool Server::SetClientEvents(int client_fd, ClientContext &client, uint32_t events) {
+    if (client.epoll_events == events) {
+        return true;
+    }
+
+    _event.events = events;
+    _event.data.fd = client_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client_fd, &_event) == -1) {
+        CloseClient(client_fd);
+        return false;
+    }
+    client.epoll_events = events;
+    return true;
+}
+
+// a response waiting for its pipe gets the pipe registered in epoll, any other state unregisters it,
+// so a pipe with data isn't reported over and over while the socket is still full
+void Server::WatchResponsePipe(int client_fd, ClientContext &client, ResponseBody::Status status) {
+    int pipe_fd = status == ResponseBody::WAITING ? client.response.pipeFd() : -1;
+    if (pipe_fd == client.watched_pipe_fd) {
+        return;
+    }
+
+    UnwatchResponsePipe(client);
+    if (pipe_fd == -1) {
         return;
+    }
+
+    _event.events = EPOLLIN;
+    _event.data.fd = pipe_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, pipe_fd, &_event) == -1) {
+        CloseClient(client_fd);
+        return;
+    }
+    _pipe_clients[pipe_fd] = client_fd;
+    client.watched_pipe_fd = pipe_fd;
+}
+
+void Server::UnwatchResponsePipe(ClientContext &client) {
+    if (client.watched_pipe_fd == -1) {
+        return;
+    }
+    // a pipe that reached EOF was already closed by the body, which also removed it from epoll
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, client.watched_pipe_fd, NULL);
+    _pipe_clients.erase(client.watched_pipe_fd);
+    client.watched_pipe_fd = -1;
+}
+
+
 
-    // write the response to the client
-    ssize_t bytes_written = write(client_fd, client.write_buffer.c_str(), client.write_buffer.size());
+/* --------------------- *\
+|-----------Cgi-----------|
+\* --------------------- */
 
-    if (bytes_written > 0) {
-        // remove the written part from the buffer
-        client.write_buffer.erase(0, bytes_written);
+// park the request on its connection and let epoll drive the script's pipes and exit.
+// returns false if the connection was closed instead
+bool Server::StartCgi(int client_fd, ClientContext &client, std::unique_ptr<Request> request) {
+    CgiProcess &cgi = *request->getCgi();
+    client.cgi_request = std::move(request);
+    client.response.beginStream();
+
+    // a body-less request gets EOF on stdin right away
+    if (cgi.input.empty()) {
+        cgi.closeFd(cgi.stdin_fd);
     }
 
-    // if the write buffer is empty, close the connection
-    if (client.write_buffer.empty()) {
+    if ((cgi.stdin_fd != -1 && !WatchCgiFd(client_fd, cgi.stdin_fd, EPOLLOUT))
+        || !WatchCgiFd(client_fd, cgi.stdout_fd, EPOLLIN)
+        || !WatchCgiFd(client_fd, cgi.stderr_fd, EPOLLIN)
+        || (cgi.pidfd != -1 && !WatchCgiFd(client_fd, cgi.pidfd, EPOLLIN))) {
         CloseClient(client_fd);
+        return false;
+    }
+    return true;
+}
+
+// the CGI descriptors are level-triggered, each event handles what is there and waits for more
+bool Server::WatchCgiFd(int client_fd, int fd, uint32_t events) {
+    _event.events = events;
+    _event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &_event) == -1) {
+        return false;
+    }
+    _cgi_clients[fd] = client_fd;
+    return true;
+}
+
+void Server::CloseCgiFd(int &fd) {
+    if (fd == -1) {
+        return;
+    }
+    // removed from epoll before it is closed, a forked child may still hold a copy for a moment
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    _cgi_clients.erase(fd);
+    close(fd);
+    fd = -1;
+}
+
+void Server::CloseCgiFds(CgiProcess &cgi) {
+    CloseCgiFd(cgi.stdin_fd);
+    CloseCgiFd(cgi.stdout_fd);
+    CloseCgiFd(cgi.stderr_fd);
+    CloseCgiFd(cgi.pidfd);
+}
+
+void Server::HandleCgiEvent(int fd, const std::vector<ServerConfig> &configs) {
+    int client_fd = _cgi_clients[fd];
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end() || !it->second.cgi_request) {
+        CloseCgiFd(fd);
+        return;
+    }
+    ClientContext &client = it->second;
+    Request &request = *client.cgi_request;
+    CgiProcess &cgi = *request.getCgi();
+    bool output = false;
+
+    if (fd == cgi.stdin_fd) {
+        // feed the request body as fast as the script reads it
+        if (!cgi.writeInput())
+            CloseCgiFd(cgi.stdin_fd);
+    } else if (fd == cgi.stdout_fd) {
+        std::string data;
+        bool open = cgi.readOutput(fd, data);
+        if (!data.empty()) {
+            // a script streaming a long response is only timed out once it goes silent
+            cgi.deadline = time(NULL) + cgi.timeout;
+            // headers that aren't CGI headers get a 502 while there is still time for one
+            if (!request.appendCgiOutput(std::move(data))) {
+                FinishCgi(client_fd, client, configs, 502);
+                return;
+            }
+            // from the end of the header block on, the pipe is the response's and is read as the socket drains.
+            // a response going into the CGI cache is read here until it is complete or too large to keep
+            // the output of a response without a body is read and dropped instead
+            if (request.cgiResponseStarted() && !request.cgiCacheFilling() && !request.cgiBodiless()) {
+                RelayCgiOutput(request, cgi);
+            }
+            client.response.append(request.releaseResponse());
+            output = true;
+        }
+        if (!open)
+            CloseCgiFd(cgi.stdout_fd);
+    } else if (fd == cgi.stderr_fd) {
+        std::string data;
+        bool open = cgi.readOutput(fd, data);
+        request.appendCgiErrors(data);
+        if (!open)
+            CloseCgiFd(cgi.stderr_fd);
+    } else if (fd == cgi.pidfd) {
+        // the child exited
+        if (cgi.reap())
+            CloseCgiFd(cgi.pidfd);
+    }
+
+    // most scripts exit right after closing their output, so try to collect them without waiting for the pidfd
+    if (cgi.stdout_fd == -1 && cgi.stderr_fd == -1) {
+        cgi.reap();
+    }
+
+    if (cgi.finished()) {
+        FinishCgi(client_fd, client, configs, 0);
+    } else if (output) {
+        HandleClientWrite(client_fd, configs);
+    }
+}
+
+// hand stdout over to the response, which splices it to the socket. the pipe stays open when the script
+// exits, what it wrote last is still sent, and a slow client throttles the script through the pipe buffer
+void Server::RelayCgiOutput(Request &request, CgiProcess &cgi) {
+    int pipe_fd = cgi.stdout_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, pipe_fd, NULL);
+    _cgi_clients.erase(pipe_fd);
+    cgi.stdout_fd = -1;
+    request.relayCgiOutput(pipe_fd);
+}
+
+// end the streamed response: complete, or replaced by an error page if error_code is set.
+// once the headers are out an error can only be signalled by cutting the connection
+void Server::FinishCgi(int client_fd, ClientContext &client, const std::vector<ServerConfig> &configs, int error_code) {
+    Request &request = *client.cgi_request;
+    CloseCgiFds(*request.getCgi());
+    // a script that exits without a header block is as broken as one sending bad headers
+    if (error_code == 0 && !request.finishCgiResponse()) {
+        error_code = 502;
+    }
+    if (error_code != 0) {
+        if (request.cgiResponseStarted()) {
+            CloseClient(client_fd);
+            return;
+        }
+        request.failCgi(error_code, error_code == 504 ? "script timed out" : "script sent no valid CGI response");
+        // a custom error page that isn't open yet is opened on a disk thread, HandleDiskEvent sends it
+        if (request.diskWaiting()) {
+            _disk_waiting.insert(client_fd);
+            client.response.clear();
+            return;
+        }
+    }
+    client.response.append(request.releaseResponse());
+    client.response.endStream();
+    // a body without a length on HTTP/1.0 ends with the connection
+    client.keep_alive = request.keepAlive();
+    client.cgi_request.reset();
+    client.last_activity = time(NULL);
+
+    HandleClientWrite(client_fd, configs);
+}
+
+// kill scripts past their deadline, and collect finished ones when there is no pidfd to report their exit
+void Server::CheckCgiProcesses(time_t now, const std::vector<ServerConfig> &configs) {
+    std::vector<int> expired_fds;
+    std::vector<int> finished_fds;
+    for (auto it = _clients.begin(); it != _clients.end(); ++it) {
+        // a request waiting in the CGI cache or queue, or for the disk, has no script running yet
+        if (!it->second.cgi_request || it->second.cgi_request->cgiCacheWaiting() || it->second.cgi_request->cgiQueued() || it->second.cgi_request->diskWaiting()) {
+            continue;
+        }
+        if (FastCgiRequest *fastcgi = it->second.cgi_request->getFastCgi()) {
+            // a backend paused for a slow client isn't silent by its own doing
+            if (now >= fastcgi->deadline && !_fastcgi.isPaused(it->first)) {
+                expired_fds.push_back(it->first);
+            }
+            continue;
+        }
+        CgiProcess &cgi = *it->second.cgi_request->getCgi();
+        if (cgi.stdout_fd == -1 && cgi.stderr_fd == -1 && cgi.reap()) {
+            finished_fds.push_back(it->first);
+        } else if (now >= cgi.deadline) {
+            expired_fds.push_back(it->first);
+        }
+    }
+
+    // finishing a request may close its connection, so the map is only touched after the scan
+    for (size_t i = 0; i < finished_fds.size(); ++i) {
+        auto it = _clients.find(finished_fds[i]);
+        if (it != _clients.end() && it->second.cgi_request) {
+            FinishCgi(finished_fds[i], it->second, configs, 0);
+        }
+    }
+    for (size_t i = 0; i < expired_fds.size(); ++i) {
+        auto it = _clients.find(expired_fds[i]);
+        if (it == _clients.end() || !it->second.cgi_request) {
+            continue;
+        }
+        if (it->second.cgi_request->getFastCgi()) {
+            FinishFastCgi(expired_fds[i], it->second, 504);
+            HandleClientWrite(expired_fds[i], configs);
+        } else {
+            FinishCgi(expired_fds[i], it->second, configs, 504);
+        }
+    }
+}
+
+
+
+/* ------------------------- *\
+|-----------FastCgi-----------|
+\* ------------------------- */
+
+// send the request to the backend and park it on its connection, the response streams in as records arrive.
+// returns false if the connection was closed instead
+bool Server::StartFastCgi(int client_fd, ClientContext &client, std::unique_ptr<Request> request) {
+    FastCgiRequest &fastcgi = *request->getFastCgi();
+    // a script for the pre-forked interpreters may have to wait for one of them, the pool keeps the request until then
+    bool submitted = fastcgi.worker.runner.empty()
+        ? _fastcgi.submit(fastcgi.address, client_fd, fastcgi.params, fastcgi.stdin_data)
+        : _cgi_workers.submit(fastcgi.worker, client_fd, std::move(fastcgi.params), std::move(fastcgi.stdin_data));
+    if (!submitted) {
+        // nothing listens at the address or no interpreter could be started, answered like any other response
+        request->failCgi(502, fastcgi.worker.runner.empty() ? "FastCGI backend unreachable" : "no CGI worker could be started");
+        return StartResponse(client_fd, client, std::move(request));
+    }
+    // the pool queued its own copy of the body
+    fastcgi.stdin_data.clear();
+
+    client.cgi_request = std::move(request);
+    client.response.beginStream();
+    return true;
+}
+
+void Server::HandleFastCgiEvent(int fd, uint32_t events, const std::vector<ServerConfig> &configs) {
+    std::vector<FastCgiPool::Event> results;
+    _fastcgi.handleEvent(fd, events, results);
+
+    // one socket carries several requests when the backend multiplexes, each client is written once at the end
+    std::vector<int> touched;
+    for (size_t i = 0; i < results.size(); ++i) {
+        FastCgiPool::Event &event = results[i];
+        auto it = _clients.find(event.client_fd);
+        if (it == _clients.end() || !it->second.cgi_request || !it->second.cgi_request->getFastCgi()) {
+            continue;
+        }
+        ClientContext &client = it->second;
+        Request &request = *client.cgi_request;
+
+        if (event.type == FastCgiPool::Event::STDERR) {
+            // logged, the response isn't affected
+            request.appendCgiErrors(event.data);
+            continue;
+        }
+
+        if (event.type == FastCgiPool::Event::STDOUT) {
+            if (!request.appendCgiOutput(std::move(event.data))) {
+                FinishFastCgi(event.client_fd, client, 502);
+            } else {
+                FastCgiRequest &fastcgi = *request.getFastCgi();
+                fastcgi.deadline = time(NULL) + fastcgi.timeout;
+                client.response.append(request.releaseResponse());
+                // the client reads slower than the backend writes, stop reading the backend for now
+                if (client.response.bufferedBytes() > CGI_MAX_BUFFERED) {
+                    _fastcgi.pause(event.client_fd);
+                }
+            }
+        } else if (event.type == FastCgiPool::Event::END) {
+            FinishFastCgi(event.client_fd, client, request.finishCgiResponse() ? 0 : 502);
+        } else {
+            FinishFastCgi(event.client_fd, client, 502);
+        }
+        touched.push_back(event.client_fd);
+    }
+
+    for (size_t i = 0; i < touched.size(); ++i) {
+        if (_clients.count(touched[i])) {
+            HandleClientWrite(touched[i], configs);
+        }
+    }
+}
+
+// end the streamed response: complete, or replaced by an error page if error_code is set.
+// once the headers are out an error can only be signalled by cutting the connection
+void Server::FinishFastCgi(int client_fd, ClientContext &client, int error_code) {
+    if (error_code != 0) {
+        _fastcgi.abort(client_fd);
+        _cgi_workers.cancel(client_fd);
+        if (client.cgi_request->cgiResponseStarted()) {
+            CloseClient(client_fd);
+            return;
+        }
+        client.cgi_request->failCgi(error_code, error_code == 504 ? "FastCGI backend timed out" : "FastCGI backend failed");
+    }
+    // a pre-forked interpreter is free for the next script
+    _cgi_workers.finished(client_fd);
+    // a custom error page that isn't open yet is opened on a disk thread, HandleDiskEvent sends it
+    if (client.cgi_request->diskWaiting()) {
+        _disk_waiting.insert(client_fd);
+        client.response.clear();
+        return;
+    }
+    client.response.append(client.cgi_request->releaseResponse());
+    client.response.endStream();
+    // a body without a length on HTTP/1.0 ends with the connection
+    client.keep_alive = client.cgi_request->keepAlive();
+    client.cgi_request.reset();
+    client.last_activity = time(NULL);
+}
+
+void Server::ResumeFastCgi(int client_fd, ClientContext &client) {
+    FastCgiRequest *fastcgi = client.cgi_request->getFastCgi();
+    if (fastcgi != NULL && _fastcgi.isPaused(client_fd)) {
+        _fastcgi.resume(client_fd);
+        // its silence is counted from here, not from when it was paused
+        fastcgi->deadline = time(NULL) + fastcgi->timeout;
+    }
+}
+
+
+
+/* -------------------------- *\
+|-----------CgiCache-----------|
+\* -------------------------- */
+
+// each request of this worker that was waiting in a CGI cache looks its entry up again: it is answered
+// from the cache, claims the key and runs the script, or keeps waiting if another request got there first
+void Server::HandleCgiCacheEvent(const std::vector<ServerConfig> &configs) {
+    uint64_t count;
+    if (read(_cgi_cache_fd, &count, sizeof(count)) == -1) {
+        return;
+    }
+
+    // only the clients parked on a CGI cache look again, those that still have to wait are parked anew
+    std::vector<int> waiting(_cgi_cache_waiting.begin(), _cgi_cache_waiting.end());
+    _cgi_cache_waiting.clear();
+    // starting a script may close a connection, so the map is only touched after the scan
+    for (size_t i = 0; i < waiting.size(); ++i) {
+        auto it = _clients.find(waiting[i]);
+        if (it == _clients.end() || !it->second.cgi_request || !it->second.cgi_request->cgiCacheWaiting()) {
+            continue;
+        }
+        std::unique_ptr<Request> request = std::move(it->second.cgi_request);
+        request->resumeCgiCache();
+        if (StartResponse(waiting[i], it->second, std::move(request))) {
+            HandleClientWrite(waiting[i], configs);
+        }
+    }
+}
+
+
+
+/* -------------------------- *\
+|-----------CgiQueue-----------|
+\* -------------------------- */
+
+// the requests of this worker queued for a CGI slot check whether it was theirs, the others keep waiting
+void Server::HandleCgiQueueEvent(const std::vector<ServerConfig> &configs) {
+    uint64_t count;
+    if (read(_cgi_queue_fd, &count, sizeof(count)) == -1) {
+        return;
+    }
+
+    // only the queued clients check, those that weren't handed a slot are parked anew
+    std::vector<int> queued(_cgi_queued.begin(), _cgi_queued.end());
+    _cgi_queued.clear();
+    // starting a script may close a connection, so the map is only touched after the scan
+    for (size_t i = 0; i < queued.size(); ++i) {
+        auto it = _clients.find(queued[i]);
+        if (it == _clients.end() || !it->second.cgi_request || !it->second.cgi_request->cgiQueued()) {
+            continue;
+        }
+        std::unique_ptr<Request> request = std::move(it->second.cgi_request);
+        request->resumeCgiQueue();
+        if (StartResponse(queued[i], it->second, std::move(request))) {
+            HandleClientWrite(queued[i], configs);
+        }
+    }
+}
+
+// requests that waited longer than their location's cgi_queue_timeout get a 503
+void Server::ExpireCgiQueue(time_t now, const std::vector<ServerConfig> &configs) {
+    std::vector<int> expired;
+    for (auto it = _cgi_queued.begin(); it != _cgi_queued.end();) {
+        auto client = _clients.find(*it);
+        if (client == _clients.end() || !client->second.cgi_request || !client->second.cgi_request->cgiQueued()) {
+            it = _cgi_queued.erase(it);
+        } else if (now >= client->second.cgi_request->cgiQueueDeadline()) {
+            expired.push_back(*it);
+            it = _cgi_queued.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        auto it = _clients.find(expired[i]);
+        if (it == _clients.end() || !it->second.cgi_request) {
+            continue;
+        }
+        std::unique_ptr<Request> request = std::move(it->second.cgi_request);
+        request->expireCgiQueue();
+        if (StartResponse(expired[i], it->second, std::move(request))) {
+            HandleClientWrite(expired[i], configs);
+        }
+    }
+}
+
+
+
+/* ------------------------ *\
+|-----------DiskIO-----------|
+\* ------------------------ */
+
+// the requests of this worker whose disk job is done continue their response, the others keep waiting.
+// a continuation may hand the next step of its request to the disk threads again
+void Server::HandleDiskEvent(const std::vector<ServerConfig> &configs) {
+    uint64_t count;
+    if (read(_disk_fd, &count, sizeof(count)) == -1) {
+        return;
+    }
+
+    // only the clients that handed work to the disk threads are looked at, those still waiting stay in the set
+    std::vector<int> done;
+    for (auto it = _disk_waiting.begin(); it != _disk_waiting.end();) {
+        auto client = _clients.find(*it);
+        if (client == _clients.end()) {
+            it = _disk_waiting.erase(it);
+        } else if ((client->second.cgi_request && client->second.cgi_request->diskDone()) || (client->second.body_job && client->second.body_job->done.load(std::memory_order_acquire))) {
+            done.push_back(*it);
+            it = _disk_waiting.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // writing a response may close a connection or park the request for its next job, so the set and the
+    // map are only touched after the scan
+    for (size_t i = 0; i < done.size(); ++i) {
+        auto it = _clients.find(done[i]);
+        if (it == _clients.end()) {
+            continue;
+        }
+        // an upload whose files were created reads its body
+        if (it->second.body_job) {
+            ResumeBody(done[i], it->second, configs);
+            continue;
+        }
+        if (!it->second.cgi_request) {
+            continue;
+        }
+        std::unique_ptr<Request> request = std::move(it->second.cgi_request);
+        request->resumeDisk();
+        if (StartResponse(done[i], it->second, std::move(request))) {
+            HandleClientWrite(done[i], configs);
+        }
+    }
+}
+
+
+
+/* --------------------------------------- *\
+|-----------PersistentConnections-----------|
+\* --------------------------------------- */
+
+// prepare a keep-alive connection to read its next request
+void Server::ResetClientForNextRequest(ClientContext &client) {
+    client.requests_served++;
+    client.keep_alive = false;
+    client.response.clear();
+    client.last_activity = time(NULL);
+}
+
+// the client may still be sending the request that was refused. closing the socket with unread data resets
+// the connection, and the reset can destroy the error response before the client has read it
+void Server::LingerClient(int client_fd, ClientContext &client) {
+    shutdown(client_fd, SHUT_WR);
+    client.lingering = true;
+    client.last_activity = time(NULL);
+    if (!SetClientEvents(client_fd, client, EPOLLIN | EPOLLET))
+        return;
+    DrainLingeringClient(client_fd);
+}
+
+void Server::DrainLingeringClient(int client_fd) {
+    char buffer[4096];
+    while (true) {
+        ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer));
+        if (bytes_read > 0)
+            continue;
+        // the client has seen the response and closed its side, or the connection is gone
+        if (bytes_read == 0 || errno != EAGAIN) {
+            CloseClient(client_fd);
+        }
+        return;
+    }
+}
+
+// the timeouts have a granularity of seconds, so one sweep per second is enough
+void Server::RunTimers(const std::vector<ServerConfig> &configs) {
+    time_t now = time(NULL);
+    if (now == _last_timer_run) {
+        return;
+    }
+    _last_timer_run = now;
+
+    CloseIdleClients(now);
+    CheckCgiProcesses(now, configs);
+    ExpireCgiQueue(now, configs);
+    _cgi_workers.maintain(now);
+}
+
+// close persistent connections that have waited longer than keepalive_timeout for their next request,
+// and refused ones whose client hasn't closed within LINGER_TIMEOUT
+void Server::CloseIdleClients(time_t now) {
+    std::vector<int> idle_fds;
+    for (auto it = _clients.begin(); it != _clients.end(); ++it) {
+        const ClientContext &client = it->second;
+        bool waiting_for_request = client.requests_served > 0 && client.read_buffer.empty() && client.response.empty() && !client.cgi_request && !client.body_job;
+        if (waiting_for_request && now - client.last_activity >= client.keepalive_timeout) {
+            idle_fds.push_back(it->first);
+        } else if (client.lingering && now - client.last_activity >= LINGER_TIMEOUT) {
+            idle_fds.push_back(it->first);
+        }
+    }
+
+    for (size_t i = 0; i < idle_fds.size(); ++i) {
+        CloseClient(idle_fds[i]);
     }
 }
 
@@ -363,9 +1280,11 @@ void Server::AcceptConnection(int listening_fd) {
         int client_fd = AcceptClient(listening_fd);
         if (client_fd == -1) return;  // Stop accepting clients if no more are available
 
-        SetNonBlocking(client_fd);
-        AddClientToEpoll(client_fd);
-        _clients.emplace(client_fd, ClientContext(client_fd, listening_fd));
+        if (!AddClientToEpoll(client_fd)) continue;
+        ClientContext &client = _clients.emplace(client_fd, ClientContext(client_fd, listening_fd)).first->second;
+        // the address's default server block decides for every request on the connection
+        const ServerConfig &config = FindListeningSocket(listening_fd)->configs.front();
+        client.parser.setBodyBufferSize(config.client_body_buffer_size);
     }
 }
 
@@ -373,7 +1292,8 @@ void Server::AcceptConnection(int listening_fd) {
 int Server::AcceptClient(int listening_fd) {
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(listening_fd, (struct sockaddr*)&client_addr, &client_len);
+    // non-blocking like the listener, and close-on-exec so a script can't hold the connection open after it is closed
+    int client_fd = accept4(listening_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
     
     if (client_fd == -1) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -387,13 +1307,15 @@ int Server::AcceptClient(int listening_fd) {
 }
 
 // Add the client file descriptor to the epoll instance
-void Server::AddClientToEpoll(int client_fd) {
+bool Server::AddClientToEpoll(int client_fd) {
     _event.events = EPOLLIN | EPOLLET;
     _event.data.fd = client_fd;
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, client_fd, &_event) == -1) {
         close(client_fd);
         std::cerr << RED << "Error: Failed to add client to epoll." << RESET << std::endl;
+        return false;
     }
+    return true;
 }
 
 
@@ -403,10 +1325,30 @@ void Server::AddClientToEpoll(int client_fd) {
 \* ----------------------------- */
 
 void Server::CloseClient(int client_fd) {
+    // only a connection of this worker is closed, a descriptor that was closed before may
+    // already belong to something else
+    auto it = _clients.find(client_fd);
+    if (it == _clients.end()) {
+        return;
+    }
+
+    // stop watching the pipe of an unfinished response, the body closes it with the context
+    UnwatchResponsePipe(it->second);
+    // a script still running for this connection is killed along with its request
+    if (it->second.cgi_request && it->second.cgi_request->getCgi()) {
+        CloseCgiFds(*it->second.cgi_request->getCgi());
+    }
+    // and a FastCGI backend or pre-forked interpreter is told to stop
+    _cgi_workers.cancel(client_fd);
+    _fastcgi.abort(client_fd);
+
     // remove the client from epoll monitoring and close the connection
     epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
     close(client_fd);
-    _clients.erase(client_fd);
+    _clients.erase(it);
+    _cgi_cache_waiting.erase(client_fd);
+    _cgi_queued.erase(client_fd);
+    _disk_waiting.erase(client_fd);
 }
 
 
@@ -428,3 +1370,22 @@ void Server::SetNonBlocking(int sock) {
         exit(EXIT_FAILURE);
     }
 }
+
+
+
+/* -------------------------- *\
+|-----------PinToCpu-----------|
+\* -------------------------- */
+
+void Server::PinToCpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    // bind the calling thread (this worker's event loop) to a single CPU
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        std::cerr << RED << "Warning: could not pin worker " << _worker_id << " to CPU " << cpu
+                  << ": " << strerror(err) << RESET << std::endl;
+    }
+}
@@ -0,0 +1,61 @@
+#include "Spawn.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <spawn.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static std::vector<char *> pointers(const std::vector<std::string> &strings) {
+    std::vector<char *> result;
+    for (size_t i = 0; i < strings.size(); ++i) {
+        result.push_back(const_cast<char *>(strings[i].c_str()));
+    }
+    result.push_back(NULL);
+    return result;
+}
+
+pid_t spawnProcess(const SpawnOptions &options) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attributes);
+
+    // dup2() onto 0, 1 and 2 clears close-on-exec on the copies, the originals are closed by the exec
+    int redirects[3] = {options.stdin_fd, options.stdout_fd, options.stderr_fd};
+    for (int target = 0; target < 3; ++target) {
+        if (redirects[target] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, redirects[target], target);
+        }
+    }
+    // whatever descriptor was opened without close-on-exec stays with the server all the same
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+    if (!options.cwd.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions, options.cwd.c_str());
+    }
+
+    // the server ignores SIGPIPE, the child starts with the default action and nothing blocked
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigset_t unblocked;
+    sigemptyset(&unblocked);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setsigmask(&attributes, &unblocked);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    std::vector<char *> argv = pointers(options.argv);
+    std::vector<char *> envp = pointers(options.env);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, options.path.c_str(), &actions, &attributes, argv.data(), options.env.empty() ? environ : envp.data());
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
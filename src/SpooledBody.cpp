@@ -0,0 +1,66 @@
+#include "SpooledBody.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+SpooledBody::SpooledBody() : _fd(-1), _size(0) {}
+
+SpooledBody::~SpooledBody() {
+    if (_fd != -1) {
+        close(_fd);
+    }
+}
+
+bool SpooledBody::open() {
+    const char *tmpdir = std::getenv("TMPDIR");
+    std::string dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+
+    // O_TMPFILE never has a name, nothing is left behind if the server dies
+    _fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (_fd != -1) {
+        return true;
+    }
+    // filesystems without it get a named file that is unlinked right away
+    std::string path = dir + "/webserv-body-XXXXXX";
+    _fd = mkostemp(&path[0], O_CLOEXEC);
+    if (_fd == -1) {
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool SpooledBody::append(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t bytes = pwrite(_fd, data, size, _size);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += bytes;
+        size -= bytes;
+        _size += bytes;
+    }
+    return true;
+}
+
+bool SpooledBody::read(std::string &out) const {
+    out.resize(_size);
+    size_t offset = 0;
+    while (offset < _size) {
+        ssize_t bytes = pread(_fd, &out[offset], _size - offset, offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            out.clear();
+            return false;
+        }
+        offset += bytes;
+    }
+    return true;
+}
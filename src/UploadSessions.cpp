@@ -0,0 +1,193 @@
+#include "UploadSessions.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+UploadSession::UploadSession(const std::string &path, const std::string &tmp_path, int fd, off_t length) : _path(path), _tmp_path(tmp_path), _fd(fd), _length(length), _writers(0), _last_activity(time(NULL)), _closed(false), _committed(false) {}
+
+UploadSession::~UploadSession() {
+    close(_fd);
+    if (!_committed) {
+        unlink(_tmp_path.c_str());
+    }
+}
+
+int UploadSession::openPart() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed) {
+        errno = ESTALE;
+        return -1;
+    }
+    int fd = fcntl(_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd != -1) {
+        _writers++;
+        _last_activity = time(NULL);
+    }
+    return fd;
+}
+
+void UploadSession::closePart(off_t start, off_t end) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writers--;
+    _last_activity = time(NULL);
+    if (end <= start) {
+        return;
+    }
+
+    // swallow every range the new one touches or overlaps
+    auto it = _ranges.upper_bound(start);
+    if (it != _ranges.begin() && std::prev(it)->second >= start) {
+        --it;
+    }
+    while (it != _ranges.end() && it->first <= end) {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        it = _ranges.erase(it);
+    }
+    _ranges[start] = end;
+}
+
+std::string UploadSession::ranges() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::string list;
+    for (auto it = _ranges.begin(); it != _ranges.end(); ++it) {
+        if (!list.empty()) {
+            list += ",";
+        }
+        list += std::to_string(it->first) + "-" + std::to_string(it->second - 1);
+    }
+    return list;
+}
+
+int UploadSession::commit(bool &replaced) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool complete = _length == 0 || (_ranges.size() == 1 && _ranges.begin()->first == 0 && _ranges.begin()->second == _length);
+    if (_closed || _writers > 0 || !complete) {
+        return 409;
+    }
+
+    struct stat st;
+    replaced = stat(_path.c_str(), &st) == 0;
+    if (rename(_tmp_path.c_str(), _path.c_str()) == -1) {
+        std::cerr << "Error saving uploaded file " << _path << ": " << strerror(errno) << std::endl;
+        return 500;
+    }
+    _closed = true;
+    _committed = true;
+    std::cout << "File uploaded successfully: " << _path << std::endl;
+    return 0;
+}
+
+void UploadSession::abort() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+}
+
+bool UploadSession::expired(time_t now, int timeout) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _writers == 0 && now - _last_activity >= timeout;
+}
+
+UploadSessions::UploadSessions(int timeout) : _timeout(timeout) {}
+
+std::shared_ptr<UploadSession> UploadSessions::create(const std::string &path, off_t length, std::string &id) {
+    // ids can't be guessed, knowing one is what allows writing to the upload
+    unsigned char random[16];
+    if (getrandom(random, sizeof(random), 0) != static_cast<ssize_t>(sizeof(random))) {
+        std::cerr << "Failed to create an upload id: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    static const char hex[] = "0123456789abcdef";
+    id.clear();
+    for (size_t i = 0; i < sizeof(random); ++i) {
+        id += hex[random[i] >> 4];
+        id += hex[random[i] & 15];
+    }
+
+    std::string tmp_path = path.substr(0, path.rfind('/') + 1) + ".upload-" + id;
+    if (!createDirectories(path.substr(0, path.rfind('/')))) {
+        return nullptr;
+    }
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        std::cerr << "Error opening file for writing: " << tmp_path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // the whole file is reserved up front, parts arriving in any order fill it in place.
+    // filesystems without fallocate() get a sparse file of the right size
+    if (length > 0 && fallocate(fd, 0, 0, length) == -1 && (errno != EOPNOTSUPP || ftruncate(fd, length) == -1)) {
+        std::cerr << "Error reserving space for upload " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        unlink(tmp_path.c_str());
+        return nullptr;
+    }
+
+    auto session = std::make_shared<UploadSession>(path, tmp_path, fd, length);
+    std::lock_guard<std::mutex> lock(_mutex);
+    expire(time(NULL));
+    _sessions[id] = session;
+    return session;
+}
+
+std::shared_ptr<UploadSession> UploadSessions::find(const std::string &id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    expire(time(NULL));
+    auto it = _sessions.find(id);
+    if (it == _sessions.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void UploadSessions::remove(const std::string &id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sessions.erase(id);
+}
+
+// called with _mutex held. a part still writing to a dropped session keeps its file until it is done
+void UploadSessions::expire(time_t now) {
+    for (auto it = _sessions.begin(); it != _sessions.end();) {
+        if (it->second->expired(now, _timeout)) {
+            it->second->abort();
+            it = _sessions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// a session that was committed or aborted meanwhile takes no more parts
+UploadPart::UploadPart(const std::shared_ptr<UploadSession> &session, off_t offset) : FileSink(session->path(), session->openPart(), offset), _session(session), _start(offset), _open(_fd != -1) {
+    if (!_open) {
+        _status = errno == ESTALE ? 409 : 500;
+    }
+}
+
+UploadPart::~UploadPart() {
+    if (_open) {
+        _session->closePart(_start, _offset);
+    }
+}
+
+// a chunked part has no length up front, it may not run past the end of the upload either
+int UploadPart::write(const char *data, size_t size) {
+    if (_status == 0 && _offset + static_cast<off_t>(size) > _session->length()) {
+        std::cerr << "Upload part runs past the end of " << _path << std::endl;
+        _status = 400;
+    }
+    return FileSink::write(data, size);
+}
+
+int UploadPart::finish() {
+    if (_open) {
+        _session->closePart(_start, _offset);
+        _open = false;
+    }
+    return _status;
+}
@@ -12,19 +12,33 @@
 std::string Request::getCurrentTimeHttpFormat()
 {
     // get the current time in seconds since epoch
-    std::time_t now = std::time(nullptr);
+    return formatHttpDate(std::time(nullptr));
+}
 
-    // convert to GMT but idk why we needed to do this
-    std::tm *gmt_time = std::gmtime(&now);
+// format a point in time as an HTTP-date (RFC 7231), e.g. for Date and Last-Modified
+std::string Request::formatHttpDate(time_t time)
+{
+    // convert to GMT, gmtime_r because several worker threads format dates at once
+    std::tm gmt_time;
+    gmtime_r(&time, &gmt_time);
 
     // use a string stream to format the time in the required HTTP date format
     std::ostringstream ss;
-    ss << std::put_time(gmt_time, "%a, %d %b %Y %H:%M:%S GMT");
+    ss << std::put_time(&gmt_time, "%a, %d %b %Y %H:%M:%S GMT");
 
     // return the formatted date string
     return ss.str();
 }
 
+// the Connection header line matching the keep-alive decision for this request
+std::string Request::connectionHeader() const
+{
+    if (_keep_alive) {
+        return "Connection: keep-alive\r\n";
+    }
+    return "Connection: close\r\n";
+}
+
 // find the best matching location for a given URL
 LocationConfig* Request::findLocation(const std::string& url) {
     // initialize a pointer for the best match
@@ -80,40 +94,3 @@ std::string Request::getAbsolutePath(const std::string &path) {
     return std::string(absPath) + "/" + path;
 }
 
-// recursively create directories for a given path
-void Request::createDir(const std::string &path) {
-    // used to check the status of the path (e.g., whether it exists)
-    struct stat st;
-    // start with an empty string to build the path step-by-step
-    std::string currentPath = "";
-    // use a string stream to split the path into components
-    std::istringstream pathStream(path);
-    // to store each directory part as we iterate
-    std::string directory;
-
-    // check if the path is absolute (starts with a "/") and set the base path
-    if (path[0] == '/') {
-        // absolute path handling
-        currentPath = "/";
-    }
-
-    // iterate through each directory in the provided path
-    while (std::getline(pathStream, directory, '/')) {
-        
-        if (!directory.empty()) { // skip empty directory names (in case of multiple slashes)
-            // append the current directory to the path
-            currentPath += directory + "/";
-
-            // check if the directory already exists using the stat function
-            if (stat(currentPath.c_str(), &st) == -1) {  
-                // directory doesn't exist, so we try to create it
-                if (mkdir(currentPath.c_str(), 0755) == -1) {  // 0755 gives read/write/execute permissions for the owner, and read/execute for others
-                    // if the directory cannot be created, serve a 500 Internal Server Error
-                    std::cerr << "Failed to create directory: " << currentPath << std::endl;
-                    ServeErrorPage(500);
-                    return;
-                }
-            }
-        }
-    }
-}
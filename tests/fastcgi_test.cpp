@@ -0,0 +1,86 @@
+// FastCGI: name-value pairs around the one- and four-byte length boundary, and records that arrive
+// split across reads.
+//
+//   make test
+
+#include "FastCgi.hpp"
+
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+// encoded and decoded again, the pairs come back as they were
+static void expectParams(const char *name, const FastCgiParams &params) {
+    FastCgiParams decoded = fastcgiDecodeParams(fastcgiEncodeParams(params));
+    if (decoded != params) {
+        std::printf("FAIL  params %-24s -> %zu pairs\n", name, decoded.size());
+        failures++;
+    }
+}
+
+// a stream of data, split into records and fed to the parser read by read, comes back whole
+static void expectStream(const char *name, const std::string &data, size_t read_size) {
+    std::string wire;
+    fastcgiAppendBeginRequest(wire, 1, true);
+    fastcgiAppendStream(wire, FCGI_STDOUT, 1, data);
+
+    FastCgiParser parser;
+    FastCgiRecord record;
+    std::string buffer;
+    std::string stream;
+    size_t records = 0;
+    bool ended = false;
+    for (size_t pos = 0; pos < wire.size(); pos += read_size) {
+        buffer += wire.substr(pos, read_size);
+        while (parser.next(buffer, record)) {
+            records++;
+            if (record.type == FCGI_STDOUT && record.request_id == 1) {
+                ended = record.content.empty();
+                stream += record.content;
+            }
+        }
+    }
+    // the begin request, one record per FCGI_MAX_CONTENT bytes and the empty one closing the stream
+    size_t expected_records = 2 + (data.size() + FCGI_MAX_CONTENT - 1) / FCGI_MAX_CONTENT;
+    if (stream != data || !ended || records != expected_records) {
+        std::printf("FAIL  stream %-24s reads of %-6zu -> %zu bytes in %zu records%s\n", name, read_size,
+            stream.size(), records, ended ? "" : ", not ended");
+        failures++;
+    }
+}
+
+int main() {
+    expectParams("empty", {});
+    expectParams("short", {{"REQUEST_METHOD", "GET"}, {"QUERY_STRING", ""}});
+    expectParams("127 bytes", {{std::string(127, 'n'), std::string(127, 'v')}});
+    expectParams("128 bytes", {{std::string(128, 'n'), std::string(128, 'v')}});
+    expectParams("long and short mixed", {{"HTTP_COOKIE", std::string(70000, 'c')}, {"A", "b"}, {"", std::string(300, 'x')}});
+
+    // a truncated pair is dropped, the complete ones before it are kept
+    std::string encoded = fastcgiEncodeParams({{"A", "b"}, {"NAME", std::string(200, 'v')}});
+    FastCgiParams truncated = fastcgiDecodeParams(encoded.substr(0, encoded.size() - 1));
+    if (truncated != FastCgiParams{{"A", "b"}}) {
+        std::printf("FAIL  params truncated pair           -> %zu pairs\n", truncated.size());
+        failures++;
+    }
+
+    std::string large;
+    for (size_t i = 0; i < 3 * FCGI_MAX_CONTENT + 5; ++i) {
+        large += static_cast<char>(i * 7);
+    }
+    static const size_t read_sizes[] = {1, 7, 8, 4096, 1 << 20};
+    for (size_t read_size : read_sizes) {
+        expectStream("empty", "", read_size);
+        expectStream("padded", "hello", read_size);
+        expectStream("multiple of 8", "12345678", read_size);
+        expectStream("several records", large, read_size);
+    }
+
+    if (failures > 0) {
+        std::printf("fastcgi_test: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("fastcgi_test: all passed\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+// HttpParser: chunked decoding, Content-Length and Transfer-Encoding conflicts, and requests that
+// arrive in pieces. every case is fed whole, a byte at a time and in odd-sized reads.
+//
+//   make test
+
+#include "HttpParser.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+// what a case ends in: the state, the status a rejected request is answered with, the body and
+// whatever is left in the buffer behind the request, a pipelined one
+struct Result {
+    HttpParser::State state;
+    int status;
+    std::string body;
+    std::string rest;
+};
+
+static const char *stateName(HttpParser::State state) {
+    static const char *names[] = {"REQUEST_LINE", "HEADERS", "HEADERS_DONE", "BODY", "COMPLETE", "ERROR"};
+    return names[state];
+}
+
+// append the input read by read, the way the server's buffer grows, and parse after every read
+static Result run(const std::string &input, size_t read_size, size_t max_size) {
+    HttpParser parser;
+    std::string buffer;
+    HttpParser::State state = parser.getState();
+    size_t pos = 0;
+    while (pos < input.size() && state != HttpParser::COMPLETE && state != HttpParser::ERROR) {
+        size_t bytes = std::min(read_size, input.size() - pos);
+        buffer += input.substr(pos, bytes);
+        pos += bytes;
+        state = parser.parse(buffer);
+        if (state == HttpParser::HEADERS_DONE) {
+            parser.startBody(nullptr, max_size);
+            state = parser.parse(buffer);
+        }
+    }
+
+    Result result;
+    result.state = state;
+    // the read that completed the request may have stopped short of the next one
+    if (state == HttpParser::COMPLETE) {
+        result.rest = buffer.substr(parser.getRequestLength()) + input.substr(pos);
+    }
+    HttpRequest request = parser.takeRequest();
+    result.status = request.error_status;
+    result.body = request.body;
+    return result;
+}
+
+static void expect(const char *name, const std::string &input, size_t max_size, HttpParser::State state, int status, const std::string &body, const std::string &rest = "") {
+    static const size_t read_sizes[] = {std::string::npos, 1, 7};
+    for (size_t read_size : read_sizes) {
+        Result result = run(input, read_size, max_size);
+        if (result.state != state || result.status != status || result.body != body || result.rest != rest) {
+            std::printf("FAIL  %-32s reads of %-4lld -> %s %d, body \"%s\", rest \"%s\"\n", name,
+                read_size == std::string::npos ? -1LL : static_cast<long long>(read_size), stateName(result.state),
+                result.status, result.body.c_str(), result.rest.c_str());
+            failures++;
+        }
+    }
+}
+
+int main() {
+    const size_t unlimited = std::string::npos;
+
+    // bodies framed by Content-Length, or by nothing at all
+    expect("no body", "GET / HTTP/1.1\r\nHost: x\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "");
+    expect("content-length", "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", unlimited, HttpParser::COMPLETE, 0, "hello");
+    expect("content-length 0", "POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "");
+    expect("empty lines before request", "\r\n\r\nGET / HTTP/1.1\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "");
+    expect("pipelined behind a body", "POST / HTTP/1.1\r\nContent-Length: 2\r\n\r\nokGET / HTTP/1.1\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "ok", "GET / HTTP/1.1\r\n\r\n");
+
+    // incomplete requests wait for the rest, a chunk is decoded as far as it arrived
+    expect("headers not done", "GET / HTTP/1.1\r\nHost: x\r\n", unlimited, HttpParser::HEADERS, 0, "");
+    expect("body not done", "POST / HTTP/1.1\r\nContent-Length: 9\r\n\r\nhello", unlimited, HttpParser::BODY, 0, "");
+    expect("chunk not done", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel", unlimited, HttpParser::BODY, 0, "hel");
+
+    // chunked bodies are decoded, extensions and trailer fields are dropped
+    expect("chunked", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "hello world");
+    expect("chunked upper case hex", "POST / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\nA\r\n0123456789\r\n0\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "0123456789");
+    expect("chunk extensions", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3;name=value\r\nabc\r\n0;last\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "abc");
+    expect("trailer fields", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\nChecksum: 1\r\nOther: 2\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "abc");
+    expect("chunked empty", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "");
+    expect("pipelined behind chunks", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nok\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n", unlimited, HttpParser::COMPLETE, 0, "ok", "GET / HTTP/1.1\r\n\r\n");
+    expect("chunked within the limit", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", 5, HttpParser::COMPLETE, 0, "hello");
+
+    // malformed chunks
+    expect("chunk size not hex", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\nabc\r\n0\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("chunk size missing", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n;ext\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("chunk size overflows", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10000000000000000\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("chunk longer than its size", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcd\r\n0\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("chunks past the limit", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n1\r\n!\r\n0\r\n\r\n", 5, HttpParser::ERROR, 413, "");
+    expect("one chunk past the limit", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nffffff\r\n", 5, HttpParser::ERROR, 413, "");
+
+    // framing headers that conflict or can't be read
+    expect("length and chunked", "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("chunked and length", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n0\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("unknown coding", "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n0\r\n\r\n", unlimited, HttpParser::ERROR, 501, "");
+    expect("length not a number", "POST / HTTP/1.1\r\nContent-Length: 5x\r\n\r\nhello", unlimited, HttpParser::ERROR, 400, "");
+    expect("negative length", "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("two different lengths", "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!", unlimited, HttpParser::ERROR, 400, "");
+
+    // malformed request lines and headers
+    expect("no target", "GET\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("header without colon", "GET / HTTP/1.1\r\nHost x\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+    expect("header too large", "GET / HTTP/1.1\r\nX: " + std::string(MAX_HEADER_SIZE, 'a') + "\r\n\r\n", unlimited, HttpParser::ERROR, 400, "");
+
+    if (failures > 0) {
+        std::printf("http_parser_test: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("http_parser_test: all passed\n");
+    return 0;
+}
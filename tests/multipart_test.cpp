@@ -0,0 +1,130 @@
+// MultipartUpload: the boundary scanner, with the body split at every offset so each delimiter is
+// cut across two writes once, and fed a byte at a time.
+//
+//   make test
+
+#include "MultipartUpload.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+typedef std::map<std::string, std::string> Files;
+
+static int failures = 0;
+
+// name and content of every file in dir, which is emptied for the next run
+static Files collect(const std::string &dir) {
+    Files files;
+    DIR *listing = opendir(dir.c_str());
+    if (!listing) {
+        return files;
+    }
+    while (struct dirent *entry = readdir(listing)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::ifstream file(dir + "/" + name, std::ios::binary);
+        files[name] = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        unlink((dir + "/" + name).c_str());
+    }
+    closedir(listing);
+    return files;
+}
+
+// the first split bytes of the body in one write, the rest in writes of read_size. 0 or the first status a write or finish returned
+static int run(const std::string &dir, const std::string &body, size_t split, size_t read_size) {
+    MultipartUpload upload("XX", dir);
+    upload.open();
+    int status = 0;
+    size_t pos = 0;
+    while (pos < body.size() && status == 0) {
+        size_t bytes = pos < split ? split - pos : std::min(read_size, body.size() - pos);
+        status = upload.write(body.data() + pos, bytes);
+        pos += bytes;
+    }
+    if (status == 0) {
+        status = upload.finish();
+    }
+    return status;
+}
+
+static void check(const char *name, const std::string &dir, const std::string &how, int status, int expected_status, const Files &expected) {
+    Files files = collect(dir);
+    if (status != expected_status || files != expected) {
+        std::printf("FAIL  %-28s %-14s -> %d,", name, how.c_str(), status);
+        for (Files::const_iterator it = files.begin(); it != files.end(); ++it) {
+            std::printf(" %s (%zu bytes)", it->first.c_str(), it->second.size());
+        }
+        std::printf("\n");
+        failures++;
+    }
+}
+
+static void expect(const char *name, const std::string &dir, const std::string &body, int status, const Files &expected) {
+    for (size_t split = 0; split <= body.size(); ++split) {
+        std::ostringstream how;
+        how << "split at " << split;
+        check(name, dir, how.str(), run(dir, body, split, body.size()), status, expected);
+    }
+    check(name, dir, "byte by byte", run(dir, body, 0, 1), status, expected);
+}
+
+// a part with a file, as browsers send it
+static std::string filePart(const std::string &filename, const std::string &content) {
+    return "--XX\r\nContent-Disposition: form-data; name=\"file\"; filename=\"" + filename + "\"\r\nContent-Type: application/octet-stream\r\n\r\n" + content + "\r\n";
+}
+
+int main() {
+    char dir_template[] = "/tmp/multipart_test.XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    // every completed part is announced on stdout
+    std::cout.setstate(std::ios::failbit);
+
+    std::string bytes;
+    for (int i = 0; i < 256; ++i) {
+        bytes += static_cast<char>(i);
+    }
+
+    // parts are stored under their file names, fields without one are dropped
+    expect("one file", dir, filePart("a.txt", "hello") + "--XX--\r\n", 0, {{"a.txt", "hello"}});
+    expect("empty file", dir, filePart("a.txt", "") + "--XX--", 0, {{"a.txt", ""}});
+    expect("field and files", dir, "--XX\r\nContent-Disposition: form-data; name=\"text\"\r\n\r\nvalue\r\n" + filePart("a.txt", "one") + filePart("b.txt", "two") + "--XX--\r\n", 0, {{"a.txt", "one"}, {"b.txt", "two"}});
+    expect("preamble and epilogue", dir, "ignored\r\n" + filePart("a.txt", "hello") + "--XX--\r\nignored too", 0, {{"a.txt", "hello"}});
+    expect("part without headers", dir, "--XX\r\n\r\nvalue\r\n--XX--", 0, {});
+    expect("padding after boundary", dir, "--XX \t\r\nContent-Disposition: form-data; filename=\"a.txt\"\r\n\r\nhello\r\n--XX--", 0, {{"a.txt", "hello"}});
+    expect("directories in file name", dir, filePart("../../etc/a.txt", "hello") + filePart("C:\\Users\\b.txt", "world") + "--XX--", 0, {{"a.txt", "hello"}, {"b.txt", "world"}});
+
+    // content that starts like a delimiter is passed on
+    expect("almost a delimiter", dir, filePart("a.txt", "a\r\n--Xb\r\n--\r\nc\r\n-") + "--XX--", 0, {{"a.txt", "a\r\n--Xb\r\n--\r\nc\r\n-"}});
+    expect("boundary without CRLF", dir, filePart("a.txt", "--XX--XX\n--XX") + "--XX--", 0, {{"a.txt", "--XX--XX\n--XX"}});
+    expect("content ending in CR", dir, filePart("a.txt", "abc\r") + "--XX--", 0, {{"a.txt", "abc\r"}});
+    expect("every byte value", dir, filePart("a.bin", bytes + bytes) + "--XX--", 0, {{"a.bin", bytes + bytes}});
+
+    // malformed bodies leave nothing behind
+    expect("no last boundary", dir, filePart("a.txt", "hello"), 400, {});
+    expect("cut in the headers", dir, "--XX\r\nContent-Disposition: form-data; filename=\"a.txt\"\r\n", 400, {});
+    expect("garbage after boundary", dir, "--XXjunk\r\n\r\nvalue\r\n--XX--", 400, {});
+    expect("no boundary at all", dir, "hello", 400, {});
+
+    rmdir(dir.c_str());
+    if (failures > 0) {
+        std::printf("multipart_test: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("multipart_test: all passed\n");
+    return 0;
+}
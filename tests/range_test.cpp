@@ -0,0 +1,62 @@
+// Range header parsing (RFC 7233), the edge cases around the end of the file in particular.
+//
+//   make test
+
+#include "Request.hpp"
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::vector<std::pair<off_t, off_t>> Ranges;
+
+static int failures = 0;
+
+static void expect(const std::string &header, off_t size, bool parsed, const Ranges &expected) {
+    Ranges ranges;
+    bool result = Request::parseRanges(header, size, ranges);
+    if (result != parsed || (parsed && ranges != expected)) {
+        std::printf("FAIL  %-28s size %-6lld -> %s,", header.c_str(), static_cast<long long>(size), result ? "parsed" : "ignored");
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            std::printf(" %lld-%lld", static_cast<long long>(ranges[i].first), static_cast<long long>(ranges[i].second));
+        }
+        std::printf("\n");
+        failures++;
+    }
+}
+
+int main() {
+    const off_t size = 1497;
+
+    // satisfiable ranges, clipped to the file
+    expect("bytes=0-99", size, true, {{0, 99}});
+    expect("bytes=1400-", size, true, {{1400, 1496}});
+    expect("bytes=1496-", size, true, {{1496, 1496}});
+    expect("bytes=1000-99999", size, true, {{1000, 1496}});
+    expect("bytes=-100", size, true, {{1397, 1496}});
+    expect("bytes=-99999", size, true, {{0, 1496}});
+    expect("bytes=0-0, -1", size, true, {{0, 0}, {1496, 1496}});
+
+    // ranges starting at or past the end are unsatisfiable, a 416 instead of the whole file
+    expect("bytes=1497-", size, true, {});
+    expect("bytes=99999-", size, true, {});
+    expect("bytes=1497-2000", size, true, {});
+    expect("bytes=-0", size, true, {});
+    expect("bytes=0-", 0, true, {});
+    expect("bytes=99999-,0-9", size, true, {{0, 9}});
+
+    // malformed headers are ignored
+    expect("bytes=5-3", size, false, {});
+    expect("bytes=2000-1500", size, false, {});
+    expect("bytes=-", size, false, {});
+    expect("bytes=a-b", size, false, {});
+    expect("items=0-9", size, false, {});
+
+    if (failures > 0) {
+        std::printf("range_test: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("range_test: all passed\n");
+    return 0;
+}
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+# Runner for webserv's pre-forked CGI workers (cgi_worker_runner).
+#
+# The server starts this with the location's interpreter and its end of a socketpair as stdin,
+# then sends it one request at a time as FastCGI records. Each script is run in this process
+# with runpy, so the interpreter and the libraries the scripts import stay loaded between
+# requests. Its stdout and stderr are sent back as FCGI_STDOUT and FCGI_STDERR records while
+# it runs, its exit status as FCGI_END_REQUEST. The server replaces the worker after
+# cgi_worker_requests requests, or once it grows past cgi_worker_memory.
+#
+# Every run starts from the same environment, working directory, sys.path, signal handlers and
+# modules: whatever a script changes is undone afterwards, except that modules loaded from the
+# interpreter's installation (the standard library and site-packages) stay imported, along with
+# any state a script left in them. Threads, open files and child processes a script leaves
+# behind outlive it as well.
+
+import io
+import os
+import runpy
+import signal
+import socket
+import struct
+import sys
+import traceback
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_MAX_CONTENT = 65535
+
+
+def read_exactly(conn, length):
+    data = b''
+    while len(data) < length:
+        chunk = conn.recv(length - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def read_record(conn):
+    _, record_type, request_id, length, padding = struct.unpack('>BBHHBx', read_exactly(conn, 8))
+    content = read_exactly(conn, length + padding)[:length]
+    return record_type, request_id, content
+
+
+def record(record_type, request_id, content=b''):
+    padding = (8 - len(content) % 8) % 8
+    return struct.pack('>BBHHBx', 1, record_type, request_id, len(content), padding) + content + b'\0' * padding
+
+
+class RecordStream(io.RawIOBase):
+    """A script's stdout or stderr, every write leaves as records of one type."""
+
+    def __init__(self, conn, record_type, request_id):
+        super().__init__()
+        self.conn = conn
+        self.record_type = record_type
+        self.request_id = request_id
+        self.written = False
+
+    def writable(self):
+        return True
+
+    def write(self, data):
+        data = bytes(data)
+        # an empty record would end the stream, so nothing is sent for an empty write
+        for offset in range(0, len(data), FCGI_MAX_CONTENT):
+            self.conn.sendall(record(self.record_type, self.request_id, data[offset:offset + FCGI_MAX_CONTENT]))
+            self.written = True
+        return len(data)
+
+
+# the handlers a script may have replaced, SIG_DFL and SIG_IGN included
+def signal_handlers():
+    handlers = {}
+    for signum in signal.valid_signals():
+        try:
+            handlers[signum] = signal.getsignal(signum)
+        except (OSError, ValueError):
+            pass
+    return handlers
+
+
+# drop what a script imported from outside the interpreter's installation, its own modules and the
+# ones next to it, so the next script imports them afresh instead of seeing their state
+def unload_modules(before):
+    prefixes = tuple(os.path.join(os.path.realpath(p), '') for p in {sys.prefix, sys.base_prefix, sys.exec_prefix})
+    for name in [name for name in sys.modules if name not in before]:
+        path = getattr(sys.modules[name], '__file__', None)
+        if path is None or not os.path.realpath(path).startswith(prefixes):
+            del sys.modules[name]
+
+
+def decode_params(data):
+    params = {}
+    pos = 0
+
+    def length():
+        nonlocal pos
+        if data[pos] < 128:
+            pos += 1
+            return data[pos - 1]
+        value = struct.unpack('>I', data[pos:pos + 4])[0] & 0x7fffffff
+        pos += 4
+        return value
+
+    while pos < len(data):
+        name_length = length()
+        value_length = length()
+        name = data[pos:pos + name_length].decode('latin-1')
+        params[name] = data[pos + name_length:pos + name_length + value_length].decode('latin-1')
+        pos += name_length + value_length
+    return params
+
+
+# run one script with the request as its environment and stdin, like a forked CGI process would.
+# its output is buffered in 64 KB pieces and sent as it goes, so the server can stream it on
+def run_script(conn, request_id, params, body):
+    stdout = RecordStream(conn, FCGI_STDOUT, request_id)
+    stderr = RecordStream(conn, FCGI_STDERR, request_id)
+    saved = (dict(os.environ), os.getcwd(), sys.argv, sys.stdin, sys.stdout, sys.stderr)
+    path, modules, handlers = list(sys.path), set(sys.modules), signal_handlers()
+    status = 0
+
+    os.environ.clear()
+    os.environ.update(params)
+    sys.argv = [params.get('SCRIPT_FILENAME', '')]
+    sys.stdin = io.TextIOWrapper(io.BytesIO(body))
+    sys.stdout = io.TextIOWrapper(io.BufferedWriter(stdout, 65536))
+    sys.stderr = io.TextIOWrapper(io.BufferedWriter(stderr, 65536), line_buffering=True)
+    try:
+        os.chdir(params.get('DOCUMENT_ROOT', '.'))
+        # the script's directory comes first on the path, as when the interpreter runs it directly
+        sys.path.insert(0, os.path.dirname(os.path.abspath(sys.argv[0])))
+        runpy.run_path(sys.argv[0], run_name='__main__')
+    except SystemExit as e:
+        status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+    except BaseException as e:
+        # the traceback starts in the script, as if the interpreter had run it directly
+        tb = e.__traceback__
+        while tb is not None and tb.tb_frame.f_code.co_filename != sys.argv[0]:
+            tb = tb.tb_next
+        traceback.print_exception(type(e), e, tb or e.__traceback__)
+        status = 1
+    finally:
+        # a script may have closed its streams, whatever it left buffered is lost then
+        for stream in (sys.stdout, sys.stderr):
+            try:
+                stream.flush()
+            except ValueError:
+                pass
+        environ, cwd, sys.argv, sys.stdin, sys.stdout, sys.stderr = saved
+        os.environ.clear()
+        os.environ.update(environ)
+        os.chdir(cwd)
+        sys.path[:] = path
+        unload_modules(modules)
+        for signum, handler in handlers.items():
+            if signal.getsignal(signum) is not handler:
+                try:
+                    signal.signal(signum, handler)
+                except (OSError, ValueError, TypeError):
+                    pass
+
+    end = struct.pack('>IB3x', status & 0xffffffff, 0)
+    conn.sendall(record(FCGI_STDOUT, request_id)
+                 + (record(FCGI_STDERR, request_id) if stderr.written else b'')
+                 + record(FCGI_END_REQUEST, request_id, end))
+
+
+def main():
+    conn = socket.socket(fileno=sys.stdin.fileno())
+    requests = {}
+    while True:
+        try:
+            record_type, request_id, content = read_record(conn)
+        except (EOFError, ConnectionError):
+            # the server closed the socket: this worker is retired
+            return
+
+        if record_type == FCGI_GET_VALUES:
+            # one script at a time, the server queues the rest
+            conn.sendall(record(FCGI_GET_VALUES_RESULT, 0, b'\x0f\x01FCGI_MPXS_CONNS0'))
+        elif record_type == FCGI_BEGIN_REQUEST:
+            requests[request_id] = [b'', b'']
+        elif record_type == FCGI_PARAMS and request_id in requests:
+            requests[request_id][0] += content
+        elif record_type == FCGI_STDIN and request_id in requests:
+            if content:
+                requests[request_id][1] += content
+                continue
+            params, body = requests.pop(request_id)
+            run_script(conn, request_id, decode_params(params), body)
+
+
+if __name__ == '__main__':
+    main()